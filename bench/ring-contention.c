@@ -0,0 +1,391 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Contention benchmark of the tunnel queue. One producer, standing for
+ * the tcpip thread, pushes packets as fast as it can, while several
+ * readers, standing for the io_read RPCs, block until there's a packet
+ * and take it. When the queue is full the producer yields and tries
+ * again, or with --drop drops the packet from the tail as the stack
+ * does.
+ *
+ * Two queues are compared:
+ *
+ *   mutex  The former queue: a circular array under the tunnel lock,
+ *          which the producer takes for every packet, and a read_blocked
+ *          flag telling it to wake the readers up.
+ *   ring   The queue of hurdtunif.c: the lock-free ring of ring.h. The
+ *          producer only takes the lock to wake readers that announced
+ *          themselves in a waiter count. Readers serialize on the lock.
+ *
+ * For each it prints the packets delivered per second, the drops, and
+ * the time the producer spent per push.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <error.h>
+#include <argp.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <ring.h>
+
+#define MAX_READERS  64
+
+/* Default length of a tunnel queue */
+#define QUEUE_LEN  128
+
+static unsigned long count = 2000000;
+static unsigned int queue_len = QUEUE_LEN;
+static unsigned int work_ns;
+static int drop;
+static const char *readers_arg = "1,2,4";
+
+static const struct argp_option options[] = {
+  {"count", 'c', "N", 0, "Packets pushed per run (default 2000000)"},
+  {"length", 'l', "N", 0, "Length of the queue (default 128)"},
+  {"readers", 'r', "LIST", 0,
+   "Comma-separated numbers of readers (default 1,2,4)"},
+  {"work", 'w', "NS", 0,
+   "Time a reader spends on every packet it takes (default 0)"},
+  {"drop", 'd', 0, 0, "Drop packets that don't fit rather than wait"},
+  {0}
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+    {
+    case 'c':
+      count = strtoul (arg, 0, 0);
+      if (count == 0)
+	argp_error (state, "Invalid count: %s", arg);
+      break;
+    case 'l':
+      queue_len = strtoul (arg, 0, 0);
+      if (queue_len == 0)
+	argp_error (state, "Invalid length: %s", arg);
+      break;
+    case 'r':
+      readers_arg = arg;
+      break;
+    case 'w':
+      work_ns = strtoul (arg, 0, 0);
+      break;
+    case 'd':
+      drop = 1;
+      break;
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+
+  return 0;
+}
+
+static const struct argp argp = { options, parse_opt, 0,
+  "Compare the former and the lock-free tunnel queues under contention."
+};
+
+static uint64_t
+now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* What a reader does with a packet */
+static void
+consume (void)
+{
+  uint64_t until;
+
+  if (work_ns)
+    for (until = now_ns () + work_ns; now_ns () < until;);
+}
+
+/* The former queue */
+struct mutex_queue
+{
+  pthread_mutex_t lock;
+  pthread_cond_t read, select;
+  int read_blocked;
+  void **ring;
+  unsigned int head, len;
+};
+
+/* The queue of hurdtunif.c */
+struct ring_queue
+{
+  struct ring ring;
+  pthread_mutex_t lock;
+  pthread_cond_t read, select;
+  unsigned int waiters;
+};
+
+struct run
+{
+  int use_ring;
+  struct mutex_queue mq;
+  struct ring_queue rq;
+  int done;
+  unsigned long delivered;
+};
+
+static int
+mutex_push (struct mutex_queue *q, void *p)
+{
+  pthread_mutex_lock (&q->lock);
+
+  if (q->len == queue_len)
+    {
+      pthread_mutex_unlock (&q->lock);
+      return 0;
+    }
+
+  q->ring[(q->head + q->len) % queue_len] = p;
+  q->len++;
+
+  if (q->read_blocked)
+    {
+      q->read_blocked = 0;
+      pthread_cond_broadcast (&q->read);
+      pthread_cond_broadcast (&q->select);
+    }
+
+  pthread_mutex_unlock (&q->lock);
+  return 1;
+}
+
+/* Take a packet, waiting for one. Returns 0 once the run is over */
+static void *
+mutex_pop (struct run *run)
+{
+  struct mutex_queue *q = &run->mq;
+  void *p = 0;
+
+  pthread_mutex_lock (&q->lock);
+  while (q->len == 0 && !run->done)
+    {
+      q->read_blocked = 1;
+      pthread_cond_wait (&q->read, &q->lock);
+    }
+  if (q->len)
+    {
+      p = q->ring[q->head];
+      q->head = (q->head + 1) % queue_len;
+      q->len--;
+    }
+  pthread_mutex_unlock (&q->lock);
+
+  return p;
+}
+
+static void
+ring_wake (struct ring_queue *q)
+{
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&q->waiters, __ATOMIC_RELAXED))
+    {
+      pthread_mutex_lock (&q->lock);
+      pthread_cond_broadcast (&q->read);
+      pthread_cond_broadcast (&q->select);
+      pthread_mutex_unlock (&q->lock);
+    }
+}
+
+static int
+ring_queue_push (struct ring_queue *q, void *p)
+{
+  if (!ring_push (&q->ring, p, 0))
+    return 0;
+
+  ring_wake (q);
+  return 1;
+}
+
+static void *
+ring_queue_pop (struct run *run)
+{
+  struct ring_queue *q = &run->rq;
+  void *p;
+
+  pthread_mutex_lock (&q->lock);
+  while ((p = ring_pop (&q->ring, 0)) == 0
+	 && !__atomic_load_n (&run->done, __ATOMIC_ACQUIRE))
+    {
+      __atomic_add_fetch (&q->waiters, 1, __ATOMIC_SEQ_CST);
+      if (!ring_ready (&q->ring)
+	  && !__atomic_load_n (&run->done, __ATOMIC_ACQUIRE))
+	pthread_cond_wait (&q->read, &q->lock);
+      __atomic_sub_fetch (&q->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+  pthread_mutex_unlock (&q->lock);
+
+  return p;
+}
+
+static void *
+reader (void *arg)
+{
+  struct run *run = arg;
+  unsigned long n = 0;
+
+  while ((run->use_ring ? ring_queue_pop (run) : mutex_pop (run)) != 0)
+    {
+      consume ();
+      n++;
+    }
+
+  __atomic_add_fetch (&run->delivered, n, __ATOMIC_RELAXED);
+  return 0;
+}
+
+static int
+compare_u64 (const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Push COUNT packets through a queue read by NREADERS threads */
+static int
+run_queue (int use_ring, int nreaders)
+{
+  struct run run;
+  pthread_t threads[MAX_READERS];
+  uint64_t *push_ns, start, t, elapsed;
+  unsigned long i, dropped = 0;
+  pthread_mutex_t *lock;
+  pthread_cond_t *read;
+  int r, pushed;
+
+  memset (&run, 0, sizeof (run));
+  run.use_ring = use_ring;
+  if (use_ring)
+    {
+      if (ring_init (&run.rq.ring, queue_len))
+	error (1, ENOMEM, "ring");
+      pthread_mutex_init (&run.rq.lock, 0);
+      pthread_cond_init (&run.rq.read, 0);
+      pthread_cond_init (&run.rq.select, 0);
+      lock = &run.rq.lock;
+      read = &run.rq.read;
+    }
+  else
+    {
+      run.mq.ring = calloc (queue_len, sizeof (void *));
+      if (!run.mq.ring)
+	error (1, ENOMEM, "ring");
+      pthread_mutex_init (&run.mq.lock, 0);
+      pthread_cond_init (&run.mq.read, 0);
+      pthread_cond_init (&run.mq.select, 0);
+      lock = &run.mq.lock;
+      read = &run.mq.read;
+    }
+
+  push_ns = malloc (count * sizeof (uint64_t));
+  if (!push_ns)
+    error (1, ENOMEM, "samples");
+
+  for (r = 0; r < nreaders; r++)
+    {
+      errno = pthread_create (&threads[r], 0, reader, &run);
+      if (errno)
+	error (1, errno, "pthread_create");
+    }
+
+  start = now_ns ();
+  for (i = 0; i < count; i++)
+    {
+      do
+	{
+	  t = now_ns ();
+	  pushed = use_ring
+	    ? ring_queue_push (&run.rq, (void *) (uintptr_t) (i + 1))
+	    : mutex_push (&run.mq, (void *) (uintptr_t) (i + 1));
+	  push_ns[i] = now_ns () - t;
+	}
+      while (!pushed && !drop && sched_yield () == 0);
+      if (!pushed)
+	dropped++;
+    }
+
+  /* Let the readers drain the queue and leave */
+  pthread_mutex_lock (lock);
+  __atomic_store_n (&run.done, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast (read);
+  pthread_mutex_unlock (lock);
+  for (r = 0; r < nreaders; r++)
+    pthread_join (threads[r], 0);
+  elapsed = now_ns () - start;
+
+  qsort (push_ns, count, sizeof (uint64_t), compare_u64);
+  printf ("queue %s readers %d pushed %lu delivered %lu dropped %lu "
+	  "%.2f Mpackets/s push ns p50 %llu p99 %llu max %llu\n",
+	  use_ring ? "ring" : "mutex", nreaders, count, run.delivered,
+	  dropped, run.delivered * 1e3 / elapsed,
+	  (unsigned long long) push_ns[count / 2],
+	  (unsigned long long) push_ns[count - 1 - count / 100],
+	  (unsigned long long) push_ns[count - 1]);
+  fflush (stdout);
+
+  free (push_ns);
+  if (use_ring)
+    ring_destroy (&run.rq.ring);
+  else
+    free (run.mq.ring);
+
+  return run.delivered + dropped == count;
+}
+
+int
+main (int argc, char **argv)
+{
+  char *readers, *n, *save;
+  int nreaders, ok = 1;
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+
+  readers = strdup (readers_arg);
+  if (!readers)
+    error (1, ENOMEM, "%s", readers_arg);
+  for (n = strtok_r (readers, ",", &save); n; n = strtok_r (0, ",", &save))
+    {
+      nreaders = atoi (n);
+      if (nreaders <= 0 || nreaders > MAX_READERS)
+	error (1, 0, "Invalid number of readers: %s", n);
+
+      if (!run_queue (0, nreaders) || !run_queue (1, nreaders))
+	ok = 0;
+    }
+
+  if (!ok)
+    error (0, 0, "Packets were lost");
+
+  return !ok;
+}
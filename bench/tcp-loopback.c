@@ -0,0 +1,381 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Benchmark of local TCP connections, the way local database and cache
+ * clients use them. A client sends requests in several writes, e.g. a
+ * header and a body, and waits for the response of a server in this
+ * process, over the loopback.
+ *
+ * Each exchange is run three times:
+ *
+ *   default  The sockets as the stack sets them up. The translator
+ *            disables Nagle's algorithm on local connections, so this
+ *            should match nodelay.
+ *   nagle    Both sockets turn Nagle's algorithm on, as every connection
+ *            was before. The second write of a request waits for the
+ *            delayed ACK of the first.
+ *   nodelay  Both sockets turn Nagle's algorithm off.
+ *
+ * It prints the transactions per second and the percentiles of their
+ * latencies. With --stream it also measures bulk transfers.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <error.h>
+#include <argp.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/* Transactions whose latency is kept */
+#define MAX_SAMPLES  (1 << 20)
+
+/* How the sockets are set up */
+enum mode
+{
+  MODE_DEFAULT,
+  MODE_NAGLE,
+  MODE_NODELAY,
+};
+
+static const char *const mode_names[] = { "default", "nagle", "nodelay" };
+
+static struct in_addr address;
+static size_t request_size = 100;
+static size_t response_size = 100;
+static int pieces = 2;
+static double duration = 2;
+static int stream;
+
+static const struct argp_option options[] = {
+  {"address", 'a', "ADDRESS", 0,
+   "Local address to connect to (default 127.0.0.1)"},
+  {"request", 'q', "BYTES", 0, "Size of the requests (default 100)"},
+  {"response", 'r', "BYTES", 0, "Size of the responses (default 100)"},
+  {"pieces", 'p', "N", 0, "Writes a request is sent in (default 2)"},
+  {"duration", 'd', "SECONDS", 0, "Time each test runs (default 2)"},
+  {"stream", 's', 0, 0, "Measure bulk transfers too"},
+  {0}
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+    {
+    case 'a':
+      if (!inet_aton (arg, &address))
+	argp_error (state, "Invalid address: %s", arg);
+      break;
+    case 'q':
+      request_size = strtoul (arg, 0, 0);
+      break;
+    case 'r':
+      response_size = strtoul (arg, 0, 0);
+      break;
+    case 'p':
+      pieces = atoi (arg);
+      break;
+    case 'd':
+      duration = atof (arg);
+      if (duration <= 0)
+	argp_error (state, "Invalid duration: %s", arg);
+      break;
+    case 's':
+      stream = 1;
+      break;
+    case ARGP_KEY_END:
+      if (request_size == 0 || response_size == 0 || pieces <= 0
+	  || (size_t) pieces > request_size)
+	argp_error (state, "Invalid request, response or pieces");
+      break;
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+
+  return 0;
+}
+
+static const struct argp argp = { options, parse_opt, 0,
+  "Measure request/response exchanges over local TCP connections."
+};
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+read_full (int fd, char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0)
+    {
+      n = read (fd, buf, len);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n <= 0)
+	return -1;
+      buf += n;
+      len -= n;
+    }
+
+  return 0;
+}
+
+static int
+write_full (int fd, const char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0)
+    {
+      n = write (fd, buf, len);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n < 0)
+	return -1;
+      buf += n;
+      len -= n;
+    }
+
+  return 0;
+}
+
+/* Set FD up as MODE says */
+static void
+set_mode (int fd, enum mode mode)
+{
+  int nodelay = mode == MODE_NODELAY;
+
+  if (mode == MODE_DEFAULT)
+    return;
+
+  if (setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+		  sizeof (nodelay)) < 0)
+    error (1, errno, "TCP_NODELAY");
+}
+
+struct server
+{
+  int fd;
+  enum mode mode;
+  int stream;
+};
+
+/* Answer requests, or swallow a stream, until the client leaves */
+static void *
+serve (void *arg)
+{
+  struct server *s = arg;
+  size_t size = s->stream ? 65536 : request_size;
+  char *buf;
+
+  buf = calloc (1, size > response_size ? size : response_size);
+  if (!buf)
+    error (1, ENOMEM, "server");
+
+  set_mode (s->fd, s->mode);
+
+  if (s->stream)
+    while (read (s->fd, buf, size) > 0);
+  else
+    while (read_full (s->fd, buf, request_size) == 0
+	   && write_full (s->fd, buf, response_size) == 0);
+
+  close (s->fd);
+  free (buf);
+  return 0;
+}
+
+/* Connect to a server thread, both sockets set up as MODE says */
+static int
+connect_pair (enum mode mode, int for_stream, pthread_t * thread)
+{
+  struct sockaddr_in sin;
+  socklen_t len = sizeof (sin);
+  struct server *s;
+  int listener, fd;
+
+  listener = socket (PF_INET, SOCK_STREAM, 0);
+  if (listener < 0)
+    error (1, errno, "socket");
+
+  memset (&sin, 0, sizeof (sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr = address;
+  if (bind (listener, (struct sockaddr *) &sin, sizeof (sin)) < 0
+      || listen (listener, 1) < 0
+      || getsockname (listener, (struct sockaddr *) &sin, &len) < 0)
+    error (1, errno, "Cannot listen on %s", inet_ntoa (address));
+
+  fd = socket (PF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    error (1, errno, "socket");
+  if (connect (fd, (struct sockaddr *) &sin, sizeof (sin)) < 0)
+    error (1, errno, "connect");
+
+  s = malloc (sizeof (*s));
+  if (!s)
+    error (1, ENOMEM, "server");
+  s->fd = accept (listener, 0, 0);
+  if (s->fd < 0)
+    error (1, errno, "accept");
+  s->mode = mode;
+  s->stream = for_stream;
+  close (listener);
+
+  set_mode (fd, mode);
+
+  errno = pthread_create (thread, 0, serve, s);
+  if (errno)
+    error (1, errno, "pthread_create");
+
+  return fd;
+}
+
+static int
+compare_double (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+static void
+run_exchanges (enum mode mode)
+{
+  pthread_t thread;
+  char *request, *response;
+  double *samples, start, t, elapsed;
+  size_t n = 0, count = 0, piece, off;
+  int fd, i;
+
+  request = calloc (1, request_size);
+  response = malloc (response_size);
+  samples = malloc (MAX_SAMPLES * sizeof (double));
+  if (!request || !response || !samples)
+    error (1, ENOMEM, "client");
+
+  fd = connect_pair (mode, 0, &thread);
+
+  start = now ();
+  do
+    {
+      t = now ();
+      for (i = 0, off = 0; i < pieces; i++, off += piece)
+	{
+	  piece = i < pieces - 1 ? request_size / pieces : request_size - off;
+	  if (write_full (fd, request + off, piece) < 0)
+	    error (1, errno, "write");
+	}
+      if (read_full (fd, response, response_size) < 0)
+	error (1, errno, "read");
+      t = now () - t;
+
+      if (n < MAX_SAMPLES)
+	samples[n++] = t;
+      count++;
+      elapsed = now () - start;
+    }
+  while (elapsed < duration);
+
+  close (fd);
+  pthread_join (thread, 0);
+
+  qsort (samples, n, sizeof (double), compare_double);
+  printf ("rr %s request %zu pieces %d response %zu transactions %zu "
+	  "%.0f/s latency us p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+	  mode_names[mode], request_size, pieces, response_size,
+	  count, count / elapsed, samples[n / 2] * 1e6,
+	  samples[n * 9 / 10] * 1e6, samples[n - 1 - n / 100] * 1e6,
+	  samples[n - 1] * 1e6);
+  fflush (stdout);
+
+  free (request);
+  free (response);
+  free (samples);
+}
+
+static void
+run_stream (enum mode mode)
+{
+  pthread_t thread;
+  char *buf;
+  double start, elapsed;
+  size_t size = 65536, bytes = 0;
+  int fd;
+
+  buf = calloc (1, size);
+  if (!buf)
+    error (1, ENOMEM, "client");
+
+  fd = connect_pair (mode, 1, &thread);
+
+  start = now ();
+  do
+    {
+      if (write_full (fd, buf, size) < 0)
+	error (1, errno, "write");
+      bytes += size;
+      elapsed = now () - start;
+    }
+  while (elapsed < duration);
+
+  close (fd);
+  pthread_join (thread, 0);
+  elapsed = now () - start;
+
+  printf ("stream %s bytes %zu %.1f MB/s\n", mode_names[mode], bytes,
+	  bytes / elapsed / 1e6);
+  fflush (stdout);
+  free (buf);
+}
+
+int
+main (int argc, char **argv)
+{
+  enum mode mode;
+
+  inet_aton ("127.0.0.1", &address);
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+
+  for (mode = MODE_DEFAULT; mode <= MODE_NODELAY; mode++)
+    run_exchanges (mode);
+
+  if (stream)
+    for (mode = MODE_DEFAULT; mode <= MODE_NODELAY; mode++)
+      run_stream (mode);
+
+  return 0;
+}
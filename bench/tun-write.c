@@ -0,0 +1,423 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Throughput test of the tunnel write path. UDP packets from a peer on
+ * the tunnel are written to the tunnel device, addressed to a socket of
+ * ours, for every size asked for. Packets larger than one pool pbuf are
+ * spread over a chain of them, and writes of two pages or more arrive
+ * out of line and are referenced rather than copied. The socket checks
+ * that every packet arrives whole. The stack drops packets with a bad
+ * checksum, so corrupted ones show up as lost.
+ *
+ * On the Hurd the device is the tunnel node the translator serves:
+ *
+ *   settrans -fgap /servers/socket/2 /hurd/lwip \
+ *     -i /dev/tun0 -a 10.9.0.1 -m 255.255.255.0
+ *
+ * On Linux, for comparison, it's /dev/net/tun and --ifname names the
+ * interface to create, which must be given the address and brought up
+ * before the test starts sending, see --wait.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <error.h>
+#include <argp.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#ifdef __linux__
+#include <linux/if_tun.h>
+#endif
+
+#define IP_HLEN   20
+#define UDP_HLEN  8
+
+/* Largest packet written */
+#define MAX_PACKET  0xffff
+
+/* Packets written and not received yet */
+#define WINDOW  32
+
+/* Sizes written, in pool pbufs of about 1.5 KiB: 1, 3, 6, 22 and 40 */
+static const char *sizes_arg = "1024,4000,9000,32768,60000";
+
+static const char *device = "/dev/tun0";
+static const char *ifname = "bt0";
+static struct in_addr address, peer;
+static int port = 5001;
+static unsigned int count = 2000;
+static unsigned int wait_seconds;
+
+/* Receiver state */
+static int sock;
+static size_t packet_size;
+static uint32_t received, corrupt;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t progress = PTHREAD_COND_INITIALIZER;
+
+static const struct argp_option options[] = {
+  {"device", 'd', "FILE", 0, "Tunnel device (default /dev/tun0)"},
+  {"ifname", 'n', "NAME", 0,
+   "On Linux, the interface to create (default bt0)"},
+  {"address", 'a', "ADDRESS", 0,
+   "Our address on the tunnel (default 10.9.0.1)"},
+  {"peer", 'r', "ADDRESS", 0,
+   "Source of the packets, on the tunnel (default 10.9.0.2)"},
+  {"port", 'p', "PORT", 0, "UDP port to send to (default 5001)"},
+  {"sizes", 's', "LIST", 0,
+   "Comma-separated IP packet sizes (default 1024,4000,9000,32768,60000)"},
+  {"count", 'c', "N", 0, "Packets per size (default 2000)"},
+  {"wait", 'w', "SECONDS", 0,
+   "Wait before sending, to configure the interface"},
+  {0}
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+    {
+    case 'd':
+      device = arg;
+      break;
+    case 'n':
+      ifname = arg;
+      break;
+    case 'a':
+      if (!inet_aton (arg, &address))
+	argp_error (state, "Invalid address: %s", arg);
+      break;
+    case 'r':
+      if (!inet_aton (arg, &peer))
+	argp_error (state, "Invalid address: %s", arg);
+      break;
+    case 'p':
+      port = atoi (arg);
+      if (port <= 0 || port > 0xffff)
+	argp_error (state, "Invalid port: %s", arg);
+      break;
+    case 's':
+      sizes_arg = arg;
+      break;
+    case 'c':
+      count = strtoul (arg, 0, 0);
+      if (count == 0)
+	argp_error (state, "Invalid count: %s", arg);
+      break;
+    case 'w':
+      wait_seconds = strtoul (arg, 0, 0);
+      break;
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+
+  return 0;
+}
+
+static const struct argp argp = { options, parse_opt, 0,
+  "Write UDP packets of several sizes to a tunnel and check they arrive."
+};
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Ones' complement sum of LEN bytes at DATA, added to SUM */
+static uint32_t
+sum_bytes (uint32_t sum, const uint8_t * data, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i + 1 < len; i += 2)
+    sum += (data[i] << 8) | data[i + 1];
+  if (len & 1)
+    sum += data[len - 1] << 8;
+
+  return sum;
+}
+
+static uint16_t
+fold (uint32_t sum)
+{
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+
+  return ~sum & 0xffff;
+}
+
+/* The byte at OFFSET of the payload of packet SEQ */
+static uint8_t
+pattern (uint32_t seq, size_t offset)
+{
+  return (seq * 131 + offset * 7) & 0xff;
+}
+
+/* Build packet SEQ of SIZE bytes in BUF */
+static void
+build_packet (uint8_t * buf, size_t size, uint32_t seq)
+{
+  uint8_t *udp = buf + IP_HLEN, *payload = udp + UDP_HLEN;
+  size_t i, len = size - IP_HLEN - UDP_HLEN;
+  uint32_t sum;
+
+  memcpy (payload, &seq, sizeof (seq));
+  for (i = sizeof (seq); i < len; i++)
+    payload[i] = pattern (seq, i);
+
+  memset (buf, 0, IP_HLEN + UDP_HLEN);
+  buf[0] = 0x45;
+  buf[2] = size >> 8;
+  buf[3] = size & 0xff;
+  buf[4] = seq >> 8;
+  buf[5] = seq & 0xff;
+  buf[6] = 0x40;		/* Don't fragment */
+  buf[8] = 64;
+  buf[9] = IPPROTO_UDP;
+  memcpy (buf + 12, &peer, 4);
+  memcpy (buf + 16, &address, 4);
+  sum = fold (sum_bytes (0, buf, IP_HLEN));
+  buf[10] = sum >> 8;
+  buf[11] = sum & 0xff;
+
+  udp[0] = port >> 8;
+  udp[1] = port & 0xff;
+  udp[2] = port >> 8;
+  udp[3] = port & 0xff;
+  udp[4] = (size - IP_HLEN) >> 8;
+  udp[5] = (size - IP_HLEN) & 0xff;
+
+  /* Pseudo header, then the datagram */
+  sum = sum_bytes (0, buf + 12, 8) + IPPROTO_UDP + size - IP_HLEN;
+  sum = fold (sum_bytes (sum, udp, size - IP_HLEN));
+  if (sum == 0)
+    sum = 0xffff;
+  udp[6] = sum >> 8;
+  udp[7] = sum & 0xff;
+}
+
+/* Whether the datagram DATA of LEN bytes is intact */
+static int
+check_datagram (const uint8_t * data, size_t len)
+{
+  uint32_t seq;
+  size_t i;
+
+  if (len != packet_size - IP_HLEN - UDP_HLEN)
+    return 0;
+
+  memcpy (&seq, data, sizeof (seq));
+  for (i = sizeof (seq); i < len; i++)
+    if (data[i] != pattern (seq, i))
+      return 0;
+
+  return 1;
+}
+
+static void *
+receiver (void *arg)
+{
+  uint8_t *buf;
+  ssize_t len;
+  int ok;
+
+  buf = malloc (MAX_PACKET);
+  if (!buf)
+    error (1, ENOMEM, "receiver");
+
+  while (1)
+    {
+      len = recv (sock, buf, MAX_PACKET, 0);
+      if (len < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  error (1, errno, "recv");
+	}
+
+      ok = check_datagram (buf, len);
+
+      pthread_mutex_lock (&lock);
+      if (ok)
+	received++;
+      else
+	corrupt++;
+      pthread_cond_broadcast (&progress);
+      pthread_mutex_unlock (&lock);
+    }
+
+  return 0;
+}
+
+/* Wait until at most IN_FLIGHT of the SENT packets are on their way */
+static int
+wait_for (uint32_t sent, uint32_t in_flight)
+{
+  struct timespec deadline;
+  int err = 0;
+
+  clock_gettime (CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 2;
+
+  pthread_mutex_lock (&lock);
+  while (!err && sent - received - corrupt > in_flight)
+    err = pthread_cond_timedwait (&progress, &lock, &deadline);
+  pthread_mutex_unlock (&lock);
+
+  return err == 0;
+}
+
+static int
+open_device (void)
+{
+  int fd;
+
+  fd = open (device, O_RDWR);
+  if (fd < 0)
+    error (1, errno, "%s", device);
+
+#ifdef __linux__
+  if (!strcmp (device, "/dev/net/tun"))
+    {
+      struct ifreq ifr;
+
+      memset (&ifr, 0, sizeof (ifr));
+      ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+      strncpy (ifr.ifr_name, ifname, IFNAMSIZ - 1);
+      if (ioctl (fd, TUNSETIFF, &ifr) < 0)
+	error (1, errno, "%s: %s", device, ifname);
+    }
+#endif
+
+  return fd;
+}
+
+/* Write COUNT packets of SIZE bytes to FD, returns whether all arrived */
+static int
+run_size (int fd, size_t size)
+{
+  uint8_t *buf;
+  uint32_t seq, lost;
+  ssize_t written;
+  double start, elapsed;
+  int ok;
+
+  buf = malloc (size);
+  if (!buf)
+    error (1, ENOMEM, "%zu", size);
+
+  pthread_mutex_lock (&lock);
+  packet_size = size;
+  received = corrupt = 0;
+  pthread_mutex_unlock (&lock);
+
+  start = now ();
+  for (seq = 0; seq < count; seq++)
+    {
+      /* Give up on a lost packet rather than wait for it forever */
+      if (!wait_for (seq, WINDOW - 1))
+	break;
+
+      build_packet (buf, size, seq);
+      do
+	written = write (fd, buf, size);
+      while (written < 0 && errno == EINTR);
+      if (written != (ssize_t) size)
+	error (1, written < 0 ? errno : 0, "Short write of %zu bytes", size);
+    }
+  wait_for (seq, 0);
+  elapsed = now () - start;
+
+  pthread_mutex_lock (&lock);
+  lost = seq - received - corrupt;
+  printf ("size %zu packets %u received %u corrupt %u lost %u "
+	  "%.1f MB/s %.0f packets/s\n",
+	  size, seq, received, corrupt, lost,
+	  received * (double) size / elapsed / 1e6, received / elapsed);
+  ok = received == count;
+  pthread_mutex_unlock (&lock);
+
+  fflush (stdout);
+  free (buf);
+  return ok;
+}
+
+int
+main (int argc, char **argv)
+{
+  struct sockaddr_in sin;
+  pthread_t thread;
+  char *sizes, *size, *save;
+  unsigned long n;
+  int fd, rcvbuf = 4 << 20, failed = 0;
+
+  inet_aton ("10.9.0.1", &address);
+  inet_aton ("10.9.0.2", &peer);
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+
+  fd = open_device ();
+  if (wait_seconds)
+    sleep (wait_seconds);
+
+  sock = socket (PF_INET, SOCK_DGRAM, 0);
+  if (sock < 0)
+    error (1, errno, "socket");
+  setsockopt (sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof (rcvbuf));
+
+  memset (&sin, 0, sizeof (sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons (port);
+  sin.sin_addr = address;
+  if (bind (sock, (struct sockaddr *) &sin, sizeof (sin)) < 0)
+    error (1, errno, "bind %s:%d", inet_ntoa (address), port);
+
+  errno = pthread_create (&thread, 0, receiver, 0);
+  if (errno)
+    error (1, errno, "pthread_create");
+
+  sizes = strdup (sizes_arg);
+  if (!sizes)
+    error (1, ENOMEM, "%s", sizes_arg);
+  for (size = strtok_r (sizes, ",", &save); size;
+       size = strtok_r (0, ",", &save))
+    {
+      n = strtoul (size, 0, 0);
+      if (n < IP_HLEN + UDP_HLEN + sizeof (uint32_t) || n > MAX_PACKET)
+	error (1, 0, "Invalid size: %s", size);
+      if (!run_size (fd, n))
+	failed = 1;
+    }
+
+  return failed;
+}
@@ -0,0 +1,1103 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Packet capture */
+
+#include <capture.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <net/if_arp.h>
+#include <hurd.h>
+#include <hurd/idvec.h>
+#include <hurd/iohelp.h>
+#include <device/bpf.h>
+
+#include <lwip-hurd.h>
+#include <trivfs-ops.h>
+#include <ring.h>
+#include <stats.h>
+#include <netif/ifcommon.h>
+
+/*
+ * Each reader has its own session: a filter and a ring of captured
+ * packets. The taps run the filter and push a copy of what it accepts,
+ * without taking any lock, so neither the tcpip thread nor the device
+ * threads ever wait for a reader. When a ring is full, packets are
+ * dropped and counted.
+ *
+ * The reader turns the packets into pcap-ng blocks. Interfaces get their
+ * description block the first time one of their packets is read.
+ *
+ * Sessions and filters are only freed once no tap is using them. Taps
+ * announce themselves in the counter of the slot before looking at it.
+ */
+
+/* Operations not in the original BPF */
+#ifndef BPF_MOD
+#define BPF_MOD  0x90
+#endif
+#ifndef BPF_XOR
+#define BPF_XOR  0xa0
+#endif
+#ifndef BPF_MEMWORDS
+#define BPF_MEMWORDS  16
+#endif
+
+/* pcap-ng block types, and link types */
+#define PCAPNG_SHB        0x0a0d0d0a
+#define PCAPNG_IDB        0x00000001
+#define PCAPNG_EPB        0x00000006
+#define PCAPNG_BOM        0x1a2b3c4d
+#define PCAPNG_SHB_LEN    28
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW      101
+
+/* Options */
+#define PCAPNG_OPT_END        0
+#define PCAPNG_OPT_IF_NAME    2
+#define PCAPNG_OPT_EPB_FLAGS  2
+
+/* Interfaces described in a capture at most */
+#define CAPTURE_MAX_IFS   64
+#define CAPTURE_IFNAMSIZ  16
+
+/* An instruction as written by the user, as tcpdump -dd prints them */
+struct capture_insn
+{
+  uint16_t code;
+  uint8_t jt;
+  uint8_t jf;
+  uint32_t k;
+};
+
+struct capture_filter
+{
+  size_t len;
+  struct capture_insn insns[];
+};
+
+/* A captured packet */
+struct capture_rec
+{
+  uint64_t time;		/* Microseconds since the epoch */
+  uint32_t caplen;
+  uint32_t origlen;
+  uint16_t linktype;
+  uint8_t dir;
+  char ifname[CAPTURE_IFNAMSIZ];
+  uint8_t data[];
+};
+
+/* An interface already described to the reader */
+struct capture_if
+{
+  char name[CAPTURE_IFNAMSIZ];
+  uint16_t linktype;
+};
+
+struct capture_session
+{
+  int slot;
+
+  struct ring ring;
+  uint32_t bytes;		/* Packet bytes in the ring */
+  struct capture_filter *filter;
+
+  /* Readers of the same open */
+  pthread_mutex_t lock;
+  pthread_cond_t wait;
+  unsigned int waiters;
+
+  /* Protected by the lock */
+  int started;			/* The section header was read */
+  struct capture_if ifs[CAPTURE_MAX_IFS];
+  unsigned int nifs;
+
+  /* Blocks not read yet, protected by the lock */
+  uint8_t *out;
+  size_t out_size, out_len, out_offs;
+};
+
+/* Counters, one shard each */
+struct capture_counters
+{
+  uint64_t packets, captured, drops;
+  char pad[STATS_LINE - 3 * sizeof (uint64_t)];
+};
+
+uint32_t capture_snaplen = CAPTURE_DEFAULT_SNAPLEN;
+unsigned int capture_sessions;
+char *capture_node_path;
+
+static struct capture_session *sessions[CAPTURE_MAX_SESSIONS];
+static unsigned int session_users[CAPTURE_MAX_SESSIONS];
+static pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct capture_counters counters[STATS_SHARDS];
+
+static struct port_class *capture_cntlclass;
+static struct port_class *capture_class;
+
+/* Load SIZE bytes at offset K of P, in network byte order */
+static int
+load (struct pbuf *p, uint32_t k, int size, uint32_t * val)
+{
+  uint8_t buf[4];
+
+  if (k > p->tot_len || size > p->tot_len - k)
+    return 0;
+
+  if (pbuf_copy_partial (p, buf, size, k) != size)
+    return 0;
+
+  switch (size)
+    {
+    case 4:
+      *val = buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3];
+      break;
+    case 2:
+      *val = buf[0] << 8 | buf[1];
+      break;
+    default:
+      *val = buf[0];
+    }
+
+  return 1;
+}
+
+/* Whether CODE is an instruction filter_run knows */
+static int
+valid_code (uint16_t code)
+{
+  switch (code)
+    {
+    case BPF_RET | BPF_K:
+    case BPF_RET | BPF_A:
+    case BPF_LD | BPF_W | BPF_ABS:
+    case BPF_LD | BPF_H | BPF_ABS:
+    case BPF_LD | BPF_B | BPF_ABS:
+    case BPF_LD | BPF_W | BPF_IND:
+    case BPF_LD | BPF_H | BPF_IND:
+    case BPF_LD | BPF_B | BPF_IND:
+    case BPF_LD | BPF_W | BPF_LEN:
+    case BPF_LDX | BPF_W | BPF_LEN:
+    case BPF_LD | BPF_IMM:
+    case BPF_LDX | BPF_IMM:
+    case BPF_LD | BPF_MEM:
+    case BPF_LDX | BPF_MEM:
+    case BPF_LDX | BPF_B | BPF_MSH:
+    case BPF_ST:
+    case BPF_STX:
+    case BPF_ALU | BPF_ADD | BPF_K:
+    case BPF_ALU | BPF_SUB | BPF_K:
+    case BPF_ALU | BPF_MUL | BPF_K:
+    case BPF_ALU | BPF_DIV | BPF_K:
+    case BPF_ALU | BPF_MOD | BPF_K:
+    case BPF_ALU | BPF_AND | BPF_K:
+    case BPF_ALU | BPF_OR | BPF_K:
+    case BPF_ALU | BPF_XOR | BPF_K:
+    case BPF_ALU | BPF_LSH | BPF_K:
+    case BPF_ALU | BPF_RSH | BPF_K:
+    case BPF_ALU | BPF_ADD | BPF_X:
+    case BPF_ALU | BPF_SUB | BPF_X:
+    case BPF_ALU | BPF_MUL | BPF_X:
+    case BPF_ALU | BPF_DIV | BPF_X:
+    case BPF_ALU | BPF_MOD | BPF_X:
+    case BPF_ALU | BPF_AND | BPF_X:
+    case BPF_ALU | BPF_OR | BPF_X:
+    case BPF_ALU | BPF_XOR | BPF_X:
+    case BPF_ALU | BPF_LSH | BPF_X:
+    case BPF_ALU | BPF_RSH | BPF_X:
+    case BPF_ALU | BPF_NEG:
+    case BPF_JMP | BPF_JA:
+    case BPF_JMP | BPF_JGT | BPF_K:
+    case BPF_JMP | BPF_JGE | BPF_K:
+    case BPF_JMP | BPF_JEQ | BPF_K:
+    case BPF_JMP | BPF_JSET | BPF_K:
+    case BPF_JMP | BPF_JGT | BPF_X:
+    case BPF_JMP | BPF_JGE | BPF_X:
+    case BPF_JMP | BPF_JEQ | BPF_X:
+    case BPF_JMP | BPF_JSET | BPF_X:
+    case BPF_MISC | BPF_TAX:
+    case BPF_MISC | BPF_TXA:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+/*
+ * Check the program F can run safely: known instructions, jumps forward
+ * and inside it, valid scratch memory and a return at the end.
+ */
+static error_t
+filter_validate (struct capture_filter *f)
+{
+  struct capture_insn *insn;
+  size_t i, left;
+
+  if (f->len == 0 || f->len > CAPTURE_MAX_INSNS)
+    return EINVAL;
+
+  for (i = 0; i < f->len; i++)
+    {
+      insn = &f->insns[i];
+      left = f->len - i - 1;
+
+      if (!valid_code (insn->code))
+	return EINVAL;
+
+      switch (BPF_CLASS (insn->code))
+	{
+	case BPF_LD:
+	case BPF_LDX:
+	  if (BPF_MODE (insn->code) == BPF_MEM && insn->k >= BPF_MEMWORDS)
+	    return EINVAL;
+	  break;
+	case BPF_ST:
+	case BPF_STX:
+	  if (insn->k >= BPF_MEMWORDS)
+	    return EINVAL;
+	  break;
+	case BPF_ALU:
+	  if ((BPF_OP (insn->code) == BPF_DIV
+	       || BPF_OP (insn->code) == BPF_MOD)
+	      && BPF_SRC (insn->code) == BPF_K && insn->k == 0)
+	    return EINVAL;
+	  break;
+	case BPF_JMP:
+	  if (BPF_OP (insn->code) == BPF_JA)
+	    {
+	      if (insn->k >= left)
+		return EINVAL;
+	    }
+	  else if (insn->jt >= left || insn->jf >= left)
+	    return EINVAL;
+	  break;
+	}
+    }
+
+  if (BPF_CLASS (f->insns[f->len - 1].code) != BPF_RET)
+    return EINVAL;
+
+  return 0;
+}
+
+/* Run F on P. Returns the number of bytes to keep, 0 to skip it */
+static uint32_t
+filter_run (struct capture_filter *f, struct pbuf *p)
+{
+  struct capture_insn *pc;
+  uint32_t a = 0, x = 0, k, v;
+  uint32_t mem[BPF_MEMWORDS];
+
+  memset (mem, 0, sizeof (mem));
+
+  for (pc = f->insns;; pc++)
+    {
+      k = pc->k;
+      switch (pc->code)
+	{
+	case BPF_RET | BPF_K:
+	  return k;
+	case BPF_RET | BPF_A:
+	  return a;
+
+	case BPF_LD | BPF_W | BPF_ABS:
+	  if (!load (p, k, 4, &a))
+	    return 0;
+	  break;
+	case BPF_LD | BPF_H | BPF_ABS:
+	  if (!load (p, k, 2, &a))
+	    return 0;
+	  break;
+	case BPF_LD | BPF_B | BPF_ABS:
+	  if (!load (p, k, 1, &a))
+	    return 0;
+	  break;
+	case BPF_LD | BPF_W | BPF_IND:
+	  if (k > UINT32_MAX - x || !load (p, x + k, 4, &a))
+	    return 0;
+	  break;
+	case BPF_LD | BPF_H | BPF_IND:
+	  if (k > UINT32_MAX - x || !load (p, x + k, 2, &a))
+	    return 0;
+	  break;
+	case BPF_LD | BPF_B | BPF_IND:
+	  if (k > UINT32_MAX - x || !load (p, x + k, 1, &a))
+	    return 0;
+	  break;
+	case BPF_LD | BPF_W | BPF_LEN:
+	  a = p->tot_len;
+	  break;
+	case BPF_LDX | BPF_W | BPF_LEN:
+	  x = p->tot_len;
+	  break;
+	case BPF_LD | BPF_IMM:
+	  a = k;
+	  break;
+	case BPF_LDX | BPF_IMM:
+	  x = k;
+	  break;
+	case BPF_LD | BPF_MEM:
+	  a = mem[k];
+	  break;
+	case BPF_LDX | BPF_MEM:
+	  x = mem[k];
+	  break;
+	case BPF_LDX | BPF_B | BPF_MSH:
+	  /* Length of an IPv4 header */
+	  if (!load (p, k, 1, &v))
+	    return 0;
+	  x = (v & 0xf) << 2;
+	  break;
+	case BPF_ST:
+	  mem[k] = a;
+	  break;
+	case BPF_STX:
+	  mem[k] = x;
+	  break;
+
+	case BPF_ALU | BPF_ADD | BPF_X:
+	  k = x;
+	  /* Fall through */
+	case BPF_ALU | BPF_ADD | BPF_K:
+	  a += k;
+	  break;
+	case BPF_ALU | BPF_SUB | BPF_X:
+	  k = x;
+	  /* Fall through */
+	case BPF_ALU | BPF_SUB | BPF_K:
+	  a -= k;
+	  break;
+	case BPF_ALU | BPF_MUL | BPF_X:
+	  k = x;
+	  /* Fall through */
+	case BPF_ALU | BPF_MUL | BPF_K:
+	  a *= k;
+	  break;
+	case BPF_ALU | BPF_DIV | BPF_X:
+	  if (x == 0)
+	    return 0;
+	  k = x;
+	  /* Fall through */
+	case BPF_ALU | BPF_DIV | BPF_K:
+	  a /= k;
+	  break;
+	case BPF_ALU | BPF_MOD | BPF_X:
+	  if (x == 0)
+	    return 0;
+	  k = x;
+	  /* Fall through */
+	case BPF_ALU | BPF_MOD | BPF_K:
+	  a %= k;
+	  break;
+	case BPF_ALU | BPF_AND | BPF_X:
+	  k = x;
+	  /* Fall through */
+	case BPF_ALU | BPF_AND | BPF_K:
+	  a &= k;
+	  break;
+	case BPF_ALU | BPF_OR | BPF_X:
+	  k = x;
+	  /* Fall through */
+	case BPF_ALU | BPF_OR | BPF_K:
+	  a |= k;
+	  break;
+	case BPF_ALU | BPF_XOR | BPF_X:
+	  k = x;
+	  /* Fall through */
+	case BPF_ALU | BPF_XOR | BPF_K:
+	  a ^= k;
+	  break;
+	case BPF_ALU | BPF_LSH | BPF_X:
+	  k = x;
+	  /* Fall through */
+	case BPF_ALU | BPF_LSH | BPF_K:
+	  a = k < 32 ? a << k : 0;
+	  break;
+	case BPF_ALU | BPF_RSH | BPF_X:
+	  k = x;
+	  /* Fall through */
+	case BPF_ALU | BPF_RSH | BPF_K:
+	  a = k < 32 ? a >> k : 0;
+	  break;
+	case BPF_ALU | BPF_NEG:
+	  a = -a;
+	  break;
+
+	case BPF_JMP | BPF_JA:
+	  pc += k;
+	  break;
+	case BPF_JMP | BPF_JGT | BPF_K:
+	  pc += a > k ? pc->jt : pc->jf;
+	  break;
+	case BPF_JMP | BPF_JGE | BPF_K:
+	  pc += a >= k ? pc->jt : pc->jf;
+	  break;
+	case BPF_JMP | BPF_JEQ | BPF_K:
+	  pc += a == k ? pc->jt : pc->jf;
+	  break;
+	case BPF_JMP | BPF_JSET | BPF_K:
+	  pc += a & k ? pc->jt : pc->jf;
+	  break;
+	case BPF_JMP | BPF_JGT | BPF_X:
+	  pc += a > x ? pc->jt : pc->jf;
+	  break;
+	case BPF_JMP | BPF_JGE | BPF_X:
+	  pc += a >= x ? pc->jt : pc->jf;
+	  break;
+	case BPF_JMP | BPF_JEQ | BPF_X:
+	  pc += a == x ? pc->jt : pc->jf;
+	  break;
+	case BPF_JMP | BPF_JSET | BPF_X:
+	  pc += a & x ? pc->jt : pc->jf;
+	  break;
+
+	case BPF_MISC | BPF_TAX:
+	  x = a;
+	  break;
+	case BPF_MISC | BPF_TXA:
+	  a = x;
+	  break;
+
+	default:
+	  /* Not reached, the program was validated */
+	  return 0;
+	}
+    }
+}
+
+/* Wait until no tap is using the session in SLOT */
+static void
+quiesce (int slot)
+{
+  while (__atomic_load_n (&session_users[slot], __ATOMIC_ACQUIRE))
+    sched_yield ();
+}
+
+/* Wake up the readers of S waiting for packets, if any */
+static void
+session_wake (struct capture_session *s)
+{
+  /* As in the tunnel queues, either they see the packet or we see them */
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&s->waiters, __ATOMIC_RELAXED))
+    {
+      pthread_mutex_lock (&s->lock);
+      pthread_cond_broadcast (&s->wait);
+      pthread_mutex_unlock (&s->lock);
+    }
+}
+
+/* Wait for packets in S, with TSP as timeout. Called with its lock held */
+static error_t
+session_wait (struct capture_session *s, struct timespec *tsp)
+{
+  error_t err = 0;
+
+  __atomic_add_fetch (&s->waiters, 1, __ATOMIC_SEQ_CST);
+  if (!ring_ready (&s->ring))
+    err = pthread_hurd_cond_timedwait_np (&s->wait, &s->lock, tsp);
+  __atomic_sub_fetch (&s->waiters, 1, __ATOMIC_SEQ_CST);
+
+  return err;
+}
+
+static uint64_t
+now_us (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* Queue a copy of P in S, if its filter wants it */
+static void
+session_tap (struct capture_session *s, struct netif *netif, struct pbuf *p,
+	     int dir, uint64_t * time)
+{
+  struct capture_filter *f;
+  struct capture_rec *rec;
+  uint32_t snap, limit;
+
+  STATS_ADD (counters, packets, 1);
+
+  f = __atomic_load_n (&s->filter, __ATOMIC_ACQUIRE);
+  snap = f ? filter_run (f, p) : UINT32_MAX;
+  if (snap == 0)
+    return;
+
+  STATS_ADD (counters, captured, 1);
+
+  limit = __atomic_load_n (&capture_snaplen, __ATOMIC_RELAXED);
+  if (snap > limit)
+    snap = limit;
+  if (snap > p->tot_len)
+    snap = p->tot_len;
+
+  if (__atomic_add_fetch (&s->bytes, snap, __ATOMIC_RELAXED) >
+      CAPTURE_RING_BYTES)
+    goto drop;
+
+  rec = malloc (sizeof (struct capture_rec) + snap);
+  if (!rec)
+    goto drop;
+
+  if (!*time)
+    *time = now_us ();
+
+  rec->time = *time;
+  rec->caplen = snap;
+  rec->origlen = p->tot_len;
+  rec->linktype = netif_get_state (netif)->type == ARPHRD_ETHER ?
+    LINKTYPE_ETHERNET : LINKTYPE_RAW;
+  rec->dir = dir;
+  strncpy (rec->ifname, netif_get_state (netif)->devname,
+	   CAPTURE_IFNAMSIZ - 1);
+  rec->ifname[CAPTURE_IFNAMSIZ - 1] = 0;
+  pbuf_copy_partial (p, rec->data, snap, 0);
+
+  if (!ring_push (&s->ring, rec, 0))
+    {
+      free (rec);
+      goto drop;
+    }
+
+  session_wake (s);
+
+  return;
+
+drop:
+  __atomic_sub_fetch (&s->bytes, snap, __ATOMIC_RELAXED);
+  STATS_ADD (counters, drops, 1);
+}
+
+void
+capture_tap (struct netif *netif, struct pbuf *p, int dir)
+{
+  struct capture_session *s;
+  uint64_t time = 0;
+  int i;
+
+  for (i = 0; i < CAPTURE_MAX_SESSIONS; i++)
+    {
+      if (!__atomic_load_n (&sessions[i], __ATOMIC_RELAXED))
+	continue;
+
+      __atomic_add_fetch (&session_users[i], 1, __ATOMIC_SEQ_CST);
+      s = __atomic_load_n (&sessions[i], __ATOMIC_SEQ_CST);
+      if (s)
+	session_tap (s, netif, p, dir, &time);
+      __atomic_sub_fetch (&session_users[i], 1, __ATOMIC_RELEASE);
+    }
+}
+
+void
+capture_get_stats (struct capture_stats *stats)
+{
+  stats->packets = STATS_SUM (counters, packets);
+  stats->captured = STATS_SUM (counters, captured);
+  stats->drops = STATS_SUM (counters, drops);
+}
+
+void
+capture_reset_stats (void)
+{
+  STATS_CLEAR (counters, packets);
+  STATS_CLEAR (counters, captured);
+  STATS_CLEAR (counters, drops);
+}
+
+/* Make room for N more bytes of output in S */
+static error_t
+out_reserve (struct capture_session *s, size_t n)
+{
+  uint8_t *out;
+  size_t size;
+
+  if (s->out_len + n <= s->out_size)
+    return 0;
+
+  for (size = s->out_size ? : 4096; size < s->out_len + n; size *= 2);
+
+  out = realloc (s->out, size);
+  if (!out)
+    return ENOMEM;
+
+  s->out = out;
+  s->out_size = size;
+
+  return 0;
+}
+
+static void
+put16 (struct capture_session *s, uint16_t v)
+{
+  memcpy (s->out + s->out_len, &v, sizeof (v));
+  s->out_len += sizeof (v);
+}
+
+static void
+put32 (struct capture_session *s, uint32_t v)
+{
+  memcpy (s->out + s->out_len, &v, sizeof (v));
+  s->out_len += sizeof (v);
+}
+
+/* Copy LEN bytes of DATA, padded to 32 bits */
+static void
+put_padded (struct capture_session *s, const void *data, size_t len)
+{
+  memcpy (s->out + s->out_len, data, len);
+  memset (s->out + s->out_len + len, 0, -len & 3);
+  s->out_len += (len + 3) & ~3;
+}
+
+/* The section header, in host byte order as pcap-ng allows */
+static error_t
+put_shb (struct capture_session *s)
+{
+  error_t err;
+  uint32_t len = PCAPNG_SHB_LEN;
+
+  err = out_reserve (s, len);
+  if (err)
+    return err;
+
+  put32 (s, PCAPNG_SHB);
+  put32 (s, len);
+  put32 (s, PCAPNG_BOM);
+  put16 (s, 1);
+  put16 (s, 0);
+  put32 (s, 0xffffffff);	/* Unknown section length */
+  put32 (s, 0xffffffff);
+  put32 (s, len);
+
+  return 0;
+}
+
+/* Describe the interface of REC if needed, and tell its id in ID */
+static error_t
+put_idb (struct capture_session *s, struct capture_rec *rec, uint32_t * id)
+{
+  error_t err;
+  struct capture_if *cif;
+  size_t namelen;
+  uint32_t len;
+
+  for (*id = 0; *id < s->nifs; (*id)++)
+    if (s->ifs[*id].linktype == rec->linktype
+	&& strcmp (s->ifs[*id].name, rec->ifname) == 0)
+      return 0;
+
+  if (s->nifs == CAPTURE_MAX_IFS)
+    return ENOSPC;
+
+  namelen = strlen (rec->ifname);
+  len = 20 + 4 + ((namelen + 3) & ~3) + 4;
+
+  err = out_reserve (s, len);
+  if (err)
+    return err;
+
+  put32 (s, PCAPNG_IDB);
+  put32 (s, len);
+  put16 (s, rec->linktype);
+  put16 (s, 0);
+  put32 (s, __atomic_load_n (&capture_snaplen, __ATOMIC_RELAXED));
+  put16 (s, PCAPNG_OPT_IF_NAME);
+  put16 (s, namelen);
+  put_padded (s, rec->ifname, namelen);
+  put16 (s, PCAPNG_OPT_END);
+  put16 (s, 0);
+  put32 (s, len);
+
+  cif = &s->ifs[s->nifs++];
+  memcpy (cif->name, rec->ifname, CAPTURE_IFNAMSIZ);
+  cif->linktype = rec->linktype;
+
+  return 0;
+}
+
+/* An enhanced packet block for REC */
+static error_t
+put_epb (struct capture_session *s, struct capture_rec *rec)
+{
+  error_t err;
+  uint32_t id, len;
+
+  err = put_idb (s, rec, &id);
+  if (err)
+    return err;
+
+  len = 28 + ((rec->caplen + 3) & ~3) + 8 + 4 + 4;
+
+  err = out_reserve (s, len);
+  if (err)
+    return err;
+
+  put32 (s, PCAPNG_EPB);
+  put32 (s, len);
+  put32 (s, id);
+  put32 (s, rec->time >> 32);
+  put32 (s, rec->time);
+  put32 (s, rec->caplen);
+  put32 (s, rec->origlen);
+  put_padded (s, rec->data, rec->caplen);
+  put16 (s, PCAPNG_OPT_EPB_FLAGS);
+  put16 (s, 4);
+  put32 (s, rec->dir);
+  put16 (s, PCAPNG_OPT_END);
+  put16 (s, 0);
+  put32 (s, len);
+
+  return 0;
+}
+
+/*
+ * Turn captured packets into output until there are WANT bytes or the
+ * ring is empty. Called with the lock held.
+ */
+static error_t
+fill (struct capture_session *s, size_t want)
+{
+  error_t err;
+  struct capture_rec *rec;
+
+  if (!s->started)
+    {
+      err = put_shb (s);
+      if (err)
+	return err;
+      s->started = 1;
+    }
+
+  while (s->out_len - s->out_offs < want
+	 && (rec = ring_pop (&s->ring, 0)) != 0)
+    {
+      __atomic_sub_fetch (&s->bytes, rec->caplen, __ATOMIC_RELAXED);
+
+      err = put_epb (s, rec);
+      if (err)
+	STATS_ADD (counters, drops, 1);
+      free (rec);
+      if (err == ENOMEM)
+	return err;
+    }
+
+  return 0;
+}
+
+error_t
+capture_node_create (const char *path)
+{
+  return trivfs_node_create (path, 0600, capture_cntlclass, capture_class,
+			     &capture_node_path);
+}
+
+/* Only the owner of the translator sees the traffic */
+static error_t
+capture_check_open (struct trivfs_control *cntl, struct iouser *user,
+		    int flags)
+{
+  if (flags == O_NORW)
+    return 0;
+
+  if (!idvec_contains (user->uids, 0)
+      && !idvec_contains (user->uids, lwip_owner))
+    return EPERM;
+
+  return 0;
+}
+
+static error_t
+capture_po_create (struct trivfs_peropen *po)
+{
+  error_t err;
+  struct capture_session *s;
+  int i;
+
+  po->hook = 0;
+  if (!(po->openmodes & O_READ))
+    return 0;
+
+  s = calloc (1, sizeof (struct capture_session));
+  if (!s)
+    return ENOMEM;
+
+  err = ring_init (&s->ring, CAPTURE_RING_LEN);
+  if (err)
+    {
+      free (s);
+      return err;
+    }
+
+  pthread_mutex_init (&s->lock, 0);
+  pthread_cond_init (&s->wait, 0);
+
+  pthread_mutex_lock (&sessions_lock);
+  for (i = 0; i < CAPTURE_MAX_SESSIONS; i++)
+    if (!sessions[i])
+      break;
+
+  if (i == CAPTURE_MAX_SESSIONS)
+    {
+      pthread_mutex_unlock (&sessions_lock);
+      ring_destroy (&s->ring);
+      free (s);
+      return EBUSY;
+    }
+
+  s->slot = i;
+  __atomic_store_n (&sessions[i], s, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch (&capture_sessions, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock (&sessions_lock);
+
+  po->hook = s;
+
+  return 0;
+}
+
+static void
+capture_po_destroy (struct trivfs_peropen *po)
+{
+  struct capture_session *s = po->hook;
+  struct capture_rec *rec;
+
+  if (!s)
+    return;
+
+  pthread_mutex_lock (&sessions_lock);
+  __atomic_store_n (&sessions[s->slot], 0, __ATOMIC_SEQ_CST);
+  __atomic_sub_fetch (&capture_sessions, 1, __ATOMIC_RELAXED);
+  quiesce (s->slot);
+  pthread_mutex_unlock (&sessions_lock);
+
+  while ((rec = ring_pop (&s->ring, 0)) != 0)
+    free (rec);
+  ring_destroy (&s->ring);
+
+  free (s->filter);
+  free (s->out);
+  pthread_cond_destroy (&s->wait);
+  pthread_mutex_destroy (&s->lock);
+  free (s);
+}
+
+static error_t
+capture_read (struct trivfs_protid *cred, char **data,
+	      mach_msg_type_number_t * data_len, loff_t offs, size_t amount)
+{
+  error_t err;
+  struct capture_session *s = cred->po->hook;
+
+  if (!s || !(cred->po->openmodes & O_READ))
+    return EBADF;
+
+  pthread_mutex_lock (&s->lock);
+
+  while (s->out_len == s->out_offs)
+    {
+      err = fill (s, amount);
+      if (err)
+	{
+	  pthread_mutex_unlock (&s->lock);
+	  return err;
+	}
+
+      if (s->out_len > s->out_offs)
+	break;
+
+      if (cred->po->openmodes & O_NONBLOCK)
+	{
+	  pthread_mutex_unlock (&s->lock);
+	  return EWOULDBLOCK;
+	}
+
+      if (session_wait (s, NULL))
+	{
+	  pthread_mutex_unlock (&s->lock);
+	  return EINTR;
+	}
+    }
+
+  if (amount > s->out_len - s->out_offs)
+    amount = s->out_len - s->out_offs;
+
+  /* Possibly allocate a new buffer. */
+  if (*data_len < amount)
+    {
+      *data = mmap (0, amount, PROT_READ | PROT_WRITE, MAP_ANON, 0, 0);
+      if (*data == MAP_FAILED)
+	{
+	  pthread_mutex_unlock (&s->lock);
+	  return ENOMEM;
+	}
+    }
+
+  memcpy (*data, s->out + s->out_offs, amount);
+  *data_len = amount;
+
+  s->out_offs += amount;
+  if (s->out_offs == s->out_len)
+    s->out_offs = s->out_len = 0;
+
+  pthread_mutex_unlock (&s->lock);
+
+  return 0;
+}
+
+static error_t
+capture_write (struct trivfs_protid *cred, char *data,
+	       mach_msg_type_number_t data_len,
+	       mach_msg_type_number_t * amount)
+{
+  error_t err;
+  struct capture_session *s = cred->po->hook;
+  struct capture_filter *f = 0, *old;
+
+  /* The filter belongs to a capture */
+  if (!s)
+    return EBADF;
+
+  if (data_len % sizeof (struct capture_insn))
+    return EINVAL;
+
+  if (data_len > 0)
+    {
+      f = malloc (sizeof (struct capture_filter) + data_len);
+      if (!f)
+	return ENOMEM;
+
+      f->len = data_len / sizeof (struct capture_insn);
+      memcpy (f->insns, data, data_len);
+
+      err = filter_validate (f);
+      if (err)
+	{
+	  free (f);
+	  return err;
+	}
+    }
+
+  /*
+   * Taps may still run the previous one. They may wait for the lock of
+   * the session to wake its readers, so it's not held meanwhile.
+   */
+  pthread_mutex_lock (&sessions_lock);
+  old = __atomic_exchange_n (&s->filter, f, __ATOMIC_ACQ_REL);
+  quiesce (s->slot);
+  pthread_mutex_unlock (&sessions_lock);
+
+  free (old);
+  *amount = data_len;
+
+  return 0;
+}
+
+static error_t
+capture_readable (struct trivfs_protid *cred,
+		  mach_msg_type_number_t * amount)
+{
+  struct capture_session *s = cred->po->hook;
+
+  if (!s)
+    return EBADF;
+
+  /* Packets still in the ring take more room as blocks */
+  pthread_mutex_lock (&s->lock);
+  *amount = s->out_len - s->out_offs
+    + __atomic_load_n (&s->bytes, __ATOMIC_RELAXED);
+  if (!s->started)
+    *amount += PCAPNG_SHB_LEN;
+  pthread_mutex_unlock (&s->lock);
+
+  return 0;
+}
+
+static error_t
+capture_select (struct trivfs_protid *cred, struct timespec *tsp, int *type)
+{
+  error_t err;
+  struct capture_session *s = cred->po->hook;
+
+  *type &= SELECT_READ | SELECT_WRITE;
+
+  /* Writing a filter never blocks */
+  if (!s || !(*type & SELECT_READ))
+    return 0;
+
+  pthread_mutex_lock (&s->lock);
+
+  /* The section header is always there to be read first */
+  while (s->started && s->out_len == s->out_offs && !ring_ready (&s->ring))
+    {
+      if (*type & SELECT_WRITE)
+	{
+	  *type = SELECT_WRITE;
+	  pthread_mutex_unlock (&s->lock);
+	  return 0;
+	}
+
+      err = session_wait (s, tsp);
+      if (err)
+	{
+	  *type = 0;
+	  pthread_mutex_unlock (&s->lock);
+	  return err == ETIMEDOUT ? 0 : err;
+	}
+    }
+
+  pthread_mutex_unlock (&s->lock);
+
+  return 0;
+}
+
+static void
+capture_modify_stat (struct trivfs_protid *cred, io_statbuf_t * st)
+{
+  st->st_size = 0;
+  st->st_mode &= ~(S_IFMT | 077);
+  st->st_mode |= S_IFCHR;
+}
+
+static const struct trivfs_node_ops capture_ops = {
+  .check_open = capture_check_open,
+  .po_create = capture_po_create,
+  .po_destroy = capture_po_destroy,
+  .modify_stat = capture_modify_stat,
+  .read = capture_read,
+  .write = capture_write,
+  .readable = capture_readable,
+  .select = capture_select,
+};
+
+error_t
+capture_module_init (void)
+{
+  return trivfs_node_register (&capture_cntlclass, &capture_class, &capture_ops);
+}
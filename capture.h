@@ -0,0 +1,91 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Packet capture */
+
+#ifndef LWIP_CAPTURE_H
+#define LWIP_CAPTURE_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <hurd/trivfs.h>
+
+#include <lwip/netif.h>
+#include <lwip/pbuf.h>
+
+/* Direction of a captured packet, as in the pcap-ng flags */
+#define CAPTURE_IN   1
+#define CAPTURE_OUT  2
+
+/* Readers capturing at the same time */
+#define CAPTURE_MAX_SESSIONS  8
+
+/* Packets and bytes waiting for a reader, past that they're dropped */
+#define CAPTURE_RING_LEN      4096
+#define CAPTURE_RING_BYTES    (4 * 1024 * 1024)
+
+/* Default snap length, as tcpdump's */
+#define CAPTURE_DEFAULT_SNAPLEN  262144
+
+/* Longest filter accepted */
+#define CAPTURE_MAX_INSNS     512
+
+struct capture_stats
+{
+  uint64_t packets;		/* Packets seen by the readers' filters */
+  uint64_t captured;		/* Packets they accepted */
+  uint64_t drops;		/* Accepted but not queued */
+};
+
+/* Bytes kept from each packet at most */
+extern uint32_t capture_snaplen;
+
+/* Number of readers, the taps do nothing while it's 0 */
+extern unsigned int capture_sessions;
+
+void capture_tap (struct netif *netif, struct pbuf *p, int dir);
+
+/* Show the packet P going in direction DIR through NETIF to the readers */
+static inline void
+capture_packet (struct netif *netif, struct pbuf *p, int dir)
+{
+  if (__atomic_load_n (&capture_sessions, __ATOMIC_RELAXED))
+    capture_tap (netif, p, dir);
+}
+
+void capture_get_stats (struct capture_stats *stats);
+void capture_reset_stats (void);
+
+/*
+ * The capture node. Every open for reading starts a capture, read as a
+ * pcap-ng stream. Writing a classic BPF program to the open, as an array
+ * of struct bpf_insn, filters what it gets. The value returned by the
+ * program is the number of bytes to keep, and an empty write removes the
+ * filter.
+ */
+error_t capture_module_init (void);
+
+/* Serve the capture on PATH */
+error_t capture_node_create (const char *path);
+
+/* Where it's served, or NULL */
+extern char *capture_node_path;
+
+#endif /* LWIP_CAPTURE_H */
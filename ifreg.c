@@ -0,0 +1,205 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/* Interface registry */
+
+#include <ifreg.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <netif/ifcommon.h>
+
+/*
+ * Readers never lock: they take a reference to the current snapshot and
+ * check it's still current. Snapshots are never freed, just reused by the
+ * writer once nobody references them, so a late reference to an old one
+ * is harmless.
+ */
+static struct ifsnapshot snapshots[2];
+static struct ifsnapshot *current;
+
+/* Serializes the writers and lets them wait for the readers */
+static pthread_mutex_t ifreg_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ifreg_released = PTHREAD_COND_INITIALIZER;
+
+static hurd_ihash_key_t
+name_hash (const void *key)
+{
+  return (hurd_ihash_key_t) hurd_ihash_hash32 (key, strlen (key), 0);
+}
+
+static int
+name_compare (const void *a, const void *b)
+{
+  return strcmp (a, b) == 0;
+}
+
+/* Set up an empty snapshot */
+static void
+snapshot_init (struct ifsnapshot *s)
+{
+  s->num = 0;
+  s->netifs = 0;
+  hurd_ihash_init (&s->names, HURD_IHASH_NO_LOCP);
+  hurd_ihash_set_gki (&s->names, name_hash, name_compare);
+  hurd_ihash_init (&s->ports, HURD_IHASH_NO_LOCP);
+}
+
+/* Empty S to fill it again */
+static void
+snapshot_reset (struct ifsnapshot *s)
+{
+  hurd_ihash_destroy (&s->names);
+  hurd_ihash_destroy (&s->ports);
+  free (s->netifs);
+  snapshot_init (s);
+}
+
+void
+ifreg_init (void)
+{
+  snapshot_init (&snapshots[0]);
+  snapshot_init (&snapshots[1]);
+  current = &snapshots[0];
+}
+
+struct ifsnapshot *
+ifreg_get (void)
+{
+  struct ifsnapshot *s;
+
+  while (1)
+    {
+      s = __atomic_load_n (&current, __ATOMIC_ACQUIRE);
+      __atomic_add_fetch (&s->refs, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n (&current, __ATOMIC_SEQ_CST) == s)
+	return s;
+
+      /* The writer replaced it meanwhile */
+      ifreg_put (s);
+    }
+}
+
+void
+ifreg_put (struct ifsnapshot *snap)
+{
+  if (__atomic_sub_fetch (&snap->refs, 1, __ATOMIC_SEQ_CST) == 0
+      && __atomic_load_n (&snap->retired, __ATOMIC_SEQ_CST))
+    {
+      pthread_mutex_lock (&ifreg_lock);
+      pthread_cond_broadcast (&ifreg_released);
+      pthread_mutex_unlock (&ifreg_lock);
+    }
+}
+
+int
+ifreg_lookup (struct ifsnapshot *snap, const char *name)
+{
+  return (uintptr_t) hurd_ihash_find (&snap->names, (hurd_ihash_key_t) name);
+}
+
+int
+ifreg_lookup_port (struct ifsnapshot *snap, mach_port_t port)
+{
+  if (port == MACH_PORT_NULL)
+    return 0;
+
+  return (uintptr_t) hurd_ihash_find (&snap->ports, port);
+}
+
+struct netif *
+ifreg_netif (struct ifsnapshot *snap, int index)
+{
+  if (index < 1 || (size_t) index > snap->num)
+    return 0;
+
+  return snap->netifs[index - 1];
+}
+
+/* Fill S from the stack's interface list */
+static error_t
+snapshot_fill (struct ifsnapshot *s)
+{
+  error_t err;
+  struct netif *netif;
+  struct ifcommon *ifc;
+  size_t i, n;
+
+  n = 0;
+  for (netif = netif_list; netif; netif = netif->next)
+    n++;
+
+  s->netifs = malloc ((n ? n : 1) * sizeof (struct netif *));
+  if (!s->netifs)
+    return ENOMEM;
+
+  for (i = 0, netif = netif_list; netif; netif = netif->next, i++)
+    {
+      ifc = netif_get_state (netif);
+      s->netifs[i] = netif;
+
+      err = hurd_ihash_add (&s->names, (hurd_ihash_key_t) ifc->devname,
+			    (void *) (uintptr_t) (i + 1));
+      if (!err && ifc->readptname != MACH_PORT_NULL)
+	err = hurd_ihash_add (&s->ports, ifc->readptname,
+			      (void *) (uintptr_t) (i + 1));
+      if (err)
+	return err;
+    }
+  s->num = n;
+
+  return 0;
+}
+
+error_t
+ifreg_update (void)
+{
+  error_t err;
+  struct ifsnapshot *old, *new;
+
+  pthread_mutex_lock (&ifreg_lock);
+
+  old = current;
+  new = old == &snapshots[0] ? &snapshots[1] : &snapshots[0];
+
+  /* Late readers may still bump its count, but they'll see it's stale */
+  while (__atomic_load_n (&new->refs, __ATOMIC_SEQ_CST))
+    pthread_cond_wait (&ifreg_released, &ifreg_lock);
+
+  snapshot_reset (new);
+  err = snapshot_fill (new);
+  if (err)
+    /* Still stop handing out the old interfaces */
+    snapshot_reset (new);
+
+  __atomic_store_n (&new->retired, 0, __ATOMIC_SEQ_CST);
+  __atomic_store_n (&current, new, __ATOMIC_SEQ_CST);
+
+  /* Wait for the users of the old one */
+  __atomic_store_n (&old->retired, 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n (&old->refs, __ATOMIC_SEQ_CST))
+    pthread_cond_wait (&ifreg_released, &ifreg_lock);
+
+  pthread_mutex_unlock (&ifreg_lock);
+
+  return err;
+}
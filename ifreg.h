@@ -0,0 +1,72 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/* Interface registry */
+
+#ifndef LWIP_IFREG_H
+#define LWIP_IFREG_H
+
+#include <stddef.h>
+#include <mach.h>
+#include <hurd/ihash.h>
+
+#include <lwip/netif.h>
+
+/*
+ * An immutable view of the interface list.
+ *
+ * Interfaces in a snapshot aren't freed while someone holds a reference
+ * to it. Indexes start at 1 and follow the order of the stack's list.
+ */
+struct ifsnapshot
+{
+  unsigned int refs;
+  int retired;
+
+  size_t num;
+  struct netif **netifs;
+  struct hurd_ihash names;	/* Device name -> index */
+  struct hurd_ihash ports;	/* Port for device reads -> index */
+};
+
+/* Module initialization */
+void ifreg_init (void);
+
+/* Get a reference to the current snapshot, it never fails */
+struct ifsnapshot *ifreg_get (void);
+void ifreg_put (struct ifsnapshot *snap);
+
+/* Lookups, they return 0 if there's no such interface */
+int ifreg_lookup (struct ifsnapshot *snap, const char *name);
+int ifreg_lookup_port (struct ifsnapshot *snap, mach_port_t port);
+struct netif *ifreg_netif (struct ifsnapshot *snap, int index);
+
+/*
+ * Publish a new snapshot of the stack's interface list and wait for the
+ * users of the previous one. Interfaces removed from the stack may be
+ * freed after this returns, even if it fails: the new snapshot is just
+ * empty then.
+ *
+ * Readers may wait for the tcpip thread, so it must not be called from
+ * there once they can find interfaces.
+ */
+error_t ifreg_update (void);
+
+#endif /* LWIP_IFREG_H */
@@ -28,25 +28,24 @@
 
 #include <lwip-hurd.h>
 #include <lwip-util.h>
+#include <ifreg.h>
 #include <netif/ifcommon.h>
 
-/* Get the interface from its name */
+/*
+ * Get the interface from its name. It stays valid until SNAP, which
+ * always gets a reference, is released.
+ */
 static struct netif *
-get_if (char *name)
+get_if (char *name, struct ifsnapshot **snap)
 {
   char ifname[IFNAMSIZ];
-  struct netif *netif;
 
   memcpy (ifname, name, IFNAMSIZ - 1);
   ifname[IFNAMSIZ - 1] = 0;
 
-  for (netif = netif_list; netif != 0; netif = netif->next)
-    {
-      if (strcmp (netif_get_state (netif)->devname, ifname) == 0)
-	break;
-    }
+  *snap = ifreg_get ();
 
-  return netif;
+  return ifreg_netif (*snap, ifreg_lookup (*snap, ifname));
 }
 
 enum siocgif_type
@@ -75,24 +74,22 @@ siocgifXaddr (struct sock_user *user,
   struct sockaddr_in *sin = (struct sockaddr_in *) addr;
   size_t buflen = sizeof (struct sockaddr);
   struct netif *netif;
+  struct ifsnapshot *snap;
   uint32_t addrs[4];
 
   if (!user)
     return EOPNOTSUPP;
 
-  netif = get_if (ifnam);
+  netif = get_if (ifnam, &snap);
   if (!netif)
-    return ENODEV;
-
-  if (type == DSTADDR)
-    return EOPNOTSUPP;
-
+    err = ENODEV;
+  else if (type == DSTADDR)
+    err = EOPNOTSUPP;
   /* We're only interested in geting the address family */
-  err = lwip_getsockname (user->sock->sockno, addr, (socklen_t *) & buflen);
-  if (err)
-    return err;
-
-  if (sin->sin_family != AF_INET)
+  else if (lwip_getsockname (user->sock->sockno, addr,
+			     (socklen_t *) & buflen))
+    err = errno;
+  else if (sin->sin_family != AF_INET)
     err = EINVAL;
   else
     {
@@ -101,6 +98,8 @@ siocgifXaddr (struct sock_user *user,
       sin->sin_addr.s_addr = addrs[type];
     }
 
+  ifreg_put (snap);
+
   return err;
 }
 
@@ -122,6 +121,7 @@ siocsifXaddr (struct sock_user *user,
   struct sockaddr_in sin;
   size_t buflen = sizeof (struct sockaddr_in);
   struct netif *netif;
+  struct ifsnapshot *snap;
   uint32_t ipv4_addrs[5];
 
   if (!user)
@@ -130,20 +130,16 @@ siocsifXaddr (struct sock_user *user,
   if (!user->isroot)
     return EPERM;
 
-  netif = get_if (ifnam);
+  netif = get_if (ifnam, &snap);
 
   if (!netif)
-    return ENODEV;
-
-  if (type == DSTADDR || type == BRDADDR)
-    return EOPNOTSUPP;
-
-  err = lwip_getsockname (user->sock->sockno,
-			  (sockaddr_t *) & sin, (socklen_t *) & buflen);
-  if (err)
-    return err;
-
-  if (sin.sin_family != AF_INET)
+    err = ENODEV;
+  else if (type == DSTADDR || type == BRDADDR)
+    err = EOPNOTSUPP;
+  else if (lwip_getsockname (user->sock->sockno,
+			     (sockaddr_t *) & sin, (socklen_t *) & buflen))
+    err = errno;
+  else if (sin.sin_family != AF_INET)
     err = EINVAL;
   else
     {
@@ -157,6 +153,8 @@ siocsifXaddr (struct sock_user *user,
 			      0);
     }
 
+  ifreg_put (snap);
+
   return err;
 }
 
@@ -174,11 +172,12 @@ lwip_S_iioctl_siocsifflags (struct sock_user * user,
 {
   error_t err = 0;
   struct netif *netif;
+  struct ifsnapshot *snap;
 
   if (!user)
     return EOPNOTSUPP;
 
-  netif = get_if (ifnam);
+  netif = get_if (ifnam, &snap);
 
   if (!user->isroot)
     err = EPERM;
@@ -189,6 +188,8 @@ lwip_S_iioctl_siocsifflags (struct sock_user * user,
       err = if_change_flags (netif, flags);
     }
 
+  ifreg_put (snap);
+
   return err;
 }
 
@@ -198,11 +199,12 @@ lwip_S_iioctl_siocgifflags (struct sock_user * user, char *name, short *flags)
 {
   error_t err = 0;
   struct netif *netif;
+  struct ifsnapshot *snap;
 
   if (!user)
     return EOPNOTSUPP;
 
-  netif = get_if (name);
+  netif = get_if (name, &snap);
   if (!netif)
     err = ENODEV;
   else
@@ -210,6 +212,8 @@ lwip_S_iioctl_siocgifflags (struct sock_user * user, char *name, short *flags)
       *flags = netif_get_state (netif)->flags;
     }
 
+  ifreg_put (snap);
+
   return err;
 }
 
@@ -227,11 +231,12 @@ lwip_S_iioctl_siocgifmetric (struct sock_user * user,
 {
   error_t err = 0;
   struct netif *netif;
+  struct ifsnapshot *snap;
 
   if (!user)
     return EOPNOTSUPP;
 
-  netif = get_if (ifnam);
+  netif = get_if (ifnam, &snap);
   if (!netif)
     err = ENODEV;
   else
@@ -239,6 +244,8 @@ lwip_S_iioctl_siocgifmetric (struct sock_user * user,
       *metric = 0;		/* Not supported.  */
     }
 
+  ifreg_put (snap);
+
   return err;
 }
 
@@ -280,11 +287,12 @@ lwip_S_iioctl_siocgifhwaddr (struct sock_user * user,
 {
   error_t err = 0;
   struct netif *netif;
+  struct ifsnapshot *snap;
 
   if (!user)
     return EOPNOTSUPP;
 
-  netif = get_if (ifname);
+  netif = get_if (ifname, &snap);
   if (!netif)
     err = ENODEV;
   else
@@ -293,6 +301,8 @@ lwip_S_iioctl_siocgifhwaddr (struct sock_user * user,
       addr->sa_family = netif_get_state (netif)->type;
     }
 
+  ifreg_put (snap);
+
   return err;
 }
 
@@ -302,11 +312,12 @@ lwip_S_iioctl_siocgifmtu (struct sock_user * user, ifname_t ifnam, int *mtu)
 {
   error_t err = 0;
   struct netif *netif;
+  struct ifsnapshot *snap;
 
   if (!user)
     return EOPNOTSUPP;
 
-  netif = get_if (ifnam);
+  netif = get_if (ifnam, &snap);
   if (!netif)
     err = ENODEV;
   else
@@ -314,6 +325,8 @@ lwip_S_iioctl_siocgifmtu (struct sock_user * user, ifname_t ifnam, int *mtu)
       *mtu = netif->mtu;
     }
 
+  ifreg_put (snap);
+
   return err;
 }
 
@@ -323,6 +336,7 @@ lwip_S_iioctl_siocsifmtu (struct sock_user * user, ifname_t ifnam, int mtu)
 {
   error_t err = 0;
   struct netif *netif;
+  struct ifsnapshot *snap;
 
   if (!user)
     return EOPNOTSUPP;
@@ -333,7 +347,7 @@ lwip_S_iioctl_siocsifmtu (struct sock_user * user, ifname_t ifnam, int mtu)
   if (mtu <= 0)
     err = EINVAL;
 
-  netif = get_if (ifnam);
+  netif = get_if (ifnam, &snap);
   if (!netif)
     err = ENODEV;
   else
@@ -341,6 +355,8 @@ lwip_S_iioctl_siocsifmtu (struct sock_user * user, ifname_t ifnam, int mtu)
       err = netif_get_state (netif)->update_mtu (netif, mtu);
     }
 
+  ifreg_put (snap);
+
   return err;
 }
 
@@ -351,26 +367,21 @@ lwip_S_iioctl_siocgifindex (struct sock_user * user,
 			    int *index)
 {
   error_t err = 0;
-  struct netif *netif;
+  struct ifsnapshot *snap;
   int i;
 
   if (!user)
     return EOPNOTSUPP;
 
-  i = 1;			/* The first index must be 1 */
-  for (netif = netif_list; netif != 0; netif = netif->next)
-    {
-      if (strcmp (netif_get_state (netif)->devname, ifnam) == 0)
-	{
-	  *index = i;
-	  break;
-	}
-
-      i++;
-    }
+  snap = ifreg_get ();
 
-  if (!netif)
+  i = ifreg_lookup (snap, ifnam);
+  if (i == 0)
     err = ENODEV;
+  else
+    *index = i;
+
+  ifreg_put (snap);
 
   return err;
 }
@@ -383,7 +394,7 @@ lwip_S_iioctl_siocgifname (struct sock_user * user,
 {
   error_t err = 0;
   struct netif *netif;
-  int i;
+  struct ifsnapshot *snap;
 
   if (!user)
     return EOPNOTSUPP;
@@ -391,15 +402,9 @@ lwip_S_iioctl_siocgifname (struct sock_user * user,
   if (*index < 0)
     return EINVAL;
 
-  i = 1;			/* The first index is 1 */
-  for (netif = netif_list; netif != 0; netif = netif->next)
-    {
-      if (i == *index)
-	break;
-
-      i++;
-    }
+  snap = ifreg_get ();
 
+  netif = ifreg_netif (snap, *index);
   if (!netif)
     err = ENODEV;
   else
@@ -408,5 +413,7 @@ lwip_S_iioctl_siocgifname (struct sock_user * user,
       ifnam[IFNAMSIZ - 1] = '\0';
     }
 
+  ifreg_put (snap);
+
   return err;
 }
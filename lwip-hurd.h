@@ -30,6 +30,9 @@
 #include <hurd/trivfs.h>
 #include <refcount.h>
 
+#include <objcache.h>
+#include <tcptune.h>
+
 struct port_bucket *lwip_bucket;
 struct port_class *socketport_class;
 struct port_class *addrport_class;
@@ -79,6 +82,21 @@ struct sock_addr
   } address;
 };
 
+/* Addresses up to the size of sockaddr_storage all take the same size, so
+   their allocations are alike.  */
+#define SOCK_ADDR_SIZE(len)                                             \
+  (offsetof (struct sock_addr, address) + (len) > sizeof (struct sock_addr) \
+   ? offsetof (struct sock_addr, address) + (len) : sizeof (struct sock_addr))
+
+/* Sockets come from their own cache.  Libports allocates the port
+   objects, we only count them.  */
+struct objcache socket_cache;
+struct objstats sock_user_stats;
+struct objstats sock_addr_stats;
+
+/* Maximum number of sockets, 0 for as many as the stack allows.  */
+unsigned int lwip_max_sockets;
+
 /* Owner of the underlying node.  */
 uid_t lwip_owner;
 
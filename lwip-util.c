@@ -23,16 +23,32 @@
 #include <lwip-util.h>
 
 #include <error.h>
+#include <pthread.h>
+#include <time.h>
 #include <net/if_arp.h>
 
 #include <lwip/sockets.h>
 #include <lwip/netifapi.h>
+#include <lwip/priv/tcpip_priv.h>
 
 #include <lwip-hurd.h>
+#include <ifreg.h>
+#include <route.h>
 #include <options.h>
 #include <netif/hurdethif.h>
 #include <netif/hurdtunif.h>
 #include <netif/hurdloopif.h>
+#include <netif/neighcache.h>
+
+/* Serializes the configuration changes */
+static pthread_mutex_t init_ifs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Whether the startup configuration is still to be applied. Later ones
+ * wait for it, or it would undo them.
+ */
+static int startup_pending;
+static pthread_cond_t startup_done = PTHREAD_COND_INITIALIZER;
 
 /*
  * Detect the proper module for the given device name
@@ -54,7 +70,10 @@ create_netif_state (char *name, struct ifcommon *ifc)
   if (strncmp (base_name, "tun", 3) == 0)
     ifc->init = hurdtunif_device_init;
   else
-    ifc->init = hurdethif_device_init;
+    {
+      ifc->probe = hurdethif_device_probe;
+      ifc->init = hurdethif_device_init;
+    }
 
   /* Freed in the module terminate callback */
   ifc->devname = strndup (name, strlen (name));
@@ -98,7 +117,13 @@ ipv4config_is_valid (uint32_t addr, uint32_t netmask,
   return 1;
 }
 
-/* Configure the loopback interface */
+static err_t
+init_loopback_locked (struct netif *netif)
+{
+  return if_init (netif) ? ERR_IF : ERR_OK;
+}
+
+/* Configure the loopback interface, the stack is already running */
 static void
 init_loopback ()
 {
@@ -108,60 +133,439 @@ init_loopback ()
   ifc.init = hurdloopif_device_init;
   netif_list->state = &ifc;
 
-  if_init (netif_list);
+  netifapi_netif_common (netif_list, 0, init_loopback_locked);
 }
 
-/* Remove the existing interfaces, but the loopback one */
-void
-remove_ifs ()
+/*
+ * Whether the device names A and B are the same device. A tunnel given by
+ * its bare name is set up at /dev, and its interface keeps that path, so
+ * "tun0" and "/dev/tun0" are the same.
+ */
+static int
+same_device (const char *a, const char *b)
 {
-  struct netif *netif;
+  if (strncmp (a, "/dev/tun", 8) == 0 && !strchr (a + 5, '/'))
+    a += 5;
+  if (strncmp (b, "/dev/tun", 8) == 0 && !strchr (b + 5, '/'))
+    b += 5;
+
+  return strcmp (a, b) == 0;
+}
 
-  netif = netif_list;
-  while (netif != 0)
+/* Find the wanted configuration for NAME, if any */
+static struct parse_interface *
+find_config (struct parse_hook *ifs, char *name)
+{
+  struct parse_interface *in;
+
+  for (in = ifs->interfaces; in < ifs->interfaces + ifs->num_interfaces; in++)
+    if (in->dev_name[0] && same_device (in->dev_name, name))
+      return in;
+
+  return 0;
+}
+
+/* Remove the interfaces not in IFS, but the loopback one */
+static void
+remove_ifs (struct parse_hook *ifs)
+{
+  struct netif *netif, *next, *removed = 0;
+
+  /* Take them out of the stack, keeping them in our own list */
+  for (netif = netif_list; netif != 0; netif = next)
     {
+      next = netif->next;
+
       /* Skip the loopback interface */
       if (netif_get_state (netif)->type == ARPHRD_LOOPBACK)
-	{
-	  netif = netif->next;
-	  continue;
-	}
-      if_terminate (netif);
+	continue;
+
+      /* Keep the ones still configured */
+      if (find_config (ifs, netif_get_state (netif)->devname))
+	continue;
+
+      route_flush (netif);
       netifapi_netif_remove (netif);
-      free (netif);
+      netif->next = removed;
+      removed = netif;
+    }
 
-      netif = netif_list;
+  if (!removed)
+    return;
+
+  /* Nobody can reach them after this */
+  ifreg_update ();
+
+  for (netif = removed; netif != 0; netif = next)
+    {
+      next = netif->next;
+      if_terminate (netif);
+      free (netif);
     }
 
   return;
 }
 
-/* Initialize the interfaces given by the user through command line */
-void
-init_ifs (void *arg)
+/*
+ * IPv6 configuration of an interface. The stack is running, so it's
+ * changed from the tcpip thread.
+ */
+struct ip6_config_msg
 {
-  error_t err;
-  struct parse_interface *in;
-  struct parse_hook *ifs;
+  struct tcpip_api_call_data call;
   struct netif *netif;
-  struct ifcommon ifc;
+  ip6_addr_t *addrs;		/* LWIP_IPV6_NUM_ADDRESSES of them */
+  int linklocal;
+};
+
+/* Add the user given unicast IPv6 addresses the interface doesn't have,
+   and its link-local one if asked, from the tcpip thread */
+static err_t
+do_add_ip6_addrs (struct tcpip_api_call_data *call)
+{
+  struct ip6_config_msg *msg = (struct ip6_config_msg *) call;
+  struct netif *netif = msg->netif;
   int8_t ipv6_addr_idx;
   ip6_addr_t *address6;
   int i;
 
+  if (msg->linklocal)
+    {
+      netif->ip6_autoconfig_enabled = 1;
+      netif_create_ip6_linklocal_address (netif, 1);
+    }
+
+  for (i = 0; i < LWIP_IPV6_NUM_ADDRESSES; i++)
+    {
+      address6 = &msg->addrs[i];
+
+      if (ip6_addr_isany (address6) || ip6_addr_ismulticast (address6)
+	  || netif_get_ip6_addr_match (netif, address6) >= 0)
+	continue;
+
+      netif_add_ip6_address (netif, address6, &ipv6_addr_idx);
+
+      if (ipv6_addr_idx >= 0)
+	/* First use DAD to make sure nobody else has it */
+	netif_ip6_addr_set_state (netif, ipv6_addr_idx, IP6_ADDR_TENTATIVE);
+      else
+	error (0, 0, "No free slot for IPv6 address: %s\n",
+	       ip6addr_ntoa (address6));
+    }
+
+  return ERR_OK;
+}
+
+static void
+add_ip6_addrs (struct netif *netif, struct parse_interface *in, int linklocal)
+{
+  struct ip6_config_msg msg;
+
+  msg.netif = netif;
+  msg.addrs = (ip6_addr_t *) in->addr6;
+  msg.linklocal = linklocal;
+  tcpip_api_call (do_add_ip6_addrs, &msg.call);
+}
+
+/* Apply the output queue configuration */
+static void
+configure_tunnel (struct netif *netif, struct parse_interface *in)
+{
+  struct tunqueue_params queue;
+
+  if (netif_get_state (netif)->type != ARPHRD_TUNNEL)
+    return;
+
+  hurdtunif_get_queue_params (netif, &queue);
+  if (queue.max_len != in->queue.max_len
+      || queue.max_bytes != in->queue.max_bytes
+      || queue.policy != in->queue.policy)
+    hurdtunif_set_queue_params (netif, &in->queue);
+
+  hurdtunif_set_framed (netif, in->framed);
+  hurdtunif_set_multiqueue (netif, in->multiqueue);
+}
+
+/* Whether the live route R is the user given one PR */
+static int
+same_route (struct route *r, struct parse_route *pr)
+{
+  return route_is (r, &pr->prefix, pr->len, &pr->gateway);
+}
+
+/* Whether a later route in IN to the same prefix replaces the Ith one */
+static int
+route_replaced (struct parse_interface *in, size_t i)
+{
+  struct route r;
+  size_t j;
+
+  ip_addr_copy (r.prefix, in->routes[i].prefix);
+  r.len = in->routes[i].len;
+  for (j = i + 1; j < in->num_routes; j++)
+    if (route_is (&r, &in->routes[j].prefix, in->routes[j].len, 0))
+      return 1;
+
+  return 0;
+}
+
+/*
+ * Change the static routes through the interface to the given ones. The
+ * routes that stay are left alone, so traffic through them isn't
+ * disturbed.
+ */
+static void
+configure_routes (struct netif *netif, struct parse_interface *in)
+{
+  error_t err;
+  struct route *routes;
+  size_t i, j, num;
+
+  if (route_list (netif, &routes, &num))
+    {
+      /* Start over */
+      route_flush (netif);
+      routes = 0;
+      num = 0;
+    }
+
+  /* Remove the routes no longer given */
+  for (i = 0; i < num; i++)
+    {
+      for (j = 0; j < in->num_routes; j++)
+	if (same_route (&routes[i], &in->routes[j]))
+	  break;
+
+      if (j == in->num_routes)
+	route_del (&routes[i].prefix, routes[i].len);
+    }
+
+  for (i = 0; i < in->num_routes; i++)
+    {
+      for (j = 0; j < num; j++)
+	if (same_route (&routes[j], &in->routes[i]))
+	  break;
+
+      if (j < num || route_replaced (in, i))
+	/* Already there, or it would be */
+	continue;
+
+      err = route_add (&in->routes[i].prefix, in->routes[i].len,
+		       &in->routes[i].gateway, netif);
+      if (err)
+	error (0, err, "Cannot add route to %s/%d",
+	       ipaddr_ntoa (&in->routes[i].prefix), in->routes[i].len);
+    }
+
+  free (routes);
+}
+
+/* Find the live interface for NAME, if any */
+static struct netif *
+find_if (char *name)
+{
+  struct netif *netif;
+
+  for (netif = netif_list; netif != 0; netif = netif->next)
+    if (same_device (netif_get_state (netif)->devname, name))
+      break;
+
+  return netif;
+}
+
+/* A new interface, while its device is being opened */
+struct if_probe
+{
+  struct parse_interface *in;
+  struct netif *netif;
+  struct ifcommon ifc;
+  pthread_t thread;
+  int started;
+  error_t err;
+};
+
+static void *
+probe_thread (void *arg)
+{
+  struct if_probe *probe = arg;
+
+  probe->err = probe->ifc.probe (probe->netif);
+
+  return 0;
+}
+
+/*
+ * Open the devices of the new interfaces, all at once. Devices are slow
+ * to answer, and the stack doesn't need to wait for them.
+ *
+ * Returns the number of new interfaces.
+ */
+static size_t
+probe_ifs (struct if_probe *probes, struct parse_hook *ifs)
+{
+  struct if_probe *probe;
+  size_t i, num = 0;
+
+  for (i = 0; i < ifs->num_interfaces; i++)
+    {
+      probe = &probes[i];
+      if (!ifs->interfaces[i].dev_name[0]
+	  || find_if (ifs->interfaces[i].dev_name))
+	continue;
+
+      probe->netif = calloc (1, sizeof (struct netif));
+      if (!probe->netif)
+	continue;
+
+      probe->in = &ifs->interfaces[i];
+      create_netif_state (probe->in->dev_name, &probe->ifc);
+      probe->netif->state = &probe->ifc;
+      num++;
+
+      if (!probe->ifc.probe)
+	continue;
+
+      probe->started =
+	!pthread_create (&probe->thread, 0, probe_thread, probe);
+      if (!probe->started)
+	/* Do it ourselves */
+	probe->err = probe->ifc.probe (probe->netif);
+    }
+
+  for (i = 0; i < ifs->num_interfaces; i++)
+    if (probes[i].started)
+      pthread_join (probes[i].thread, 0);
+
+  return num;
+}
+
+/* Add a new interface to the stack, once probed */
+static struct netif *
+add_if (struct if_probe *probe)
+{
+  error_t err;
+  struct netif *netif = probe->netif;
+  struct parse_interface *in = probe->in;
+
+  if (probe->err)
+    {
+      /* The device couldn't be opened, the probe left nothing open */
+      free (probe->ifc.devname);
+      free (netif);
+      return 0;
+    }
+
+  /*
+   * Create a new interface and configre IPv4.
+   *
+   * Fifth parameter (in->name) is a hook.
+   */
+  err = netifapi_netif_add
+    (netif, &in->address, &in->netmask, &in->gateway, &probe->ifc, if_init,
+     tcpip_input);
+  if (err)
+    {
+      /* The interface failed to init */
+      if (netif->state != &probe->ifc)
+	/* It failed after setting the control block, must free it */
+	free (netif->state);
+      else if (probe->ifc.probe && probe->ifc.close)
+	/* Close the device the probe opened */
+	probe->ifc.close (netif);
+      free (probe->ifc.devname);
+      free (netif);
+      return 0;
+    }
+
+  /* Add IPv6 configuration and the user given unicast addresses */
+  add_ip6_addrs (netif, in, 1);
+
+  configure_tunnel (netif, in);
+
+  /* Up the inerface */
+  netifapi_netif_set_up (netif);
+
+  /* Set the first interface with valid gateway as default */
+  if (in->gateway.addr != INADDR_NONE)
+    {
+      netifapi_netif_set_default (netif);
+    }
+
+  return netif;
+}
+
+/*
+ * Apply the changes in its configuration to a live interface. The device
+ * stays open, and so the stack keeps its state.
+ *
+ * IPv6 addresses are only added, the stack doesn't tell the user given
+ * ones from the autoconfigured.
+ */
+static void
+reconfigure_if (struct netif *netif, struct parse_interface *in)
+{
+  if (netif_ip4_addr (netif)->addr != in->address.addr
+      || netif_ip4_netmask (netif)->addr != in->netmask.addr
+      || netif_ip4_gw (netif)->addr != in->gateway.addr)
+    netifapi_netif_set_addr (netif, &in->address, &in->netmask,
+			     &in->gateway);
+
+  add_ip6_addrs (netif, in, 0);
+
+  configure_tunnel (netif, in);
+
+  if (in->gateway.addr != INADDR_NONE && netif_default != netif)
+    netifapi_netif_set_default (netif);
+}
+
+/*
+ * Apply the configuration IFS and free it. On reconfiguration, only the
+ * differences with the live interfaces are applied.
+ *
+ * Returns the number of new interfaces. Must be called with init_ifs_lock
+ * held.
+ */
+static size_t
+apply_ifs (struct parse_hook *ifs)
+{
+  struct parse_interface *in;
+  struct netif *netif;
+  struct if_probe *probes;
+  size_t num_new = 0;
+  error_t err;
+
+  if (ifs->neigh_size)
+    {
+      err = neighcache_set_size (ifs->neigh_size);
+      if (err)
+	error (0, err, "Cannot resize the neighbour cache");
+    }
+
+  /* Leave out the incomplete or invalid configurations */
+  for (in = ifs->interfaces; in < ifs->interfaces + ifs->num_interfaces; in++)
+    if (in->dev_name[0]
+	&& !ipv4config_is_valid (in->address.addr, in->netmask.addr,
+				 in->gateway.addr, INADDR_NONE))
+      in->dev_name[0] = 0;
+
   if (netif_list != 0)
     {
       if (netif_list->next == 0)
 	init_loopback ();
       else
-	remove_ifs ();
+	remove_ifs (ifs);
     }
 
+  probes = calloc (ifs->num_interfaces, sizeof (struct if_probe));
+  if (probes)
+    num_new = probe_ifs (probes, ifs);
+  else
+    error (0, ENOMEM, "Cannot add new interfaces");
+
   /*
    * Go through the list backwards. For LwIP
    * to create its list in the proper order.
    */
-  ifs = (struct parse_hook *) arg;
   for (in = ifs->interfaces + ifs->num_interfaces - 1;
        in >= ifs->interfaces; in--)
     {
@@ -169,70 +573,112 @@ init_ifs (void *arg)
       if (!in->dev_name[0])
 	continue;
 
-      if (!ipv4config_is_valid (in->address.addr, in->netmask.addr,
-				in->gateway.addr, INADDR_NONE))
-	continue;
+      netif = find_if (in->dev_name);
+      if (netif)
+	reconfigure_if (netif, in);
+      else if (probes && probes[in - ifs->interfaces].in)
+	netif = add_if (&probes[in - ifs->interfaces]);
 
-      netif = calloc (1, sizeof (struct netif));
+      if (netif)
+	configure_routes (netif, in);
+    }
 
-      create_netif_state (in->dev_name, &ifc);
+  free (probes);
 
-      /*
-       * Create a new interface and configre IPv4.
-       *
-       * Fifth parameter (in->name) is a hook.
-       */
-      err = netifapi_netif_add
-	(netif, &in->address, &in->netmask, &in->gateway, &ifc, if_init,
-	 tcpip_input);
-      if (err)
-	{
-	  /* The interface failed to init */
-	  if (netif->state != in->dev_name)
-	    /* It failed after setting the control block, must free it */
-	    mem_free (netif->state);
-	  free (netif);
-	  continue;
-	}
+  /* Publish the new interfaces */
+  ifreg_update ();
 
-      /* Add IPv6 configuration */
-      netif->ip6_autoconfig_enabled = 1;
-      netif_create_ip6_linklocal_address (netif, 1);
+  /* Free the hook */
+  for (in = ifs->interfaces; in < ifs->interfaces + ifs->num_interfaces; in++)
+    free (in->routes);
+  free (ifs->interfaces);
+  free (ifs);
 
-      /* Add user given unicast addresses */
-      for (i = 0; i < LWIP_IPV6_NUM_ADDRESSES; i++)
-	{
-	  address6 = (ip6_addr_t *) & in->addr6[i];
-
-	  if (!ip6_addr_isany (address6) && !ip6_addr_ismulticast (address6))
-	    {
-	      netif_add_ip6_address (netif, address6, &ipv6_addr_idx);
-
-	      if (ipv6_addr_idx >= 0)
-		/* First use DAD to make sure nobody else has it */
-		netif_ip6_addr_set_state (netif, ipv6_addr_idx,
-					  IP6_ADDR_TENTATIVE);
-	      else
-		error (0, 0, "No free slot for IPv6 address: %s\n",
-		       ip6addr_ntoa (address6));
-	    }
-	}
+  return num_new;
+}
+
+/* Initialize the interfaces given by the user through command line */
+void
+init_ifs (void *arg)
+{
+  pthread_mutex_lock (&init_ifs_lock);
+
+  while (startup_pending)
+    pthread_cond_wait (&startup_done, &init_ifs_lock);
+  apply_ifs (arg);
+
+  pthread_mutex_unlock (&init_ifs_lock);
+}
+
+/* Apply the startup configuration, and tell how long it took */
+static void *
+startup_thread (void *arg)
+{
+  struct timespec start, end;
+  size_t num_new;
+
+  pthread_mutex_lock (&init_ifs_lock);
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  num_new = apply_ifs (arg);
+  if (num_new)
+    {
+      clock_gettime (CLOCK_MONOTONIC, &end);
+      error (0, 0, "%zu interfaces brought up in %ld ms", num_new,
+	     (long) ((end.tv_sec - start.tv_sec) * 1000
+		     + (end.tv_nsec - start.tv_nsec) / 1000000));
+    }
+
+  startup_pending = 0;
+  pthread_cond_broadcast (&startup_done);
+
+  pthread_mutex_unlock (&init_ifs_lock);
+
+  return 0;
+}
+
+/*
+ * Like init_ifs, but bring the interfaces up in the background. Must be
+ * called before serving any request, so the configurations given through
+ * them are applied after this one.
+ */
+void
+init_ifs_background (void *arg)
+{
+  pthread_t thread;
+
+  pthread_mutex_lock (&init_ifs_lock);
+  startup_pending = 1;
+  pthread_mutex_unlock (&init_ifs_lock);
+
+  if (pthread_create (&thread, 0, startup_thread, arg))
+    /* Do it ourselves */
+    startup_thread (arg);
+  else
+    pthread_detach (thread);
+}
 
-      /* Up the inerface */
-      netifapi_netif_set_up (netif);
+/* Replace the IPv6 addresses given, from the tcpip thread */
+static err_t
+do_set_ip6_addrs (struct tcpip_api_call_data *call)
+{
+  struct ip6_config_msg *msg = (struct ip6_config_msg *) call;
+  ip6_addr_t *laddr6;
+  int i;
 
-      /* Set the first interface with valid gateway as default */
-      if (in->gateway.addr != INADDR_NONE)
+  for (i = 0; i < LWIP_IPV6_NUM_ADDRESSES; i++)
+    {
+      laddr6 = &msg->addrs[i];
+      if (!ip6_addr_isany (laddr6))
 	{
-	  netifapi_netif_set_default (netif);
+	  netif_ip6_addr_set (msg->netif, i, laddr6);
+
+	  if (!ip6_addr_islinklocal (laddr6))
+	    netif_ip6_addr_set_state (msg->netif, i, IP6_ADDR_TENTATIVE);
 	}
     }
 
-  /* Free the hook */
-  free (ifs->interfaces);
-  free (ifs);
-
-  return;
+  return ERR_OK;
 }
 
 /*
@@ -244,6 +690,7 @@ update_if (struct netif *netif, uint32_t addr, uint32_t netmask,
 	   uint32_t * addr6, uint8_t * addr6_prefix_len)
 {
   error_t err;
+  struct ip6_config_msg msg;
   int i;
 
   err = 0;
@@ -253,17 +700,11 @@ update_if (struct netif *netif, uint32_t addr, uint32_t netmask,
 			   (ip4_addr_t *) & gateway);
 
   if (addr6)
-    for (i = 0; i < LWIP_IPV6_NUM_ADDRESSES; i++)
-      {
-	ip6_addr_t *laddr6 = ((ip6_addr_t *) addr6 + i);
-	if (!ip6_addr_isany (laddr6))
-	  {
-	    netif_ip6_addr_set (netif, i, laddr6);
-
-	    if (!ip6_addr_islinklocal (laddr6))
-	      netif_ip6_addr_set_state (netif, i, IP6_ADDR_TENTATIVE);
-	  }
-      }
+    {
+      msg.netif = netif;
+      msg.addrs = (ip6_addr_t *) addr6;
+      tcpip_api_call (do_set_ip6_addrs, &msg.call);
+    }
 
   if (addr6_prefix_len)
     for (i = 0; i < LWIP_IPV6_NUM_ADDRESSES; i++)
@@ -28,6 +28,7 @@
 #include <lwip/netif.h>
 
 void init_ifs (void *arg);
+void init_ifs_background (void *arg);
 
 void inquire_device (struct netif *netif, uint32_t * addr, uint32_t * netmask,
 		     uint32_t * peer, uint32_t * broadcast,
@@ -38,6 +38,12 @@
 #include <netif/hurdethif.h>
 #include <netif/hurdtunif.h>
 #include <startup.h>
+#include <stats.h>
+#include <capture.h>
+#include <tcptrace.h>
+#include <tcpinfo.h>
+#include <rpcstats.h>
+#include <ifreg.h>
 
 /* Translator initialization */
 
@@ -52,11 +58,6 @@ int trivfs_support_write = 0;
 int trivfs_support_exec = 0;
 int trivfs_allow_open = O_READ | O_WRITE;
 
-void
-trivfs_modify_stat (struct trivfs_protid *cred, io_statbuf_t * st)
-{
-}
-
 error_t
 trivfs_goaway (struct trivfs_control *fsys, int flags)
 {
@@ -95,8 +96,8 @@ trivfs_goaway (struct trivfs_control *fsys, int flags)
     }
 }
 
-int
-lwip_demuxer (mach_msg_header_t * inp, mach_msg_header_t * outp)
+static int
+demux (mach_msg_header_t * inp, mach_msg_header_t * outp)
 {
   struct port_info *pi;
 
@@ -152,6 +153,24 @@ lwip_demuxer (mach_msg_header_t * inp, mach_msg_header_t * outp)
   return 0;
 }
 
+int
+lwip_demuxer (mach_msg_header_t * inp, mach_msg_header_t * outp)
+{
+#if LWIP_RPC_STATS
+  uint64_t start = rpcstats_now ();
+  int handled;
+
+  handled = demux (inp, outp);
+  if (handled)
+    rpcstats_record (inp->msgh_id, ((mig_reply_header_t *) outp)->RetCode,
+		     start);
+
+  return handled;
+#else
+  return demux (inp, outp);
+#endif
+}
+
 void
 translator_bind (int portclass, const char *name)
 {
@@ -204,6 +223,10 @@ main (int argc, char **argv)
   struct stat st;
   mach_port_t bootstrap;
 
+  err = objcache_init (&socket_cache, "socket", sizeof (struct socket));
+  if (err)
+    error (1, err, "Cannot create the socket cache");
+
   lwip_bucket = ports_create_bucket ();
   addrport_class = ports_create_class (clean_addrport, 0);
   socketport_class = ports_create_class (clean_socketport, 0);
@@ -213,11 +236,26 @@ main (int argc, char **argv)
 		      MACH_PORT_RIGHT_RECEIVE, &fsys_identity);
 
   /* Init the device modules */
+  ifreg_init ();
   hurdethif_module_init ();
-  hurdtunif_module_init ();
+  err = hurdtunif_module_init ();
+  if (err)
+    error (1, err, "Cannot create the tunnel classes");
+  err = stats_module_init ();
+  if (err)
+    error (1, err, "Cannot create the statistics classes");
+  err = capture_module_init ();
+  if (err)
+    error (1, err, "Cannot create the capture classes");
+  err = tcptrace_module_init ();
+  if (err)
+    error (1, err, "Cannot create the trace classes");
+  err = tcpinfo_module_init ();
+  if (err)
+    error (1, err, "Cannot create the connections classes");
 
-  /* Parse options.  When successful, this configures the interfaces
-     before returning */
+  /* Parse options.  When successful, this starts the stack and brings the
+     interfaces up in the background */
   argp_parse (&lwip_argp, argc, argv, 0, 0, 0);
 
   task_get_bootstrap_port (mach_task_self (), &bootstrap);
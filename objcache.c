@@ -0,0 +1,302 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Object caches */
+
+#include <objcache.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Each thread keeps two magazines per cache, a loaded one and the
+ * previous one, and allocates from and frees to them without locking.
+ * Only when both are empty, or both full, it exchanges one with the
+ * cache's depot under its lock.
+ *
+ * Objects are carved from slabs taken from malloc, which are never
+ * given back: a cache keeps as much memory as its peak usage needed.
+ */
+
+struct objcache_mag
+{
+  struct objcache_mag *next;
+  int rounds;
+  void *objs[OBJCACHE_MAG_SIZE];
+};
+
+/* The magazines of a thread, indexed by cache id */
+struct objcache_thread
+{
+  struct objcache_mag *loaded[OBJCACHE_MAX];
+  struct objcache_mag *prev[OBJCACHE_MAX];
+};
+
+static struct objcache *caches[OBJCACHE_MAX];
+static int num_caches;
+static pthread_mutex_t caches_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+
+/* Give the magazines of an exiting thread back to the depots */
+static void
+thread_destroy (void *arg)
+{
+  struct objcache_thread *t = arg;
+  struct objcache_mag *mags[2];
+  struct objcache *c;
+  int i, j;
+
+  for (i = 0; i < OBJCACHE_MAX; i++)
+    {
+      c = caches[i];
+      mags[0] = t->loaded[i];
+      mags[1] = t->prev[i];
+
+      if (!mags[0] && !mags[1])
+	continue;
+
+      pthread_mutex_lock (&c->lock);
+      for (j = 0; j < 2; j++)
+	{
+	  if (!mags[j])
+	    continue;
+
+	  if (mags[j]->rounds)
+	    {
+	      mags[j]->next = c->full;
+	      c->full = mags[j];
+	    }
+	  else
+	    {
+	      mags[j]->next = c->empty;
+	      c->empty = mags[j];
+	    }
+	}
+      pthread_mutex_unlock (&c->lock);
+    }
+
+  free (t);
+}
+
+static void
+thread_key_create (void)
+{
+  pthread_key_create (&thread_key, thread_destroy);
+}
+
+/* Get the magazines of the calling thread, or NULL */
+static struct objcache_thread *
+thread_get (void)
+{
+  struct objcache_thread *t;
+
+  t = pthread_getspecific (thread_key);
+  if (!t)
+    {
+      t = calloc (1, sizeof (struct objcache_thread));
+      if (t && pthread_setspecific (thread_key, t))
+	{
+	  free (t);
+	  t = 0;
+	}
+    }
+
+  return t;
+}
+
+error_t
+objcache_init (struct objcache *c, const char *name, size_t size)
+{
+  pthread_once (&thread_key_once, thread_key_create);
+
+  memset (c, 0, sizeof (struct objcache));
+  c->name = name;
+
+  /* Keep the objects aligned, and big enough for the free list */
+  if (size < sizeof (void *))
+    size = sizeof (void *);
+  c->size = (size + 15) & ~(size_t) 15;
+
+  pthread_mutex_init (&c->lock, 0);
+
+  pthread_mutex_lock (&caches_lock);
+  if (num_caches == OBJCACHE_MAX)
+    {
+      pthread_mutex_unlock (&caches_lock);
+      return ENOSPC;
+    }
+  c->id = num_caches;
+  caches[num_caches++] = c;
+  pthread_mutex_unlock (&caches_lock);
+
+  return 0;
+}
+
+/* Get an object from the free list or a slab, with C locked */
+static void *
+depot_alloc (struct objcache *c)
+{
+  void *obj;
+
+  if (c->free)
+    {
+      obj = c->free;
+      c->free = *(void **) obj;
+      return obj;
+    }
+
+  if (c->slab_left < c->size)
+    {
+      c->slab = malloc (OBJCACHE_SLAB_SIZE);
+      if (!c->slab)
+	{
+	  c->slab_left = 0;
+	  return 0;
+	}
+      c->slab_left = OBJCACHE_SLAB_SIZE;
+      c->slab_bytes += OBJCACHE_SLAB_SIZE;
+    }
+
+  obj = c->slab;
+  c->slab += c->size;
+  c->slab_left -= c->size;
+
+  return obj;
+}
+
+void *
+objcache_alloc (struct objcache *c)
+{
+  struct objcache_thread *t;
+  struct objcache_mag *m;
+  void *obj;
+
+  t = thread_get ();
+  if (t)
+    {
+      m = t->loaded[c->id];
+      if (m && m->rounds > 0)
+	goto out;
+
+      m = t->prev[c->id];
+      if (m && m->rounds > 0)
+	{
+	  t->prev[c->id] = t->loaded[c->id];
+	  t->loaded[c->id] = m;
+	  goto out;
+	}
+
+      /* Both empty, exchange the previous one for a full one */
+      pthread_mutex_lock (&c->lock);
+      m = c->full;
+      if (m)
+	{
+	  c->full = m->next;
+	  if (t->prev[c->id])
+	    {
+	      t->prev[c->id]->next = c->empty;
+	      c->empty = t->prev[c->id];
+	    }
+	  t->prev[c->id] = t->loaded[c->id];
+	  t->loaded[c->id] = m;
+	  pthread_mutex_unlock (&c->lock);
+	  goto out;
+	}
+      pthread_mutex_unlock (&c->lock);
+    }
+
+  pthread_mutex_lock (&c->lock);
+  obj = depot_alloc (c);
+  pthread_mutex_unlock (&c->lock);
+
+  if (obj)
+    objstats_alloc (&c->stats);
+
+  return obj;
+
+out:
+  objstats_alloc (&c->stats);
+  return m->objs[--m->rounds];
+}
+
+void
+objcache_free (struct objcache *c, void *obj)
+{
+  struct objcache_thread *t;
+  struct objcache_mag *m;
+
+  objstats_free (&c->stats);
+
+  t = thread_get ();
+  if (t)
+    {
+      m = t->loaded[c->id];
+      if (m && m->rounds < OBJCACHE_MAG_SIZE)
+	goto out;
+
+      m = t->prev[c->id];
+      if (m && m->rounds < OBJCACHE_MAG_SIZE)
+	{
+	  t->prev[c->id] = t->loaded[c->id];
+	  t->loaded[c->id] = m;
+	  goto out;
+	}
+
+      /* Both full or missing, exchange the previous one for an empty one */
+      pthread_mutex_lock (&c->lock);
+      m = c->empty;
+      if (m)
+	c->empty = m->next;
+      pthread_mutex_unlock (&c->lock);
+
+      if (!m)
+	{
+	  m = malloc (sizeof (struct objcache_mag));
+	  if (m)
+	    m->rounds = 0;
+	}
+
+      if (m)
+	{
+	  if (t->prev[c->id])
+	    {
+	      pthread_mutex_lock (&c->lock);
+	      t->prev[c->id]->next = c->full;
+	      c->full = t->prev[c->id];
+	      pthread_mutex_unlock (&c->lock);
+	    }
+	  t->prev[c->id] = t->loaded[c->id];
+	  t->loaded[c->id] = m;
+	  goto out;
+	}
+    }
+
+  pthread_mutex_lock (&c->lock);
+  *(void **) obj = c->free;
+  c->free = obj;
+  pthread_mutex_unlock (&c->lock);
+
+  return;
+
+out:
+  m->objs[m->rounds++] = obj;
+}
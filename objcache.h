@@ -0,0 +1,110 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Object caches */
+
+#ifndef LWIP_OBJCACHE_H
+#define LWIP_OBJCACHE_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/* Maximum number of caches */
+#define OBJCACHE_MAX        8
+
+/* Objects in a magazine */
+#define OBJCACHE_MAG_SIZE   32
+
+/* Memory taken from malloc at once */
+#define OBJCACHE_SLAB_SIZE  (16 * 1024)
+
+/* Allocation counters, the live count is allocs - frees */
+struct objstats
+{
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t peak;		/* Highest live count seen */
+};
+
+struct objcache_mag;
+
+/* A cache of objects of the same size */
+struct objcache
+{
+  const char *name;
+  size_t size;
+  int id;
+
+  pthread_mutex_t lock;
+  struct objcache_mag *full;	/* Magazines ready to be loaded */
+  struct objcache_mag *empty;	/* Magazines ready to be filled */
+  void *free;			/* Objects freed without a magazine */
+  char *slab;			/* Part of the last slab not used yet */
+  size_t slab_left;
+  size_t slab_bytes;		/* Memory taken from malloc */
+
+  struct objstats stats;
+};
+
+/* Set up C for objects of SIZE bytes */
+error_t objcache_init (struct objcache *c, const char *name, size_t size);
+
+/* Get an uninitialized object from C, or NULL */
+void *objcache_alloc (struct objcache *c);
+void objcache_free (struct objcache *c, void *obj);
+
+/* Counters for objects allocated elsewhere */
+static inline uint64_t
+objstats_live (struct objstats *s)
+{
+  return __atomic_load_n (&s->allocs, __ATOMIC_RELAXED)
+    - __atomic_load_n (&s->frees, __ATOMIC_RELAXED);
+}
+
+static inline void
+objstats_alloc (struct objstats *s)
+{
+  uint64_t live, peak;
+
+  __atomic_add_fetch (&s->allocs, 1, __ATOMIC_RELAXED);
+
+  live = objstats_live (s);
+  peak = __atomic_load_n (&s->peak, __ATOMIC_RELAXED);
+  while (live > peak
+	 && !__atomic_compare_exchange_n (&s->peak, &peak, live, 1,
+					  __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static inline void
+objstats_free (struct objstats *s)
+{
+  __atomic_add_fetch (&s->frees, 1, __ATOMIC_RELAXED);
+}
+
+static inline void
+objstats_get (struct objstats *s, struct objstats *copy)
+{
+  copy->allocs = __atomic_load_n (&s->allocs, __ATOMIC_RELAXED);
+  copy->frees = __atomic_load_n (&s->frees, __ATOMIC_RELAXED);
+  copy->peak = __atomic_load_n (&s->peak, __ATOMIC_RELAXED);
+}
+
+#endif /* LWIP_OBJCACHE_H */
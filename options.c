@@ -25,6 +25,8 @@
 #include <options.h>
 
 #include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
 #include <argp.h>
 #include <argz.h>
 #include <sys/socket.h>
@@ -37,11 +39,26 @@
 #include <lwip/tcpip.h>
 
 #include <lwip-hurd.h>
+#include <ifreg.h>
+#include <route.h>
+#include <stats.h>
+#include <capture.h>
+#include <tcptrace.h>
+#include <tcpinfo.h>
 #include <lwip-util.h>
 #include <netif/ifcommon.h>
+#include <netif/neighcache.h>
 
 /* Fsysopts and command line option parsing */
 
+/* Names of the tunnel drop policies, indexed by enum tun_drop_policy */
+static const char *const drop_policies[] = { "tail", "head", "codel", 0 };
+
+#ifndef LWIP_HOOK_FILENAME
+/* Whether the user was told the static routes go unused */
+static int route_hooks_warned;
+#endif
+
 /* Adds an empty interface slot to H, and sets H's current interface to it, or
    returns an error. */
 static error_t
@@ -66,10 +83,36 @@ parse_hook_add_interface (struct parse_hook *h)
   h->curint->gateway.addr = INADDR_NONE;
   for (i = 0; i < LWIP_IPV6_NUM_ADDRESSES; i++)
     ip6_addr_set_zero ((ip6_addr_t *) & h->curint->addr6[i]);
+  h->curint->queue.max_len = TUN_QUEUE_DEFAULT_LEN;
+  h->curint->queue.max_bytes = TUN_QUEUE_DEFAULT_BYTES;
+  h->curint->queue.policy = TUN_QUEUE_DEFAULT_POLICY;
+  h->curint->framed = 0;
+  h->curint->multiqueue = 0;
+  h->curint->routes = 0;
+  h->curint->num_routes = 0;
 
   return 0;
 }
 
+/*
+ * Parse the decimal number ARG into VAL, and check it's no more than MAX.
+ * strtoul takes negative numbers and saturates on overflow, and where long
+ * has 32 bits the result still fits, so both are checked for here.
+ */
+static int
+parse_number (const char *arg, unsigned long max, unsigned long *val)
+{
+  char *end;
+
+  if (*arg < '0' || *arg > '9')
+    return 0;
+
+  errno = 0;
+  *val = strtoul (arg, &end, 10);
+
+  return !*end && errno != ERANGE && *val <= max;
+}
+
 /* Option parser */
 static error_t
 parse_opt (int opt, char *arg, struct argp_state *state)
@@ -108,9 +151,11 @@ parse_opt (int opt, char *arg, struct argp_state *state)
   switch (opt)
     {
       struct parse_interface *in;
+      struct parse_route *route;
       uint8_t addr6_prefix_len;
       ip6_addr_t *address6;
-      char *ptr;
+      unsigned long len;
+      char *ptr, *gw;
 
     case 'i':
       /* An interface.  */
@@ -246,6 +291,133 @@ parse_opt (int opt, char *arg, struct argp_state *state)
 
       break;
 
+    case OPT_ROUTE:
+      /* Static route */
+      route = realloc (h->curint->routes,
+		       (h->curint->num_routes + 1) *
+		       sizeof (struct parse_route));
+      if (!route)
+	FAIL (ENOMEM, 1, ENOMEM, "option parsing");
+      h->curint->routes = route;
+      route += h->curint->num_routes;
+
+      if ((gw = strchr (arg, ',')))
+	*gw++ = 0;
+
+      if (!(ptr = strchr (arg, '/')))
+	PERR (EINVAL, "%s: No prefix-length given", arg);
+      *ptr++ = 0;
+
+      if (!ipaddr_aton (arg, &route->prefix))
+	PERR (EINVAL, "Malformed route prefix");
+
+      len = strtoul (ptr, &ptr, 10);
+      if (*ptr || len > (IP_IS_V6 (&route->prefix) ? 128 : 32))
+	PERR (EINVAL, "%s: The prefix-length is invalid", arg);
+      route->len = len;
+
+      if (gw)
+	{
+	  if (!ipaddr_aton (gw, &route->gateway)
+	      || IP_IS_V6 (&route->gateway) != IP_IS_V6 (&route->prefix))
+	    PERR (EINVAL, "Malformed route gateway");
+	}
+      else
+	ip_addr_set_any (IP_IS_V6 (&route->prefix), &route->gateway);
+
+      h->curint->num_routes++;
+
+#ifndef LWIP_HOOK_FILENAME
+      /* LwIP only asks the table through the hooks in lwiphooks.h */
+      if (!route_hooks_warned)
+	{
+	  error (0, 0, "Warning: LwIP wasn't built with the routing hooks, "
+		 "static routes won't be used");
+	  route_hooks_warned = 1;
+	}
+#endif
+      break;
+
+    case OPT_NEIGH_CACHE:
+      if (!parse_number (arg, UINT32_MAX, &len) || len == 0)
+	PERR (EINVAL, "Malformed neighbour cache size");
+      h->neigh_size = len;
+      break;
+
+    case OPT_MAX_SOCKETS:
+      if (!parse_number (arg, UINT_MAX, &len))
+	PERR (EINVAL, "Malformed socket limit");
+      h->max_sockets = len;
+      break;
+
+    case OPT_TCP_MEM:
+      if (!parse_number (arg, UINT32_MAX, &len))
+	PERR (EINVAL, "Malformed TCP memory limit");
+      h->tcp_mem = len;
+      break;
+
+    case OPT_USER_MEM:
+      if (!parse_number (arg, UINT32_MAX, &len))
+	PERR (EINVAL, "Malformed user memory limit");
+      h->user_mem = len;
+      break;
+
+    case OPT_STATS:
+      h->stats_path = arg;
+      break;
+
+    case OPT_CAPTURE:
+      h->capture_path = arg;
+      break;
+
+    case OPT_SNAPLEN:
+      if (!parse_number (arg, UINT32_MAX, &len) || len == 0)
+	PERR (EINVAL, "Malformed snap length");
+      h->snaplen = len;
+      break;
+
+    case OPT_TCP_TRACE:
+      h->tcp_trace_path = arg;
+      h->tcp_trace = 1;
+      break;
+
+    case OPT_NO_TCP_TRACE:
+      h->tcp_trace = 0;
+      break;
+
+    case OPT_CONNECTIONS:
+      h->connections_path = arg;
+      break;
+
+    case OPT_QUEUE_LEN:
+      if (!parse_number (arg, UINT32_MAX, &len) || len == 0)
+	PERR (EINVAL, "Malformed queue length");
+      h->curint->queue.max_len = len;
+      break;
+
+    case OPT_QUEUE_BYTES:
+      if (!parse_number (arg, UINT32_MAX, &len))
+	PERR (EINVAL, "Malformed queue byte limit");
+      h->curint->queue.max_bytes = len;
+      break;
+
+    case OPT_DROP_POLICY:
+      for (i = 0; drop_policies[i]; i++)
+	if (strcmp (arg, drop_policies[i]) == 0)
+	  break;
+      if (!drop_policies[i])
+	PERR (EINVAL, "Unknown drop policy: %s", arg);
+      h->curint->queue.policy = i;
+      break;
+
+    case OPT_FRAMED:
+      h->curint->framed = 1;
+      break;
+
+    case OPT_MULTIQUEUE:
+      h->curint->multiqueue = 1;
+      break;
+
     case ARGP_KEY_INIT:
       /* Initialize our parsing state.  */
       h = malloc (sizeof (struct parse_hook));
@@ -254,6 +426,16 @@ parse_opt (int opt, char *arg, struct argp_state *state)
 
       h->interfaces = 0;
       h->num_interfaces = 0;
+      h->neigh_size = 0;
+      h->max_sockets = -1;
+      h->tcp_mem = -1;
+      h->user_mem = -1;
+      h->stats_path = 0;
+      h->capture_path = 0;
+      h->snaplen = 0;
+      h->tcp_trace_path = 0;
+      h->tcp_trace = -1;
+      h->connections_path = 0;
       err = parse_hook_add_interface (h);
       if (err)
 	FAIL (err, 12, err, "option parsing");
@@ -262,10 +444,57 @@ parse_opt (int opt, char *arg, struct argp_state *state)
       break;
 
     case ARGP_KEY_SUCCESS:
+      /* First what can fail, so nothing is applied then */
+      if (h->stats_path)
+	{
+	  err = stats_node_create (h->stats_path);
+	  if (err)
+	    FAIL (err, 1, err, "%s", h->stats_path);
+	}
+      if (h->capture_path)
+	{
+	  err = capture_node_create (h->capture_path);
+	  if (err)
+	    FAIL (err, 1, err, "%s", h->capture_path);
+	}
+      if (h->tcp_trace_path)
+	{
+	  err = tcptrace_node_create (h->tcp_trace_path);
+	  if (err)
+	    FAIL (err, 1, err, "%s", h->tcp_trace_path);
+	}
+      if (h->connections_path)
+	{
+	  err = tcpinfo_node_create (h->connections_path);
+	  if (err)
+	    FAIL (err, 1, err, "%s", h->connections_path);
+	}
+
+      /* Existing sockets are kept when lowering the limit */
+      if (h->max_sockets >= 0)
+	__atomic_store_n (&lwip_max_sockets, h->max_sockets,
+			  __ATOMIC_RELAXED);
+      if (h->tcp_mem >= 0)
+	__atomic_store_n (&tcptune_mem_limit, h->tcp_mem, __ATOMIC_RELAXED);
+      if (h->user_mem >= 0)
+	__atomic_store_n (&tcptune_user_limit, h->user_mem, __ATOMIC_RELAXED);
+      if (h->snaplen)
+	__atomic_store_n (&capture_snaplen, h->snaplen, __ATOMIC_RELAXED);
+      if (h->tcp_trace >= 0)
+	__atomic_store_n (&tcptrace_enabled, h->tcp_trace, __ATOMIC_RELAXED);
+
       /* If the interface list is not empty, a previous configuration exists */
       if (netif_list == 0)
-	/* Inititalize LwIP */
-	tcpip_init (init_ifs, h);
+	{
+	  /*
+	   * Inititalize LwIP. The interfaces come up in the background, the
+	   * translator serves requests in the meantime.
+	   */
+	  tcpip_init (0, 0);
+	  tcptune_init ();
+	  tcptrace_init ();
+	  init_ifs_background (h);
+	}
       else
 	/* No need to initialize the stack again */
 	init_ifs (h);
@@ -273,6 +502,8 @@ parse_opt (int opt, char *arg, struct argp_state *state)
 
     case ARGP_KEY_ERROR:
       /* Parsing error occurred, free everything. */
+      for (in = h->interfaces; in < h->interfaces + h->num_interfaces; in++)
+	free (in->routes);
       free (h->interfaces);
       free (h);
       break;
@@ -291,10 +522,16 @@ trivfs_append_args (struct trivfs_control * fsys, char **argz,
 {
   error_t err = 0;
   struct netif *netif;
+  struct ifsnapshot *snap;
+  size_t n;
   int i;
   uint32_t addr, netmask, gateway;
   uint32_t addr6[LWIP_IPV6_NUM_ADDRESSES][4];
   uint8_t addr6_prefix_len[LWIP_IPV6_NUM_ADDRESSES];
+  struct tunqueue_params queue;
+  struct route *routes;
+  size_t nroutes;
+  char prefix[IPADDR_STRLEN_MAX], gw[IPADDR_STRLEN_MAX];
 
 #define ADD_OPT(fmt, args...)           \
   do { char buf[100];                   \
@@ -306,8 +543,30 @@ trivfs_append_args (struct trivfs_control * fsys, char **argz,
        i.s_addr = (addr);               \
        ADD_OPT ("--%s=%s", name, inet_ntoa (i)); } while (0)
 
-  for (netif = netif_list; netif != 0; netif = netif->next)
+  if (lwip_max_sockets)
+    ADD_OPT ("--max-sockets=%u", lwip_max_sockets);
+  if (tcptune_mem_limit)
+    ADD_OPT ("--tcp-mem=%u", tcptune_mem_limit);
+  if (tcptune_user_limit)
+    ADD_OPT ("--user-mem=%u", tcptune_user_limit);
+  if (stats_node_path)
+    ADD_OPT ("--stats=%s", stats_node_path);
+  if (capture_node_path)
+    ADD_OPT ("--capture=%s", capture_node_path);
+  if (capture_snaplen != CAPTURE_DEFAULT_SNAPLEN)
+    ADD_OPT ("--snaplen=%u", capture_snaplen);
+  if (tcptrace_node_path && tcptrace_enabled)
+    ADD_OPT ("--tcp-trace=%s", tcptrace_node_path);
+  if (tcpinfo_node_path)
+    ADD_OPT ("--connections=%s", tcpinfo_node_path);
+  if (neighcache_get_size () != NEIGH_DEFAULT_SIZE)
+    ADD_OPT ("--neighbour-cache=%u", neighcache_get_size ());
+
+  snap = ifreg_get ();
+  for (n = 0; n < snap->num; n++)
     {
+      netif = snap->netifs[n];
+
       /* Skip the loopback interface */
       if (netif_get_state (netif)->type == ARPHRD_LOOPBACK)
 	{
@@ -329,7 +588,37 @@ trivfs_append_args (struct trivfs_control * fsys, char **argz,
 	  ADD_OPT ("--address6=%s/%d",
 		   ip6addr_ntoa (((ip6_addr_t *) & addr6[i])),
 		   addr6_prefix_len[i]);
+
+      if (!err && !route_list (netif, &routes, &nroutes))
+	{
+	  for (i = 0; i < nroutes; i++)
+	    {
+	      ipaddr_ntoa_r (&routes[i].prefix, prefix, sizeof prefix);
+	      ipaddr_ntoa_r (&routes[i].gateway, gw, sizeof gw);
+	      if (ip_addr_isany (&routes[i].gateway))
+		ADD_OPT ("--route=%s/%d", prefix, routes[i].len);
+	      else
+		ADD_OPT ("--route=%s/%d,%s", prefix, routes[i].len, gw);
+	    }
+	  free (routes);
+	}
+
+      if (netif_get_state (netif)->type == ARPHRD_TUNNEL)
+	{
+	  hurdtunif_get_queue_params (netif, &queue);
+	  if (queue.max_len != TUN_QUEUE_DEFAULT_LEN)
+	    ADD_OPT ("--queue-length=%u", queue.max_len);
+	  if (queue.max_bytes != TUN_QUEUE_DEFAULT_BYTES)
+	    ADD_OPT ("--queue-bytes=%u", queue.max_bytes);
+	  if (queue.policy != TUN_QUEUE_DEFAULT_POLICY)
+	    ADD_OPT ("--drop-policy=%s", drop_policies[queue.policy]);
+	  if (hurdtunif_get_framed (netif))
+	    ADD_OPT ("--framed");
+	  if (hurdtunif_get_multiqueue (netif))
+	    ADD_OPT ("--multiqueue");
+	}
     }
+  ifreg_put (snap);
 
 #undef ADD_ADDR_OPT
 
@@ -33,8 +33,18 @@
 #include <lwip/ip.h>
 #include <lwip/netif.h>
 
+#include <netif/hurdtunif.h>
+
 #define DEV_NAME_LEN    256
 
+/* A static route given by the user */
+struct parse_route
+{
+  ip_addr_t prefix;
+  uint8_t len;
+  ip_addr_t gateway;
+};
+
 /* Used to describe a particular interface during argument parsing.  */
 struct parse_interface
 {
@@ -46,6 +56,19 @@ struct parse_interface
 
   /* New IPv6 configuration to apply. */
   uint32_t addr6[LWIP_IPV6_NUM_ADDRESSES][4];
+
+  /* Output queue configuration, for tunnels. */
+  struct tunqueue_params queue;
+
+  /* Whether the tunnel exchanges length-prefixed packets. */
+  int framed;
+
+  /* Whether each reader of the tunnel gets its own queue. */
+  int multiqueue;
+
+  /* Static routes through this interface. */
+  struct parse_route *routes;
+  size_t num_routes;
 };
 
 /* Used to hold data during argument parsing.  */
@@ -58,11 +81,82 @@ struct parse_hook
   /* Interface to which options apply.  If the device field isn't filled in
      then it should be by the next --interface option.  */
   struct parse_interface *curint;
+
+  /* Size of the neighbour cache, 0 to keep the current one.  */
+  uint32_t neigh_size;
+
+  /* Maximum number of sockets, -1 to keep the current one.  */
+  int64_t max_sockets;
+
+  /* Memory for TCP buffers, -1 to keep the current limit.  */
+  int64_t tcp_mem;
+
+  /* Memory for the TCP buffers of a user, -1 to keep the current limit.  */
+  int64_t user_mem;
+
+  /* Where to serve the statistics, or NULL.  */
+  char *stats_path;
+
+  /* Where to serve the packet capture, or NULL.  */
+  char *capture_path;
+
+  /* Bytes to keep from each captured packet, 0 to keep the current value.  */
+  uint32_t snaplen;
+
+  /* Where to serve the TCP trace, or NULL.  */
+  char *tcp_trace_path;
+
+  /* Whether to record TCP events, -1 to keep recording or not.  */
+  int tcp_trace;
+
+  /* Where to serve the TCP connections, or NULL.  */
+  char *connections_path;
+};
+
+/* Keys for options without a short version */
+enum
+{
+  OPT_QUEUE_LEN = 256,
+  OPT_QUEUE_BYTES,
+  OPT_DROP_POLICY,
+  OPT_FRAMED,
+  OPT_MULTIQUEUE,
+  OPT_ROUTE,
+  OPT_NEIGH_CACHE,
+  OPT_MAX_SOCKETS,
+  OPT_TCP_MEM,
+  OPT_USER_MEM,
+  OPT_STATS,
+  OPT_CAPTURE,
+  OPT_SNAPLEN,
+  OPT_TCP_TRACE,
+  OPT_NO_TCP_TRACE,
+  OPT_CONNECTIONS,
 };
 
 /* Lwip translator options.  Used for both startup and runtime.  */
 static const struct argp_option options[] = {
   {"interface", 'i', "DEVICE", 0, "Network interface to use", 1},
+  {"neighbour-cache", OPT_NEIGH_CACHE, "ENTRIES", 0,
+   "Size of the ARP and IPv6 neighbour cache"},
+  {"max-sockets", OPT_MAX_SOCKETS, "NUMBER", 0,
+   "Maximum number of open sockets, 0 for no limit"},
+  {"tcp-mem", OPT_TCP_MEM, "BYTES", 0,
+   "Memory all the TCP buffers may take together, 0 for no limit"},
+  {"user-mem", OPT_USER_MEM, "BYTES", 0,
+   "Memory the TCP buffers of a user may take, 0 for no limit"},
+  {"stats", OPT_STATS, "FILE", 0,
+   "Serve a snapshot of the statistics on FILE"},
+  {"capture", OPT_CAPTURE, "FILE", 0,
+   "Serve a pcap-ng capture of the traffic on FILE"},
+  {"snaplen", OPT_SNAPLEN, "BYTES", 0,
+   "Keep at most BYTES of each captured packet"},
+  {"tcp-trace", OPT_TCP_TRACE, "FILE", 0,
+   "Record TCP connection events and serve them on FILE"},
+  {"no-tcp-trace", OPT_NO_TCP_TRACE, 0, 0,
+   "Stop recording TCP connection events"},
+  {"connections", OPT_CONNECTIONS, "FILE", 0,
+   "Serve the table of TCP connections on FILE"},
   {0, 0, 0, 0, "These apply to a given interface:", 2},
   {"address", 'a', "ADDRESS", OPTION_ARG_OPTIONAL, "Set the network address"},
   {"netmask", 'm', "MASK", OPTION_ARG_OPTIONAL, "Set the netmask"},
@@ -71,6 +165,19 @@ static const struct argp_option options[] = {
   {"ipv6", '6', "NAME", 0, "Put active IPv6 translator on NAME"},
   {"address6", 'A', "ADDR/LEN", OPTION_ARG_OPTIONAL,
    "Set the global IPv6 address"},
+  {"route", OPT_ROUTE, "PREFIX/LEN[,GATEWAY]", 0,
+   "Add a static route, IPv4 or IPv6. Only used if LwIP was built with "
+   "LWIP_HOOK_FILENAME=\"lwiphooks.h\""},
+  {"queue-length", OPT_QUEUE_LEN, "PACKETS", 0,
+   "Maximum number of packets in a tunnel queue"},
+  {"queue-bytes", OPT_QUEUE_BYTES, "BYTES", 0,
+   "Maximum number of bytes in a tunnel queue, 0 for no limit"},
+  {"drop-policy", OPT_DROP_POLICY, "POLICY", 0,
+   "What to drop when a tunnel queue is full: tail, head or codel"},
+  {"framed", OPT_FRAMED, 0, 0,
+   "Read and write several length-prefixed packets at once on a tunnel"},
+  {"multiqueue", OPT_MULTIQUEUE, 0, 0,
+   "Let several processes read a tunnel, spreading the flows among them"},
   {0}
 };
 
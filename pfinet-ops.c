@@ -29,6 +29,7 @@
 #include <sys/mman.h>
 
 #include <lwip-util.h>
+#include <ifreg.h>
 #include <netif/hurdethif.h>
 
 /*
@@ -41,15 +42,20 @@ static void
 dev_ifconf (struct ifconf *ifc)
 {
   struct netif *netif;
+  struct ifsnapshot *snap;
   struct ifreq *ifr;
   struct sockaddr_in *saddr;
   int len;
+  size_t i;
 
   ifr = ifc->ifc_req;
   len = ifc->ifc_len;
   saddr = (struct sockaddr_in *) &ifr->ifr_addr;
-  for (netif = netif_list; netif != 0; netif = netif->next)
+  snap = ifreg_get ();
+  for (i = 0; i < snap->num; i++)
     {
+      netif = snap->netifs[i];
+
       if (ifc->ifc_req != 0)
 	{
 	  /* Get the data */
@@ -69,6 +75,7 @@ dev_ifconf (struct ifconf *ifc)
       /* Update the needed buffer length */
       ifr++;
     }
+  ifreg_put (snap);
 
   ifc->ifc_len = (uintptr_t) ifr - (uintptr_t) ifc->ifc_req;
 }
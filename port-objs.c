@@ -22,6 +22,7 @@
 #include "lwip-hurd.h"
 
 #include <assert.h>
+#include <string.h>
 #include <refcount.h>
 
 #include <lwip/sockets.h>
@@ -51,10 +52,10 @@ make_sockaddr_port (int sock,
     return -err;
 
   err = ports_create_port (addrport_class, lwip_bucket,
-			   (offsetof (struct sock_addr, address)
-			    +buflen), &addrstruct);
+			   SOCK_ADDR_SIZE (buflen), &addrstruct);
   if (!err)
     {
+      objstats_alloc (&sock_addr_stats);
       addrstruct->address.sa.sa_family = buf.ss_family;
       addrstruct->address.sa.sa_len = buflen;
       memcpy (addrstruct->address.sa.sa_data,
@@ -69,14 +70,26 @@ make_sockaddr_port (int sock,
   return err;
 }
 
+/* Get a new socket, or NULL with errno set */
 struct socket *
 sock_alloc (void)
 {
   struct socket *sock;
+  unsigned int max = __atomic_load_n (&lwip_max_sockets, __ATOMIC_RELAXED);
 
-  sock = calloc (1, sizeof *sock);
+  if (max && objstats_live (&socket_cache.stats) >= max)
+    {
+      errno = ENFILE;
+      return 0;
+    }
+
+  sock = objcache_alloc (&socket_cache);
   if (!sock)
-    return 0;
+    {
+      errno = ENOMEM;
+      return 0;
+    }
+  memset (sock, 0, sizeof *sock);
   sock->sockno = -1;
   sock->identity = MACH_PORT_NULL;
   refcount_init (&sock->refcnt, 1);
@@ -93,12 +106,16 @@ sock_release (struct socket *sock)
     return;
 
   if (sock->sockno > -1)
-    lwip_close (sock->sockno);
+    {
+      /* Before the number can be given to another socket */
+      tcptune_forget (sock->sockno);
+      lwip_close (sock->sockno);
+    }
 
   if (sock->identity != MACH_PORT_NULL)
     mach_port_destroy (mach_task_self (), sock->identity);
 
-  free (sock);
+  objcache_free (&socket_cache, sock);
 }
 
 /* Create a sock_user structure, initialized from SOCK and ISROOT.
@@ -120,6 +137,8 @@ make_sock_user (struct socket *sock, int isroot, int noinstall, int consume)
   if (err)
     return 0;
 
+  objstats_alloc (&sock_user_stats);
+
   if (!consume)
     refcount_ref (&sock->refcnt);
 
@@ -135,10 +154,12 @@ clean_socketport (void *arg)
   struct sock_user *const user = arg;
 
   sock_release (user->sock);
+  objstats_free (&sock_user_stats);
 }
 
-/* Nothing need be done here. */
+/* Just count it. */
 void
 clean_addrport (void *arg)
 {
+  objstats_free (&sock_addr_stats);
 }
@@ -0,0 +1,71 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Hooks into the LwIP core.
+ *
+ * The library must be built with LWIP_HOOK_FILENAME set to "lwiphooks.h"
+ * and this directory in its include path. The hooks run in the tcpip
+ * thread. Define it in the lwipopts.h installed with the library, so the
+ * translator sees it too: without it, --route warns that the static
+ * routes won't be used.
+ *
+ * LwIP asks the IPv4 route hook only once the connected subnets and the
+ * loopback didn't match, and the next-hop hooks only for destinations off
+ * the link. The IPv6 route hook runs before the connected subnets are
+ * looked at, so it returns NULL for them and for the loopback itself.
+ */
+
+#ifndef LWIP_HOOKS_H
+#define LWIP_HOOKS_H
+
+struct netif *route_ip4_hook (const ip4_addr_t * dest);
+const ip4_addr_t *route_ip4_gw_hook (struct netif *netif,
+				     const ip4_addr_t * dest);
+struct netif *route_ip6_hook (const ip6_addr_t * src,
+			      const ip6_addr_t * dest);
+const ip6_addr_t *route_ip6_gw_hook (struct netif *netif,
+				     const ip6_addr_t * dest);
+
+#define LWIP_HOOK_IP4_ROUTE(dest)  route_ip4_hook (dest)
+#define LWIP_HOOK_ETHARP_GET_GW(netif, dest)  route_ip4_gw_hook (netif, dest)
+#define LWIP_HOOK_IP6_ROUTE(src, dest)  route_ip6_hook (src, dest)
+#define LWIP_HOOK_ND6_GET_GW(netif, dest)  route_ip6_gw_hook (netif, dest)
+
+/*
+ * TCP tracing looks at a connection whenever a segment comes in for it or
+ * goes out, if enabled. The output hook is where options may be added,
+ * it adds none.
+ */
+struct tcp_pcb;
+struct tcp_hdr;
+struct pbuf;
+
+extern int tcptrace_enabled;
+
+err_t tcptrace_input_hook (struct tcp_pcb *pcb);
+u32_t *tcptrace_output_hook (struct pbuf *p, struct tcp_hdr *hdr,
+			     struct tcp_pcb *pcb, u32_t * opts);
+
+#define LWIP_HOOK_TCP_INPACKET_PCB(pcb, hdr, optlen, opt1len, opt2, p) \
+  (tcptrace_enabled ? tcptrace_input_hook (pcb) : ERR_OK)
+#define LWIP_HOOK_TCP_OUT_ADD_TCPOPTS(p, hdr, pcb, opts) \
+  (tcptrace_enabled ? tcptrace_output_hook (p, hdr, pcb, opts) : (opts))
+
+#endif /* LWIP_HOOKS_H */
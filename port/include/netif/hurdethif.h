@@ -30,6 +30,9 @@
 
 typedef struct ifcommon hurdethif;
 
+/* Open the device before adding it to the stack */
+error_t hurdethif_device_probe (struct netif *netif);
+
 /* Device initialization */
 error_t hurdethif_device_init (struct netif *netif);
 
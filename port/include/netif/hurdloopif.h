@@ -30,6 +30,15 @@
 
 typedef struct ifcommon hurdloopif;
 
+/*
+ * Largest IP packet. The stack derives the MSS of each connection from
+ * the MTU of its interface, capped by TCP_MSS.
+ */
+#define LOOP_MTU      0xffff
+
+/* Smallest MTU IPv4 can work with */
+#define LOOP_MIN_MTU  68
+
 /* Device initialization */
 error_t hurdloopif_device_init (struct netif *netif);
 
@@ -24,16 +24,133 @@
 #define LWIP_HURDTUNIF_H
 
 #include <hurd/ports.h>
+#include <hurd/trivfs.h>
 
 #include <lwip/netif.h>
 #include <netif/ifcommon.h>
+#include <ring.h>
 
-/* Queue of data in the tunnel */
+/* What to do when the tunnel queue is full */
+enum tun_drop_policy
+{
+  TUN_DROP_TAIL,		/* Drop the incoming packet */
+  TUN_DROP_HEAD,		/* Drop the oldest packets */
+  TUN_DROP_CODEL,		/* Drop at dequeue time on persistent delay */
+};
+
+/* Default limits of the tunnel queue */
+#define TUN_QUEUE_DEFAULT_LEN     128
+#define TUN_QUEUE_DEFAULT_BYTES   0	/* No limit */
+#define TUN_QUEUE_DEFAULT_POLICY  TUN_DROP_HEAD
+
+/*
+ * Length of the header preceding each packet in framed mode. It holds the
+ * packet length in network byte order.
+ */
+#define TUN_FRAME_HLEN  2
+
+/* Maximum number of readers of a multi-queue tunnel */
+#define TUN_MAX_QUEUES  256
+
+/*
+ * Shared memory rings, returned by io_map on a tunnel.
+ *
+ * The area starts with a struct tunring_hdr. RX carries packets from the
+ * stack to the user and TX the other way. Each ring has NSLOTS slots of
+ * SLOT_SIZE bytes, at the given offsets from the start of the area.
+ *
+ * The producer fills slot HEAD % NSLOTS and its length, then advances
+ * HEAD. The consumer drains slot TAIL % NSLOTS, then advances TAIL.
+ * After advancing TX HEAD, the user kicks the translator with an empty
+ * io_write if TX TAIL was equal to the old HEAD, since the translator
+ * may be idle. To wait for RX packets, the user calls io_select.
+ *
+ * While the rings are mapped, io_read on the queue fails with EOPNOTSUPP.
+ * Only the open that mapped them first can map them, and they go away
+ * when it's closed.
+ */
+#define TUN_RING_MAGIC      0x74756e72
+#define TUN_RING_SLOTS      256
+#define TUN_RING_SLOT_SIZE  2048
+
+struct tunring
+{
+  uint32_t head __attribute__ ((aligned (64)));
+  uint32_t tail __attribute__ ((aligned (64)));
+  uint32_t len[TUN_RING_SLOTS];
+};
+
+struct tunring_hdr
+{
+  uint32_t magic;
+  uint32_t nslots;
+  uint32_t slot_size;
+  uint32_t rx_offset;
+  uint32_t tx_offset;
+
+  struct tunring rx;
+  struct tunring tx;
+};
+
+struct tunmap;
+
+/* CoDel parameters, in milliseconds */
+#define TUN_CODEL_TARGET    5
+#define TUN_CODEL_INTERVAL  100
+
+/* User given configuration of the queue. Zero means default. */
+struct tunqueue_params
+{
+  uint32_t max_len;
+  uint32_t max_bytes;
+  enum tun_drop_policy policy;
+};
+
+/* Queue counters, read and updated atomically */
+struct tunqueue_stats
+{
+  uint64_t enqueued;
+  uint64_t dequeued;
+  uint64_t tail_drops;
+  uint64_t head_drops;
+  uint64_t codel_drops;
+  uint32_t max_len;		/* High-water marks */
+  uint32_t max_bytes;
+};
+
+/*
+ * Queue of data in the tunnel.
+ *
+ * Packets may be chains of pbufs referenced from the stack, so the queue
+ * can't be linked through pbuf->next. The stack pushes packets without
+ * taking the tunnel lock, readers pop them holding it.
+ */
 struct pbufqueue
 {
-  struct pbuf *head;
-  struct pbuf **tail;
-  uint8_t len;
+  struct ring ring;		/* Packets, tagged with their enqueue time */
+  struct tunqueue_params params;
+  uint32_t bytes;		/* Bytes in the ring, updated atomically */
+  unsigned int waiters;		/* Readers waiting for packets */
+
+  /* Concurrent access by the readers */
+  pthread_mutex_t lock;
+  pthread_cond_t read;
+  pthread_cond_t select;
+
+  /* Popped but not delivered yet, protected by the lock */
+  struct pbuf *stash;
+
+  /* Shared memory rings replacing the queue, if mapped */
+  struct tunmap *map;
+
+  /* CoDel state, protected by the lock */
+  uint8_t dropping;
+  uint32_t count;
+  uint32_t lastcount;
+  uint32_t first_above_time;
+  uint32_t drop_next;
+
+  struct tunqueue_stats stats;
 };
 
 /* Extension of the common device interface to store tunnel metadata */
@@ -46,11 +163,21 @@ struct hurdtunif
   struct iouser *user;		/* Restrict the access to one user at a time */
   struct pbufqueue queue;	/* Output queue */
 
-  /* Concurrent access to the queue */
+  /*
+   * Queues of the readers in multi-queue mode. Only changed from the
+   * tcpip thread, so the stack can use them without locking.
+   */
+  struct pbufqueue **queues;
+  uint32_t nqueues;
+
+  /* Protects the configuration and the set of queues */
   pthread_mutex_t lock;
-  pthread_cond_t read;
-  pthread_cond_t select;
-  uint8_t read_blocked;
+
+  /* Several length-prefixed packets per read and write */
+  uint8_t framed;
+
+  /* Several readers, each one with its own queue */
+  uint8_t multiqueue;
 };
 
 struct port_class *tunnel_cntlclass;
@@ -62,4 +189,18 @@ error_t hurdtunif_device_init (struct netif *netif);
 /* Module initialization */
 error_t hurdtunif_module_init ();
 
+/* Queue configuration */
+error_t hurdtunif_set_queue_params (struct netif *netif,
+				    struct tunqueue_params *params);
+void hurdtunif_get_queue_params (struct netif *netif,
+				 struct tunqueue_params *params);
+void hurdtunif_set_framed (struct netif *netif, int framed);
+int hurdtunif_get_framed (struct netif *netif);
+void hurdtunif_set_multiqueue (struct netif *netif, int multiqueue);
+int hurdtunif_get_multiqueue (struct netif *netif);
+void hurdtunif_get_queue_stats (struct netif *netif,
+				struct tunqueue_stats *stats,
+				uint32_t * len, uint32_t * bytes);
+void hurdtunif_reset_queue_stats (struct netif *netif);
+
 #endif /* LWIP_HURDTUNIF_H */
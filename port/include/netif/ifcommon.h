@@ -28,6 +28,17 @@
 #include <device/device.h>
 
 #include <lwip/netif.h>
+#include <lwip/pbuf.h>
+
+#include <stats.h>
+
+/* Traffic counters, one shard each */
+struct ifstats
+{
+  uint64_t rx_packets, rx_bytes, rx_drops;
+  uint64_t tx_packets, tx_bytes, tx_drops;
+  char pad[STATS_LINE - 6 * sizeof (uint64_t)];
+};
 
 /*
  * Helper struct to hold private data used to operate your interface.
@@ -41,7 +52,14 @@ struct ifcommon
   char *devname;
   uint16_t flags;
 
+  struct ifstats stats[STATS_SHARDS];
+
+  /* Hardware address, filled by the probe callback */
+  uint8_t hwaddr[NETIF_MAX_HWADDR_LEN];
+  uint8_t hwaddr_len;
+
   /* Callbacks */
+    error_t (*probe) (struct netif * netif);
     error_t (*init) (struct netif * netif);
     error_t (*terminate) (struct netif * netif);
     error_t (*open) (struct netif * netif);
@@ -50,6 +68,24 @@ struct ifcommon
     error_t (*change_flags) (struct netif * netif, uint16_t flags);
 };
 
+/*
+ * Get a pbuf for incoming data, from the pool if possible. When the pool
+ * is empty it's taken from the heap instead, and counted in
+ * if_pool_fallbacks.
+ */
+struct pbuf *if_alloc_pbuf (pbuf_layer layer, uint16_t len);
+extern uint64_t if_pool_fallbacks;
+
+/* Count traffic of NETIF */
+#define IF_COUNT(netif, field, n) \
+  STATS_ADD (netif_get_state (netif)->stats, field, n)
+
+/* Add up the counters of NETIF */
+void if_get_stats (struct netif *netif, struct ifstats *stats);
+
+/* Set the counters of NETIF back to 0 */
+void if_reset_stats (struct netif *netif);
+
 error_t if_init (struct netif *netif);
 error_t if_terminate (struct netif *netif);
 error_t if_change_flags (struct netif *netif, uint16_t flags);
@@ -0,0 +1,68 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Neighbour cache for Ethernet devices */
+
+#ifndef LWIP_NEIGHCACHE_H
+#define LWIP_NEIGHCACHE_H
+
+#include <stdint.h>
+#include <errno.h>
+
+#include <lwip/netif.h>
+#include <lwip/pbuf.h>
+#include <lwip/ip_addr.h>
+
+/* Default number of entries */
+#define NEIGH_DEFAULT_SIZE  512
+
+/* Time since the last confirmation an entry is used without probing */
+#define NEIGH_REACHABLE_MS  30000
+
+/* Time an IPv4 entry is still used while being probed */
+#define NEIGH_PROBE_MS      5000
+
+struct neighcache_stats
+{
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t expirations;
+};
+
+/* Output callbacks, resolving through the cache first */
+err_t neighcache_output (struct netif *netif, struct pbuf *p,
+			 const ip4_addr_t * ipaddr);
+err_t neighcache_output_ip6 (struct netif *netif, struct pbuf *p,
+			     const ip6_addr_t * ip6addr);
+
+/* Input callback, learns from ARP and neighbour advertisements */
+err_t neighcache_input (struct pbuf *p, struct netif *netif);
+
+/* Drop the entries of NETIF */
+void neighcache_flush (struct netif *netif);
+
+/* Resize the cache, dropping all the entries */
+error_t neighcache_set_size (uint32_t size);
+uint32_t neighcache_get_size (void);
+
+void neighcache_get_stats (struct neighcache_stats *stats);
+void neighcache_reset_stats (void);
+
+#endif /* LWIP_NEIGHCACHE_H */
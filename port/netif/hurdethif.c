@@ -43,6 +43,11 @@
 #include <lwip/snmp.h>
 #include <lwip/ethip6.h>
 #include <lwip/etharp.h>
+#include <lwip/tcpip.h>
+#include <netif/neighcache.h>
+
+#include <ifreg.h>
+#include <capture.h>
 
 /* Get the MAC address from an array of int */
 #define GET_HWADDR_BYTE(x,n)  (((char*)x)[n])
@@ -232,6 +237,24 @@ hurdethif_device_open (struct netif *netif)
 	}
     }
 
+  if (err)
+    {
+      /* Release what we got */
+      if (ethif->ether_port != MACH_PORT_NULL)
+	{
+	  device_close (ethif->ether_port);
+	  mach_port_deallocate (mach_task_self (), ethif->ether_port);
+	  ethif->ether_port = MACH_PORT_NULL;
+	}
+      if (ethif->readpt)
+	{
+	  mach_port_deallocate (mach_task_self (), ethif->readptname);
+	  ethif->readptname = MACH_PORT_NULL;
+	  ports_destroy_right (ethif->readpt);
+	  ethif->readpt = NULL;
+	}
+    }
+
   return err;
 }
 
@@ -269,9 +292,16 @@ hurdethif_output (struct netif *netif, struct pbuf *p)
   int count;
   uint8_t tried;
 
+  IF_COUNT (netif, tx_packets, 1);
+  IF_COUNT (netif, tx_bytes, p->tot_len);
+  capture_packet (netif, p, CAPTURE_OUT);
+
   if (p->tot_len != p->len)
-    /* Drop the packet */
-    return ERR_OK;
+    {
+      /* Drop the packet */
+      IF_COUNT (netif, tx_drops, 1);
+      return ERR_OK;
+    }
 
   tried = 0;
   /* Send the data from the pbuf to the interface, one pbuf at a
@@ -301,6 +331,9 @@ hurdethif_output (struct netif *netif, struct pbuf *p)
     }
   while (err);
 
+  if (err)
+    IF_COUNT (netif, tx_drops, 1);
+
   return ERR_OK;
 }
 
@@ -319,8 +352,11 @@ hurdethif_input (struct netif *netif, struct net_rcv_msg *msg)
   len = PBUF_LINK_HLEN
     + msg->packet_type.msgt_number - sizeof (struct packet_header);
 
+  IF_COUNT (netif, rx_packets, 1);
+  IF_COUNT (netif, rx_bytes, len);
+
   /* Allocate an empty pbuf chain for the data */
-  p = pbuf_alloc (PBUF_RAW, len, PBUF_POOL);
+  p = if_alloc_pbuf (PBUF_RAW, len);
 
   if (p)
     {
@@ -362,14 +398,22 @@ hurdethif_input (struct netif *netif, struct net_rcv_msg *msg)
 	}
       while (1);
 
-      /* Pass the pbuf chain to he input function */
-      if (netif->input (p, netif) != ERR_OK)
+      capture_packet (netif, p, CAPTURE_IN);
+
+      /*
+       * Pass the pbuf chain to the stack. The neighbour cache sees it
+       * first, from the tcpip thread.
+       */
+      if (tcpip_inpkt (p, netif, neighcache_input) != ERR_OK)
 	{
 	  LWIP_DEBUGF (NETIF_DEBUG, ("hurdethif_input: IP input error\n"));
+	  IF_COUNT (netif, rx_drops, 1);
 	  pbuf_free (p);
 	  p = NULL;
 	}
     }
+  else
+    IF_COUNT (netif, rx_drops, 1);
 }
 
 /* Demux incoming RPCs from the device */
@@ -378,6 +422,7 @@ hurdethif_demuxer (mach_msg_header_t * inp, mach_msg_header_t * outp)
 {
   struct net_rcv_msg *msg = (struct net_rcv_msg *) inp;
   struct netif *netif;
+  struct ifsnapshot *snap;
   mach_port_t local_port;
 
   if (inp->msgh_id != NET_RCV_MSG_ID)
@@ -400,18 +445,19 @@ hurdethif_demuxer (mach_msg_header_t * inp, mach_msg_header_t * outp)
   else
     local_port = inp->msgh_local_port;
 
-  for (netif = netif_list; netif; netif = netif->next)
-    if (local_port == netif_get_state (netif)->readptname)
-      break;
+  snap = ifreg_get ();
+  netif = ifreg_netif (snap, ifreg_lookup_port (snap, local_port));
 
   if (!netif)
     {
+      ifreg_put (snap);
       if (inp->msgh_remote_port != MACH_PORT_NULL)
 	mach_port_deallocate (mach_task_self (), inp->msgh_remote_port);
       return 1;
     }
 
   hurdethif_input (netif, msg);
+  ifreg_put (snap);
 
   return 1;
 }
@@ -439,6 +485,8 @@ hurdethif_device_update_mtu (struct netif *netif, uint32_t mtu)
 static error_t
 hurdethif_device_terminate (struct netif *netif)
 {
+  neighcache_flush (netif);
+
   /* Free the hook */
   free (netif_get_state (netif)->devname);
   free (netif_get_state (netif));
@@ -446,6 +494,60 @@ hurdethif_device_terminate (struct netif *netif)
   return 0;
 }
 
+/*
+ * Open the device and get its configuration. It only talks to the
+ * device, so it may run for several devices at once and without the
+ * stack, before adding the interface.
+ *
+ * On failure nothing is left open. On success the close callback is set,
+ * for the caller to close the device if the interface isn't added.
+ */
+error_t
+hurdethif_device_probe (struct netif *netif)
+{
+  error_t err;
+  size_t count = 2;
+  int net_address[2];
+  hurdethif *ethif = netif_get_state (netif);
+
+  err = hurdethif_device_open (netif);
+  if (err)
+    return err;
+  ethif->close = hurdethif_device_close;
+
+  /* Get the MAC address */
+  err = device_get_status (ethif->ether_port, NET_ADDRESS, net_address,
+			   &count);
+  if (err)
+    error (0, err, "%s: Cannot get hardware Ethernet address",
+	   ethif->devname);
+  else if (count * sizeof (int) >= ETHARP_HWADDR_LEN)
+    {
+      net_address[0] = ntohl (net_address[0]);
+      net_address[1] = ntohl (net_address[1]);
+
+      /* Set MAC hardware address length */
+      ethif->hwaddr_len = ETHARP_HWADDR_LEN;
+
+      /* Set MAC hardware address */
+      ethif->hwaddr[0] = GET_HWADDR_BYTE (net_address, 0);
+      ethif->hwaddr[1] = GET_HWADDR_BYTE (net_address, 1);
+      ethif->hwaddr[2] = GET_HWADDR_BYTE (net_address, 2);
+      ethif->hwaddr[3] = GET_HWADDR_BYTE (net_address, 3);
+      ethif->hwaddr[4] = GET_HWADDR_BYTE (net_address, 4);
+      ethif->hwaddr[5] = GET_HWADDR_BYTE (net_address, 5);
+    }
+  else
+    error (0, 0, "%s: Invalid Ethernet address", ethif->devname);
+
+  /* Enable Ethernet multicasting */
+  hurdethif_device_get_flags (netif, &ethif->flags);
+  ethif->flags |= IFF_UP | IFF_RUNNING | IFF_BROADCAST | IFF_ALLMULTI;
+  hurdethif_device_set_flags (netif, ethif->flags);
+
+  return 0;
+}
+
 /*
  * Initializes a single device.
  * 
@@ -455,9 +557,6 @@ error_t
 hurdethif_device_init (struct netif * netif)
 {
   error_t err;
-  size_t count = 2;
-  int net_address[2];
-  device_t ether_port;
   hurdethif *ethif;
 
   /*
@@ -477,8 +576,8 @@ hurdethif_device_init (struct netif * netif)
   ethif->type = ARPHRD_ETHER;
 
   /* Set callbacks */
-  netif->output = etharp_output;
-  netif->output_ip6 = ethip6_output;
+  netif->output = neighcache_output;
+  netif->output_ip6 = neighcache_output_ip6;
   netif->linkoutput = hurdethif_output;
 
   ethif->open = hurdethif_device_open;
@@ -490,45 +589,19 @@ hurdethif_device_init (struct netif * netif)
   /* ---- Hardware initialization ---- */
 
   /* We need the device to be opened to configure it */
-  err = hurdethif_device_open (netif);
-  if (err)
-    return err;
-
-  /* Get the MAC address */
-  ether_port = netif_get_state (netif)->ether_port;
-  err = device_get_status (ether_port, NET_ADDRESS, net_address, &count);
-  if (err)
-    error (0, err, "%s: Cannot get hardware Ethernet address",
-	   netif_get_state (netif)->devname);
-  else if (count * sizeof (int) >= ETHARP_HWADDR_LEN)
+  if (ethif->ether_port == MACH_PORT_NULL)
     {
-      net_address[0] = ntohl (net_address[0]);
-      net_address[1] = ntohl (net_address[1]);
-
-      /* Set MAC hardware address length */
-      netif->hwaddr_len = ETHARP_HWADDR_LEN;
-
-      /* Set MAC hardware address */
-      netif->hwaddr[0] = GET_HWADDR_BYTE (net_address, 0);
-      netif->hwaddr[1] = GET_HWADDR_BYTE (net_address, 1);
-      netif->hwaddr[2] = GET_HWADDR_BYTE (net_address, 2);
-      netif->hwaddr[3] = GET_HWADDR_BYTE (net_address, 3);
-      netif->hwaddr[4] = GET_HWADDR_BYTE (net_address, 4);
-      netif->hwaddr[5] = GET_HWADDR_BYTE (net_address, 5);
+      err = hurdethif_device_probe (netif);
+      if (err)
+	return err;
     }
-  else
-    error (0, 0, "%s: Invalid Ethernet address",
-	   netif_get_state (netif)->devname);
+
+  netif->hwaddr_len = ethif->hwaddr_len;
+  memcpy (netif->hwaddr, ethif->hwaddr, ethif->hwaddr_len);
 
   /* Maximum transfer unit: MSS + IP header size + TCP header size */
   netif->mtu = TCP_MSS + 20 + 20;
 
-  /* Enable Ethernet multicasting */
-  hurdethif_device_get_flags (netif, &netif_get_state (netif)->flags);
-  netif_get_state (netif)->flags |=
-    IFF_UP | IFF_RUNNING | IFF_BROADCAST | IFF_ALLMULTI;
-  hurdethif_device_set_flags (netif, netif_get_state (netif)->flags);
-
   /*
    * Up the link, set the interface type to NETIF_FLAG_ETHARP
    * and enable other features.
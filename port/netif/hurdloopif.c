@@ -28,6 +28,44 @@
 
 #include <lwip-util.h>
 
+/* LwIP's own output callbacks */
+#if LWIP_IPV4
+static netif_output_fn loop_output;
+#endif
+#if LWIP_IPV6
+static netif_output_ip6_fn loop_output_ip6;
+#endif
+
+/* Everything sent is received back, count it both ways */
+static void
+count_packet (struct netif *netif, struct pbuf *p)
+{
+  IF_COUNT (netif, tx_packets, 1);
+  IF_COUNT (netif, tx_bytes, p->tot_len);
+  IF_COUNT (netif, rx_packets, 1);
+  IF_COUNT (netif, rx_bytes, p->tot_len);
+}
+
+#if LWIP_IPV4
+static err_t
+hurdloopif_output (struct netif *netif, struct pbuf *p,
+		   const ip4_addr_t * ipaddr)
+{
+  count_packet (netif, p);
+  return loop_output (netif, p, ipaddr);
+}
+#endif
+
+#if LWIP_IPV6
+static err_t
+hurdloopif_output_ip6 (struct netif *netif, struct pbuf *p,
+		       const ip6_addr_t * ipaddr)
+{
+  count_packet (netif, p);
+  return loop_output_ip6 (netif, p, ipaddr);
+}
+#endif
+
 /* Set the device flags */
 static error_t
 hurdloopif_device_set_flags (struct netif *netif, uint16_t flags)
@@ -49,6 +87,9 @@ hurdloopif_device_update_mtu (struct netif *netif, uint32_t mtu)
 {
   error_t err = 0;
 
+  if (mtu < LOOP_MIN_MTU || mtu > LOOP_MTU)
+    return EINVAL;
+
   netif->mtu = mtu;
 
   return err;
@@ -95,12 +136,33 @@ hurdloopif_device_init (struct netif * netif)
   loopif->devname = LOOP_DEV_NAME;
   loopif->type = ARPHRD_LOOPBACK;
 
-  /* MTU = MSS + IP header + TCP header */
-  netif->mtu = TCP_MSS + 20 + 20;
+  /* Local transfers don't need Ethernet-sized segments */
+  netif->mtu = LOOP_MTU;
+
+#if LWIP_CHECKSUM_CTRL_PER_NETIF
+  /* Packets never leave the host, so they can't be corrupted */
+  NETIF_SET_CHECKSUM_CTRL (netif, NETIF_CHECKSUM_DISABLE_ALL);
+#endif
 
   /* Set flags */
   hurdloopif_device_set_flags (netif, IFF_UP | IFF_RUNNING | IFF_LOOPBACK);
 
+  /* Count the traffic on the way */
+#if LWIP_IPV4
+  if (netif->output != hurdloopif_output)
+    {
+      loop_output = netif->output;
+      netif->output = hurdloopif_output;
+    }
+#endif
+#if LWIP_IPV6
+  if (netif->output_ip6 != hurdloopif_output_ip6)
+    {
+      loop_output_ip6 = netif->output_ip6;
+      netif->output_ip6 = hurdloopif_output_ip6;
+    }
+#endif
+
   /* Set callbacks */
   loopif->open = 0;
   loopif->close = 0;
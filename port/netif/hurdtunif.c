@@ -27,38 +27,599 @@
 #include <net/if_arp.h>
 #include <error.h>
 #include <sys/mman.h>
+#include <hurd.h>
+#include <hurd/paths.h>
+
+#include "default_pager_U.h"
+
+#include <refcount.h>
+
+#include <lwip/sys.h>
+#include <lwip/stats.h>
+#include <lwip/snmp.h>
+#include <lwip/priv/tcpip_priv.h>
+#include <lwip/prot/ip.h>
 
 #include <lwip-hurd.h>
+#include <trivfs-ops.h>
+#include <capture.h>
+
+/* Whether the payload of a pbuf may change after the stack releases it */
+#ifndef PBUF_NEEDS_COPY
+#define PBUF_NEEDS_COPY(p)  ((p)->type == PBUF_REF || (p)->type == PBUF_ROM)
+#endif
+
+/*
+ * Reference the pages of large writes instead of copying them. Packets
+ * referencing external memory can't grow a link header, so this is only
+ * safe while the stack doesn't forward them.
+ */
+#if LWIP_SUPPORT_CUSTOM_PBUF && !IP_FORWARD && !LWIP_IPV6_FORWARD
+#define TUN_ZEROCOPY  1
+#else
+#define TUN_ZEROCOPY  0
+#endif
+
+/* Smallest write worth referencing instead of copying */
+#define TUN_ZEROCOPY_MIN  (2 * vm_page_size)
+
+/* Our copy of the pages of a write, shared by the packets in it */
+struct tunpages
+{
+  vm_address_t addr;
+  vm_size_t size;
+  refcount_t refs;
+};
+
+#if TUN_ZEROCOPY
+/* A packet referencing a write */
+struct tunpbuf
+{
+  struct pbuf_custom pc;
+  struct tunpages *pages;
+};
+#endif
+
+/* The shared memory rings of a queue */
+struct tunmap
+{
+  memory_object_t memobj;
+  struct tunring_hdr *hdr;
+  vm_size_t size;
+  char *rx_slots;
+  char *tx_slots;
+
+  /* Our own copies, the user may overwrite the shared ones */
+  uint32_t rx_head;
+  uint32_t tx_tail;
+
+  struct trivfs_peropen *owner;	/* Who mapped it */
+  pthread_mutex_t tx_lock;	/* Serializes the draining of TX */
+
+  /* The queue holds one, and each writer draining TX another */
+  refcount_t refs;
+};
+
+/* The default pager provides the memory of the rings */
+static mach_port_t default_pager = MACH_PORT_NULL;
+static pthread_mutex_t default_pager_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Whether time A is after or equal to time B */
+#define TIME_AFTER_EQ(a, b)  ((int32_t) ((a) - (b)) >= 0)
+
+/* Integer square root, for the CoDel control law */
+static uint32_t
+isqrt (uint32_t n)
+{
+  uint32_t x = n, y = (n + 1) / 2;
+
+  while (y < x)
+    {
+      x = y;
+      y = (x + n / x) / 2;
+    }
+
+  return x;
+}
+
+/* Number of packets in the queue */
+static uint32_t
+queue_len (struct pbufqueue *q)
+{
+  return ring_count (&q->ring) + (q->stash ? 1 : 0);
+}
+
+/* Number of bytes in the queue */
+static uint32_t
+queue_bytes (struct pbufqueue *q)
+{
+  return __atomic_load_n (&q->bytes, __ATOMIC_RELAXED)
+    + (q->stash ? q->stash->tot_len : 0);
+}
+
+/* Whether the queue can't take another packet of SIZE bytes */
+static int
+queue_full (struct pbufqueue *q, uint32_t size)
+{
+  return ring_count (&q->ring) >= q->params.max_len
+    || (q->params.max_bytes
+	&& __atomic_load_n (&q->bytes, __ATOMIC_RELAXED) + size >
+	q->params.max_bytes);
+}
+
+/*
+ * The stack, the device writers and the readers all update the queue
+ * counters, and they don't share a lock.
+ */
+static void
+stat_inc (uint64_t * counter)
+{
+  __atomic_fetch_add (counter, 1, __ATOMIC_RELAXED);
+}
 
-/* Add to the end of the queue */
+static uint64_t
+stat_get (uint64_t * counter)
+{
+  return __atomic_load_n (counter, __ATOMIC_RELAXED);
+}
+
+/* Raise the high-water mark MARK to VALUE */
 static void
+stat_max (uint32_t * mark, uint32_t value)
+{
+  uint32_t old = __atomic_load_n (mark, __ATOMIC_RELAXED);
+
+  while (value > old
+	 && !__atomic_compare_exchange_n (mark, &old, value, 1,
+					  __ATOMIC_RELAXED,
+					  __ATOMIC_RELAXED));
+}
+
+/* Add to the end of the queue. Returns 0 if there's no room */
+static int
 enqueue (struct pbufqueue *q, struct pbuf *p)
 {
-  *(q->tail) = p;
-  p->next = 0;
-  q->tail = &p->next;
+  uint32_t len, bytes;
+
+  if (!ring_push (&q->ring, p, sys_now ()))
+    return 0;
+
+  bytes = __atomic_add_fetch (&q->bytes, p->tot_len, __ATOMIC_RELAXED);
+  len = ring_count (&q->ring);
 
-  q->len++;
+  stat_inc (&q->stats.enqueued);
+  stat_max (&q->stats.max_len, len);
+  stat_max (&q->stats.max_bytes, bytes);
+
+  return 1;
 }
 
-/* Get from the head of the queue */
+/* Get from the head of the queue, and its enqueue time in TIME */
 static struct pbuf *
-dequeue (struct pbufqueue *q)
+dequeue (struct pbufqueue *q, uint32_t * time)
 {
   struct pbuf *ret;
 
-  if (!q->head)
+  ret = ring_pop (&q->ring, time);
+  if (ret)
+    __atomic_sub_fetch (&q->bytes, ret->tot_len, __ATOMIC_RELAXED);
+
+  return ret;
+}
+
+/* Keep a packet just popped to be the next one delivered */
+static void
+unpop (struct pbufqueue *q, struct pbuf *p)
+{
+  q->stash = p;
+}
+
+/*
+ * Dequeue a packet and tell whether CoDel considers its sojourn time
+ * too long, as in RFC 8289.
+ */
+static struct pbuf *
+codel_dequeue (struct pbufqueue *q, struct netif *netif, uint32_t now,
+	       int *ok_to_drop)
+{
+  struct pbuf *p;
+  uint32_t time;
+
+  *ok_to_drop = 0;
+
+  p = dequeue (q, &time);
+  if (!p)
+    {
+      q->first_above_time = 0;
+      return 0;
+    }
+
+  if (now - time < TUN_CODEL_TARGET
+      || __atomic_load_n (&q->bytes, __ATOMIC_RELAXED) <= netif->mtu)
+    /* Went below target, stay below for at least an interval */
+    q->first_above_time = 0;
+  else if (q->first_above_time == 0)
+    q->first_above_time = now + TUN_CODEL_INTERVAL;
+  else if (TIME_AFTER_EQ (now, q->first_above_time))
+    *ok_to_drop = 1;
+
+  return p;
+}
+
+/* Next drop time, following the CoDel control law */
+static uint32_t
+codel_control_law (uint32_t t, uint32_t count)
+{
+  return t + TUN_CODEL_INTERVAL / isqrt (count);
+}
+
+/* Account a dropped packet in COUNTER */
+static void
+count_drop (struct netif *netif, uint64_t * counter)
+{
+  stat_inc (counter);
+  IF_COUNT (netif, tx_drops, 1);
+  LINK_STATS_INC (link.drop);
+  MIB2_STATS_NETIF_INC (netif, ifoutdiscards);
+}
+
+/* Drop a packet, accounting it in COUNTER */
+static void
+drop_packet (struct netif *netif, struct pbuf *p, uint64_t * counter)
+{
+  count_drop (netif, counter);
+  pbuf_free (p);
+}
+
+/*
+ * Get the next packet to deliver to the user, applying the drop policy.
+ *
+ * Readers call it with the tunnel lock held.
+ */
+static struct pbuf *
+queue_pop (struct pbufqueue *q, struct netif *netif)
+{
+  struct pbuf *p;
+  uint32_t now, delta;
+  int ok_to_drop;
+
+  if (q->stash)
+    {
+      p = q->stash;
+      q->stash = 0;
+      return p;
+    }
+
+  if (q->params.policy != TUN_DROP_CODEL)
+    return dequeue (q, 0);
+
+  now = sys_now ();
+  p = codel_dequeue (q, netif, now, &ok_to_drop);
+
+  if (q->dropping)
+    {
+      if (!ok_to_drop)
+	/* Sojourn time below target, leave the dropping state */
+	q->dropping = 0;
+
+      while (p && q->dropping && TIME_AFTER_EQ (now, q->drop_next))
+	{
+	  drop_packet (netif, p, &q->stats.codel_drops);
+	  q->count++;
+	  p = codel_dequeue (q, netif, now, &ok_to_drop);
+	  if (!ok_to_drop)
+	    q->dropping = 0;
+	  else
+	    q->drop_next = codel_control_law (q->drop_next, q->count);
+	}
+    }
+  else if (p && ok_to_drop)
+    {
+      drop_packet (netif, p, &q->stats.codel_drops);
+      p = codel_dequeue (q, netif, now, &ok_to_drop);
+      q->dropping = 1;
+
+      /* Start from the last drop rate if we dropped recently */
+      delta = q->count - q->lastcount;
+      if (delta > 1
+	  && !TIME_AFTER_EQ (now - q->drop_next,
+			     16 * TUN_CODEL_INTERVAL))
+	q->count = delta;
+      else
+	q->count = 1;
+      q->lastcount = q->count;
+      q->drop_next = codel_control_law (now, q->count);
+    }
+
+  return p;
+}
+
+/* Whether there are packets for the user in the rings */
+static int
+map_pending (struct tunmap *map)
+{
+  return map->rx_head != __atomic_load_n (&map->hdr->rx.tail,
+					  __ATOMIC_ACQUIRE);
+}
+
+/* Copy the packet P to the RX ring. Returns 0 if there's no room */
+static int
+map_push (struct tunmap *map, struct pbuf *p)
+{
+  struct tunring *rx = &map->hdr->rx;
+  uint32_t slot;
+
+  if (p->tot_len > TUN_RING_SLOT_SIZE
+      || map->rx_head - __atomic_load_n (&rx->tail, __ATOMIC_ACQUIRE) >=
+      TUN_RING_SLOTS)
     return 0;
 
-  ret = q->head;
-  q->head = q->head->next;
-  ret->next = 0;
-  q->len--;
+  slot = map->rx_head % TUN_RING_SLOTS;
+  pbuf_copy_partial (p, map->rx_slots + slot * TUN_RING_SLOT_SIZE,
+		     p->tot_len, 0);
+  rx->len[slot] = p->tot_len;
 
-  if (!q->head)
-    q->tail = &q->head;
+  map->rx_head++;
+  __atomic_store_n (&rx->head, map->rx_head, __ATOMIC_RELEASE);
 
-  return ret;
+  return 1;
+}
+
+/* Unmap the rings and release their memory */
+static void
+map_destroy (struct tunmap *map)
+{
+  vm_deallocate (mach_task_self (), (vm_address_t) map->hdr, map->size);
+  mach_port_deallocate (mach_task_self (), map->memobj);
+  pthread_mutex_destroy (&map->tx_lock);
+  free (map);
+}
+
+/* Drop a reference to MAP, destroying it with the last one */
+static void
+map_release (struct tunmap *map)
+{
+  if (refcount_deref (&map->refs) == 0)
+    map_destroy (map);
+}
+
+/* Whether there's something for the readers of the queue */
+static int
+queue_has_data (struct pbufqueue *q)
+{
+  return q->stash || ring_ready (&q->ring)
+    || (q->map && map_pending (q->map));
+}
+
+/* Wake up the readers waiting for the queue, if any */
+static void
+queue_wake (struct pbufqueue *q)
+{
+  /*
+   * Readers announce themselves in WAITERS before checking the queue a
+   * last time, so either they see the packet or we see them.
+   */
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&q->waiters, __ATOMIC_RELAXED))
+    {
+      pthread_mutex_lock (&q->lock);
+      pthread_cond_broadcast (&q->read);
+      pthread_cond_broadcast (&q->select);
+      pthread_mutex_unlock (&q->lock);
+    }
+}
+
+/*
+ * Add a packet to the queue, applying the drop policy.
+ *
+ * Only called from the stack, so there's a single producer. It never
+ * takes the tunnel lock unless some reader is waiting.
+ *
+ * Returns 0 if the packet was dropped.
+ */
+static int
+queue_push (struct pbufqueue *q, struct netif *netif, struct pbuf *p)
+{
+  struct pbuf *oldest;
+
+  if (q->params.policy == TUN_DROP_HEAD)
+    while (queue_full (q, p->tot_len) && (oldest = dequeue (q, 0)) != 0)
+      drop_packet (netif, oldest, &q->stats.head_drops);
+
+  /* Also the last resort for CoDel, which drops at dequeue time */
+  if (queue_full (q, p->tot_len) || !enqueue (q, p))
+    {
+      drop_packet (netif, p, &q->stats.tail_drops);
+      return 0;
+    }
+
+  queue_wake (q);
+
+  return 1;
+}
+
+/*
+ * Wait for the queue to have data, or for COND to be signaled with TSP as
+ * timeout. Called with the queue lock held.
+ */
+static error_t
+queue_wait (struct pbufqueue *q, pthread_cond_t * cond, struct timespec *tsp)
+{
+  error_t err = 0;
+
+  __atomic_add_fetch (&q->waiters, 1, __ATOMIC_SEQ_CST);
+  if (!queue_has_data (q))
+    err = pthread_hurd_cond_timedwait_np (cond, &q->lock, tsp);
+  __atomic_sub_fetch (&q->waiters, 1, __ATOMIC_SEQ_CST);
+
+  return err;
+}
+
+/*
+ * Apply new limits to the queue, moving the packets to a ring of the
+ * new size. Packets that don't fit anymore are dropped from the head.
+ *
+ * Neither the stack nor the readers may be using the queue.
+ */
+static error_t
+queue_configure (struct pbufqueue *q, struct netif *netif,
+		 struct tunqueue_params *params)
+{
+  error_t err;
+  struct ring ring;
+  struct pbuf *p;
+  uint32_t max_len, time;
+
+  max_len = params->max_len ? params->max_len : TUN_QUEUE_DEFAULT_LEN;
+
+  err = ring_init (&ring, max_len);
+  if (err)
+    return err;
+
+  if (q->ring.cells)
+    {
+      while (ring_count (&q->ring) > max_len)
+	{
+	  p = dequeue (q, 0);
+	  drop_packet (netif, p, &q->stats.head_drops);
+	}
+
+      while ((p = ring_pop (&q->ring, &time)) != 0)
+	ring_push (&ring, p, time);
+
+      ring_destroy (&q->ring);
+    }
+
+  q->ring = ring;
+  q->params.max_len = max_len;
+  q->params.max_bytes = params->max_bytes;
+  q->params.policy = params->policy;
+
+  return 0;
+}
+
+/* Set up an empty queue */
+static error_t
+queue_init (struct pbufqueue *q, struct netif *netif,
+	    struct tunqueue_params *params)
+{
+  error_t err;
+
+  memset (q, 0, sizeof (struct pbufqueue));
+  err = queue_configure (q, netif, params);
+  if (err)
+    return err;
+
+  pthread_mutex_init (&q->lock, NULL);
+  pthread_cond_init (&q->read, NULL);
+  pthread_cond_init (&q->select, NULL);
+
+  return 0;
+}
+
+/* Free the packets and resources of a queue nobody is using anymore */
+static void
+queue_destroy (struct pbufqueue *q, struct netif *netif)
+{
+  struct pbuf *p;
+
+  while ((p = queue_pop (q, netif)) != 0)
+    pbuf_free (p);
+  ring_destroy (&q->ring);
+  if (q->map)
+    map_release (q->map);
+  pthread_cond_destroy (&q->read);
+  pthread_cond_destroy (&q->select);
+  pthread_mutex_destroy (&q->lock);
+}
+
+/* Mix the N bytes at DATA into HASH, FNV-1a style */
+static uint32_t
+hash_bytes (uint32_t hash, const uint8_t * data, size_t n)
+{
+  while (n--)
+    hash = (hash ^ *data++) * 16777619;
+
+  return hash;
+}
+
+/*
+ * Hash of the addresses, protocol and ports of the packet P, so all
+ * packets of a flow go to the same reader.
+ */
+static uint32_t
+flow_hash (struct pbuf *p)
+{
+  const uint8_t *h = p->payload;
+  uint32_t hash = 2166136261;
+  uint16_t hlen;
+  uint8_t proto;
+  int ports;
+
+  if (p->len < 1)
+    return 0;
+
+  switch (h[0] >> 4)
+    {
+    case 4:
+      if (p->len < 20)
+	return 0;
+      hlen = (h[0] & 0x0f) * 4;
+      proto = h[9];
+      hash = hash_bytes (hash, h + 12, 8);
+      /* Fragments have no ports, or only the first one */
+      ports = !(h[6] & 0x3f) && !h[7];
+      break;
+    case 6:
+      if (p->len < 40)
+	return 0;
+      hlen = 40;
+      proto = h[6];
+      hash = hash_bytes (hash, h + 8, 32);
+      ports = 1;
+      break;
+    default:
+      return 0;
+    }
+
+  hash = hash_bytes (hash, &proto, 1);
+  if ((proto == IP_PROTO_TCP || proto == IP_PROTO_UDP)
+      && ports && p->len >= hlen + 4)
+    hash = hash_bytes (hash, h + hlen, 4);
+
+  return hash;
+}
+
+/*
+ * Keep the packet P alive after the stack releases it.
+ *
+ * Take a new reference on the chain when possible, only copy it when some
+ * pbuf points to memory the stack may reuse.
+ */
+static struct pbuf *
+hold_pbuf (struct pbuf *p)
+{
+  struct pbuf *q, *pcopy;
+
+  for (q = p; q != 0; q = q->next)
+    if (PBUF_NEEDS_COPY (q))
+      break;
+
+  if (q == 0)
+    {
+      pbuf_ref (p);
+      return p;
+    }
+
+  pcopy = pbuf_alloc (PBUF_IP, p->tot_len, PBUF_RAM);
+  if (pcopy != NULL)
+    if (pbuf_copy (pcopy, p) != ERR_OK)
+      {
+	pbuf_free (pcopy);
+	pcopy = NULL;
+      }
+
+  return pcopy;
 }
 
 /*
@@ -95,14 +656,11 @@ hurdtunif_device_set_flags (struct netif *netif, uint16_t flags)
 static error_t
 hurdtunif_device_terminate (struct netif *netif)
 {
-  struct pbuf *p;
   struct hurdtunif *tunif = (struct hurdtunif *) netif_get_state (netif);
 
   /* Clear the queue */
-  while ((p = dequeue (&tunif->queue)) != 0)
-    pbuf_free (p);
-  pthread_cond_destroy (&tunif->read);
-  pthread_cond_destroy (&tunif->select);
+  queue_destroy (&tunif->queue, netif);
+  free (tunif->queues);
   pthread_mutex_destroy (&tunif->lock);
 
   /* Free the hook */
@@ -123,43 +681,50 @@ hurdtunif_output (struct netif *netif, struct pbuf *p,
 {
   error_t err = 0;
   struct hurdtunif *tunif;
-  struct pbuf *pcopy, *oldest;
+  struct pbufqueue *q;
+  struct pbuf *pheld;
 
   tunif = (struct hurdtunif *) netif_get_state (netif);
 
-  /*
-   * The stack is responsible for allocating and freeing the pbuf p.
-   * Sometimes it keeps the pbuf for the case it needs to be retransmitted,
-   * but at other times it frees the pbuf while it's still in our queue,
-   * that's why we need a copy.
-   */
-  pcopy = pbuf_alloc (PBUF_IP, p->tot_len, PBUF_RAM);
-  if (pcopy != NULL)
-    if (pbuf_copy (pcopy, p) != ERR_OK)
-      {
-	pbuf_free (pcopy);
-	pcopy = NULL;
-      }
+  IF_COUNT (netif, tx_packets, 1);
+  IF_COUNT (netif, tx_bytes, p->tot_len);
+  capture_packet (netif, p, CAPTURE_OUT);
 
-  pthread_mutex_lock (&tunif->lock);
+  /* Spread the flows among the readers, if several */
+  if (tunif->nqueues > 0)
+    q = tunif->queues[flow_hash (p) % tunif->nqueues];
+  else
+    q = &tunif->queue;
 
-  /* Avoid unlimited growth. */
-  if (tunif->queue.len > 128)
+  if (q->map)
     {
-      oldest = dequeue (&tunif->queue);
-      pbuf_free (oldest);
-    }
-
-  enqueue (&tunif->queue, pcopy);
+      /* Copy it to the shared ring right away */
+      if (map_push (q->map, p))
+	{
+	  stat_inc (&q->stats.enqueued);
+	  queue_wake (q);
+	}
+      else
+	count_drop (netif, &q->stats.tail_drops);
 
-  if (tunif->read_blocked)
-    {
-      tunif->read_blocked = 0;
-      pthread_cond_broadcast (&tunif->read);
-      pthread_cond_broadcast (&tunif->select);
+      return err;
     }
 
-  pthread_mutex_unlock (&tunif->lock);
+  /*
+   * The stack is responsible for allocating and freeing the pbuf p.
+   * Sometimes it keeps the pbuf for the case it needs to be retransmitted,
+   * but at other times it frees the pbuf while it's still in our queue,
+   * that's why we need our own reference.
+   */
+  pheld = hold_pbuf (p);
+  if (pheld == NULL)
+    {
+      LWIP_DEBUGF (NETIF_DEBUG, ("hurdtunif_output: out of memory\n"));
+      IF_COUNT (netif, tx_drops, 1);
+      return ERR_MEM;
+    }
+
+  queue_push (q, netif, pheld);
 
   return err;
 }
@@ -172,6 +737,7 @@ hurdtunif_device_init (struct netif * netif)
 {
   error_t err = 0;
   struct hurdtunif *tunif;
+  struct tunqueue_params qparams;
   char *base_name, *name = netif_get_state (netif)->devname;
 
   /*
@@ -212,315 +778,1065 @@ hurdtunif_device_init (struct netif * netif)
 			      IFF_UP | IFF_RUNNING | IFF_POINTOPOINT |
 			      IFF_NOARP);
 
-  netif->flags = NETIF_FLAG_LINK_UP;
+  netif->flags = NETIF_FLAG_LINK_UP;
+
+  /* Set the callbacks */
+  netif->output = hurdtunif_output;
+  tunif->comm.open = 0;
+  tunif->comm.close = 0;
+  tunif->comm.terminate = hurdtunif_device_terminate;
+  tunif->comm.update_mtu = hurdtunif_device_update_mtu;
+  tunif->comm.change_flags = hurdtunif_device_set_flags;
+
+  /* Output queue initialization */
+  qparams.max_len = TUN_QUEUE_DEFAULT_LEN;
+  qparams.max_bytes = TUN_QUEUE_DEFAULT_BYTES;
+  qparams.policy = TUN_QUEUE_DEFAULT_POLICY;
+  if (queue_init (&tunif->queue, netif, &qparams))
+    return ERR_MEM;
+  tunif->queues = 0;
+  tunif->nqueues = 0;
+  pthread_mutex_init (&tunif->lock, NULL);
+
+  /* Bind the translator to tunif->comm.devname */
+  tunif->underlying = file_name_lookup (tunif->comm.devname,
+					O_CREAT | O_NOTRANS, 0664);
+
+  if (tunif->underlying == MACH_PORT_NULL)
+    {
+      error (0, 0, "%s", tunif->comm.devname);
+      return -1;
+    }
+
+  err = trivfs_create_control (tunif->underlying, tunnel_cntlclass,
+			       lwip_bucket, tunnel_class, lwip_bucket,
+			       &tunif->cntl);
+
+  if (!err)
+    {
+      mach_port_t right;
+
+      /*
+       * We'll need to get the netif from trivfs operations, which may
+       * come as soon as the translator is set
+       */
+      tunif->cntl->hook = netif;
+
+      right = ports_get_send_right (tunif->cntl);
+      err = file_set_translator (tunif->underlying, 0,
+				 FS_TRANS_SET | FS_TRANS_ORPHAN, 0, 0, 0,
+				 right, MACH_MSG_TYPE_COPY_SEND);
+      mach_port_deallocate (mach_task_self (), right);
+    }
+
+  if (err)
+    error (0, err, "%s", tunif->comm.devname);
+
+  return err;
+}
+
+struct queue_config_msg
+{
+  struct tcpip_api_call_data call;
+  struct netif *netif;
+  struct tunqueue_params *params;
+  struct pbufqueue *queue;
+  struct tunmap *map;
+  error_t err;
+};
+
+/* Reconfigure the queue Q, excluding its readers */
+static error_t
+configure_locked (struct pbufqueue *q, struct netif *netif,
+		  struct tunqueue_params *params)
+{
+  error_t err;
+
+  pthread_mutex_lock (&q->lock);
+  err = queue_configure (q, netif, params);
+  pthread_mutex_unlock (&q->lock);
+
+  return err;
+}
+
+/* Resize the queues from the tcpip thread, so the stack isn't pushing */
+static err_t
+do_configure_queue (struct tcpip_api_call_data *call)
+{
+  struct queue_config_msg *msg = (struct queue_config_msg *) call;
+  struct hurdtunif *tunif =
+    (struct hurdtunif *) netif_get_state (msg->netif);
+  uint32_t i;
+
+  pthread_mutex_lock (&tunif->lock);
+  msg->err = configure_locked (&tunif->queue, msg->netif, msg->params);
+  for (i = 0; i < tunif->nqueues && !msg->err; i++)
+    msg->err = configure_locked (tunif->queues[i], msg->netif, msg->params);
+  pthread_mutex_unlock (&tunif->lock);
+
+  return ERR_OK;
+}
+
+/*
+ * Add a reader queue to the tunnel. The first one takes the packets
+ * queued while nobody was attached.
+ *
+ * Adding or removing queues moves some flows to another reader, so a
+ * few of their packets may be delivered out of order.
+ */
+static err_t
+do_attach_queue (struct tcpip_api_call_data *call)
+{
+  struct queue_config_msg *msg = (struct queue_config_msg *) call;
+  struct hurdtunif *tunif =
+    (struct hurdtunif *) netif_get_state (msg->netif);
+  struct pbufqueue **queues;
+  struct pbuf *p;
+
+  pthread_mutex_lock (&tunif->lock);
+
+  if (tunif->nqueues >= TUN_MAX_QUEUES)
+    {
+      msg->err = EBUSY;
+      goto out;
+    }
+
+  queues = realloc (tunif->queues,
+		    (tunif->nqueues + 1) * sizeof (struct pbufqueue *));
+  if (!queues)
+    {
+      msg->err = ENOMEM;
+      goto out;
+    }
+
+  if (tunif->nqueues == 0)
+    {
+      pthread_mutex_lock (&tunif->queue.lock);
+      while ((p = queue_pop (&tunif->queue, msg->netif)) != 0)
+	if (!enqueue (msg->queue, p))
+	  drop_packet (msg->netif, p, &msg->queue->stats.tail_drops);
+      pthread_mutex_unlock (&tunif->queue.lock);
+    }
+
+  queues[tunif->nqueues++] = msg->queue;
+  tunif->queues = queues;
+  msg->err = 0;
+
+out:
+  pthread_mutex_unlock (&tunif->lock);
+
+  return ERR_OK;
+}
+
+/* Remove a reader queue from the tunnel */
+static err_t
+do_detach_queue (struct tcpip_api_call_data *call)
+{
+  struct queue_config_msg *msg = (struct queue_config_msg *) call;
+  struct hurdtunif *tunif =
+    (struct hurdtunif *) netif_get_state (msg->netif);
+  uint32_t i;
+
+  pthread_mutex_lock (&tunif->lock);
+  for (i = 0; i < tunif->nqueues; i++)
+    if (tunif->queues[i] == msg->queue)
+      {
+	tunif->queues[i] = tunif->queues[--tunif->nqueues];
+	break;
+      }
+  pthread_mutex_unlock (&tunif->lock);
+
+  return ERR_OK;
+}
+
+/* Set the limits and drop policy of the tunnel queue */
+error_t
+hurdtunif_set_queue_params (struct netif *netif,
+			    struct tunqueue_params *params)
+{
+  struct queue_config_msg msg;
+
+  msg.netif = netif;
+  msg.params = params;
+  msg.err = 0;
+  tcpip_api_call (do_configure_queue, &msg.call);
+
+  return msg.err;
+}
+
+/* Get the current limits and drop policy of the tunnel queue */
+void
+hurdtunif_get_queue_params (struct netif *netif,
+			    struct tunqueue_params *params)
+{
+  struct hurdtunif *tunif = (struct hurdtunif *) netif_get_state (netif);
+
+  pthread_mutex_lock (&tunif->lock);
+  *params = tunif->queue.params;
+  pthread_mutex_unlock (&tunif->lock);
+}
+
+/* Enable or disable the framed mode of the tunnel */
+void
+hurdtunif_set_framed (struct netif *netif, int framed)
+{
+  struct hurdtunif *tunif = (struct hurdtunif *) netif_get_state (netif);
+
+  pthread_mutex_lock (&tunif->lock);
+  tunif->framed = framed;
+  pthread_mutex_unlock (&tunif->lock);
+}
+
+/* Whether the tunnel is in framed mode */
+int
+hurdtunif_get_framed (struct netif *netif)
+{
+  struct hurdtunif *tunif = (struct hurdtunif *) netif_get_state (netif);
+
+  return tunif->framed;
+}
+
+/*
+ * Let several readers open the tunnel, each one with its own queue.
+ *
+ * It only affects new openers.
+ */
+void
+hurdtunif_set_multiqueue (struct netif *netif, int multiqueue)
+{
+  struct hurdtunif *tunif = (struct hurdtunif *) netif_get_state (netif);
+
+  pthread_mutex_lock (&tunif->lock);
+  tunif->multiqueue = multiqueue;
+  pthread_mutex_unlock (&tunif->lock);
+}
+
+/* Whether the tunnel is in multi-queue mode */
+int
+hurdtunif_get_multiqueue (struct netif *netif)
+{
+  struct hurdtunif *tunif = (struct hurdtunif *) netif_get_state (netif);
+
+  return tunif->multiqueue;
+}
+
+/* Add the counters and occupancy of Q to the totals */
+static void
+sum_queue_stats (struct pbufqueue *q, struct tunqueue_stats *stats,
+		 uint32_t * len, uint32_t * bytes)
+{
+  uint32_t max_len, max_bytes;
+
+  pthread_mutex_lock (&q->lock);
+
+  stats->enqueued += stat_get (&q->stats.enqueued);
+  stats->dequeued += stat_get (&q->stats.dequeued);
+  stats->tail_drops += stat_get (&q->stats.tail_drops);
+  stats->head_drops += stat_get (&q->stats.head_drops);
+  stats->codel_drops += stat_get (&q->stats.codel_drops);
+  max_len = __atomic_load_n (&q->stats.max_len, __ATOMIC_RELAXED);
+  if (max_len > stats->max_len)
+    stats->max_len = max_len;
+  max_bytes = __atomic_load_n (&q->stats.max_bytes, __ATOMIC_RELAXED);
+  if (max_bytes > stats->max_bytes)
+    stats->max_bytes = max_bytes;
+  *len += queue_len (q);
+  *bytes += queue_bytes (q);
+
+  pthread_mutex_unlock (&q->lock);
+}
+
+/* Get the counters and current occupancy of the tunnel queues */
+void
+hurdtunif_get_queue_stats (struct netif *netif,
+			   struct tunqueue_stats *stats,
+			   uint32_t * len, uint32_t * bytes)
+{
+  struct hurdtunif *tunif = (struct hurdtunif *) netif_get_state (netif);
+  struct tunqueue_stats total;
+  uint32_t i, total_len = 0, total_bytes = 0;
+
+  memset (&total, 0, sizeof (total));
+
+  pthread_mutex_lock (&tunif->lock);
+  sum_queue_stats (&tunif->queue, &total, &total_len, &total_bytes);
+  for (i = 0; i < tunif->nqueues; i++)
+    sum_queue_stats (tunif->queues[i], &total, &total_len, &total_bytes);
+  pthread_mutex_unlock (&tunif->lock);
+
+  if (stats)
+    *stats = total;
+  if (len)
+    *len = total_len;
+  if (bytes)
+    *bytes = total_bytes;
+}
+
+/* Set the counters of Q back to 0, and its high-water marks to what's
+   queued now */
+static void
+reset_queue_stats (struct pbufqueue *q)
+{
+  pthread_mutex_lock (&q->lock);
+
+  __atomic_store_n (&q->stats.enqueued, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&q->stats.dequeued, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&q->stats.tail_drops, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&q->stats.head_drops, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&q->stats.codel_drops, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&q->stats.max_len, queue_len (q), __ATOMIC_RELAXED);
+  __atomic_store_n (&q->stats.max_bytes, queue_bytes (q), __ATOMIC_RELAXED);
+
+  pthread_mutex_unlock (&q->lock);
+}
+
+/* Reset the counters of the tunnel queues */
+void
+hurdtunif_reset_queue_stats (struct netif *netif)
+{
+  struct hurdtunif *tunif = (struct hurdtunif *) netif_get_state (netif);
+  uint32_t i;
+
+  pthread_mutex_lock (&tunif->lock);
+  reset_queue_stats (&tunif->queue);
+  for (i = 0; i < tunif->nqueues; i++)
+    reset_queue_stats (tunif->queues[i]);
+  pthread_mutex_unlock (&tunif->lock);
+}
+
+/* The size of a tunnel node is the amount of queued data */
+static void
+tunnel_modify_stat (struct trivfs_protid *cred, io_statbuf_t * st)
+{
+  struct netif *netif;
+  uint32_t bytes;
+
+  netif = (struct netif *) cred->po->cntl->hook;
+  hurdtunif_get_queue_stats (netif, 0, 0, &bytes);
+  st->st_size = bytes;
+  st->st_blksize = netif->mtu;
+}
+
+/* Get a port to the default pager, to allocate the rings */
+static error_t
+get_default_pager (mach_port_t * pager)
+{
+  error_t err = 0;
+  mach_port_t host;
+
+  pthread_mutex_lock (&default_pager_lock);
+
+  if (default_pager == MACH_PORT_NULL)
+    {
+      err = get_privileged_ports (&host, 0);
+      if (err == EPERM)
+	{
+	  /* We are not root, so try opening the /servers file.  */
+	  default_pager = file_name_lookup (_SERVERS_DEFPAGER, O_EXEC, 0);
+	  err = default_pager == MACH_PORT_NULL ? errno : 0;
+	}
+      else if (!err)
+	{
+	  err = vm_set_default_memory_manager (host, &default_pager);
+	  mach_port_deallocate (mach_task_self (), host);
+	}
+    }
+
+  *pager = default_pager;
+
+  pthread_mutex_unlock (&default_pager_lock);
+
+  return err;
+}
+
+/* Allocate a memory object for the rings and map it */
+static error_t
+map_create (struct tunmap **mapp)
+{
+  error_t err;
+  mach_port_t pager;
+  vm_address_t addr = 0;
+  vm_size_t hdrsize;
+  struct tunmap *map;
+
+  err = get_default_pager (&pager);
+  if (err)
+    return err;
+
+  map = calloc (1, sizeof (struct tunmap));
+  if (!map)
+    return ENOMEM;
+
+  hdrsize = round_page (sizeof (struct tunring_hdr));
+  map->size = hdrsize + 2 * TUN_RING_SLOTS * TUN_RING_SLOT_SIZE;
+
+  err = default_pager_object_create (pager, &map->memobj, map->size);
+  if (err)
+    {
+      free (map);
+      return err;
+    }
+
+  err = vm_map (mach_task_self (), &addr, map->size, 0, 1, map->memobj, 0, 0,
+		VM_PROT_READ | VM_PROT_WRITE, VM_PROT_READ | VM_PROT_WRITE,
+		VM_INHERIT_NONE);
+  if (err)
+    {
+      mach_port_deallocate (mach_task_self (), map->memobj);
+      free (map);
+      return err;
+    }
+
+  /* The new memory is zero filled */
+  map->hdr = (struct tunring_hdr *) addr;
+  map->hdr->magic = TUN_RING_MAGIC;
+  map->hdr->nslots = TUN_RING_SLOTS;
+  map->hdr->slot_size = TUN_RING_SLOT_SIZE;
+  map->hdr->rx_offset = hdrsize;
+  map->hdr->tx_offset = hdrsize + TUN_RING_SLOTS * TUN_RING_SLOT_SIZE;
+  map->rx_slots = (char *) addr + map->hdr->rx_offset;
+  map->tx_slots = (char *) addr + map->hdr->tx_offset;
+  pthread_mutex_init (&map->tx_lock, NULL);
+  refcount_init (&map->refs, 1);
+
+  *mapp = map;
+
+  return 0;
+}
+
+/*
+ * Switch a queue to the shared rings, moving the packets already queued
+ * to them. From now on the stack copies its packets to the RX ring.
+ */
+static err_t
+do_install_map (struct tcpip_api_call_data *call)
+{
+  struct queue_config_msg *msg = (struct queue_config_msg *) call;
+  struct pbufqueue *q = msg->queue;
+  struct pbuf *p;
+
+  pthread_mutex_lock (&q->lock);
+
+  if (q->map)
+    /* Someone else was faster */
+    msg->err = EEXIST;
+  else
+    {
+      while ((p = queue_pop (q, msg->netif)) != 0)
+	{
+	  if (!map_push (msg->map, p))
+	    count_drop (msg->netif, &q->stats.tail_drops);
+	  pbuf_free (p);
+	}
+      q->map = msg->map;
+      msg->err = 0;
+    }
+
+  pthread_mutex_unlock (&q->lock);
+
+  return ERR_OK;
+}
+
+/* Switch a queue back from the shared rings */
+static err_t
+do_remove_map (struct tcpip_api_call_data *call)
+{
+  struct queue_config_msg *msg = (struct queue_config_msg *) call;
+
+  pthread_mutex_lock (&msg->queue->lock);
+  msg->queue->map = 0;
+  pthread_mutex_unlock (&msg->queue->lock);
+
+  return ERR_OK;
+}
+
+/* If a new open with read and/or write permissions is requested,
+   restrict to exclusive usage.  */
+static error_t
+tunnel_check_open (struct trivfs_control *cntl, struct iouser *user,
+		   int flags)
+{
+  struct hurdtunif *tunif;
+
+  tunif = (struct hurdtunif *) netif_get_state ((struct netif *) cntl->hook);
+
+  if (flags != O_NORW && !tunif->multiqueue)
+    {
+      if (tunif->user)
+	return EBUSY;
+      else
+	tunif->user = user;
+    }
+
+  return 0;
+}
+
+/* When a protid is destroyed, check if it is the current user.
+   If yes, release the interface for other users.  */
+static void
+tunnel_protid_destroy (struct trivfs_protid *cred)
+{
+  struct netif *netif;
+  struct hurdtunif *tunif;
+
+  netif = (struct netif *) cred->po->cntl->hook;
+  tunif = (struct hurdtunif *) netif_get_state (netif);
+
+  if (tunif->user == cred->user)
+    tunif->user = 0;
+}
+
+/* Give each reader of a multi-queue tunnel its own queue. Everyone else
+   uses the main one.  */
+static error_t
+tunnel_po_create (struct trivfs_peropen *po)
+{
+  error_t err;
+  struct netif *netif;
+  struct hurdtunif *tunif;
+  struct tunqueue_params params;
+  struct queue_config_msg msg;
+  struct pbufqueue *q;
+
+  netif = (struct netif *) po->cntl->hook;
+  tunif = (struct hurdtunif *) netif_get_state (netif);
+  po->hook = &tunif->queue;
+
+  if (!tunif->multiqueue || !(po->openmodes & O_READ))
+    return 0;
+
+  q = malloc (sizeof (struct pbufqueue));
+  if (!q)
+    return ENOMEM;
+
+  hurdtunif_get_queue_params (netif, &params);
+  err = queue_init (q, netif, &params);
+  if (err)
+    {
+      free (q);
+      return err;
+    }
+
+  msg.netif = netif;
+  msg.queue = q;
+  msg.err = 0;
+  tcpip_api_call (do_attach_queue, &msg.call);
+  if (msg.err)
+    {
+      queue_destroy (q, netif);
+      free (q);
+      return msg.err;
+    }
+
+  po->hook = q;
+
+  return 0;
+}
+
+/* Release the queue of a reader, dropping its pending packets, or the
+   rings it mapped on the main queue */
+static void
+tunnel_po_destroy (struct trivfs_peropen *po)
+{
+  struct netif *netif;
+  struct hurdtunif *tunif;
+  struct queue_config_msg msg;
+  struct pbufqueue *q;
+
+  netif = (struct netif *) po->cntl->hook;
+  tunif = (struct hurdtunif *) netif_get_state (netif);
+  q = (struct pbufqueue *) po->hook;
+
+  if (!q)
+    return;
+
+  msg.netif = netif;
+  msg.queue = q;
+
+  if (q == &tunif->queue)
+    {
+      /*
+       * The main queue outlives its users, but not their rings. Writers
+       * draining TX may still be using them, the last one frees them.
+       */
+      if (q->map && q->map->owner == po)
+	{
+	  msg.map = q->map;
+	  tcpip_api_call (do_remove_map, &msg.call);
+	  map_release (msg.map);
+	}
+      return;
+    }
+
+  tcpip_api_call (do_detach_queue, &msg.call);
+
+  queue_destroy (q, netif);
+  free (q);
+}
+
+/* Return the single packet P to the user, truncated to AMOUNT bytes */
+static error_t
+read_packet (struct pbufqueue *q, struct pbuf *p,
+	     char **data, mach_msg_type_number_t * data_len, size_t amount)
+{
+  stat_inc (&q->stats.dequeued);
+
+  if (p->tot_len < amount)
+    amount = p->tot_len;
+  if (amount > 0)
+    {
+      /* Possibly allocate a new buffer. */
+      if (*data_len < amount)
+	{
+	  *data = mmap (0, amount, PROT_READ | PROT_WRITE, MAP_ANON, 0, 0);
+	  if (*data == MAP_FAILED)
+	    {
+	      pbuf_free (p);
+	      return ENOMEM;
+	    }
+	}
+
+      /* Copy the constant data into the buffer. The packet may be a chain. */
+      pbuf_copy_partial (p, *data, amount, 0);
+    }
+  *data_len = amount;
+  pbuf_free (p);
+
+  return 0;
+}
+
+/*
+ * Return to the user as many queued packets as fit in AMOUNT bytes,
+ * starting with P, each one preceded by its length.
+ *
+ * The first packet is truncated if it doesn't fit alone.
+ */
+static error_t
+read_frames (struct pbufqueue *q, struct netif *netif, struct pbuf *p,
+	     char **data, mach_msg_type_number_t * data_len, size_t amount)
+{
+  size_t off, len;
+  char *buf;
+  int alloced = 0;
+
+  if (*data_len < amount)
+    {
+      buf = mmap (0, amount, PROT_READ | PROT_WRITE, MAP_ANON, 0, 0);
+      if (buf == MAP_FAILED)
+	{
+	  unpop (q, p);
+	  return ENOMEM;
+	}
+      alloced = 1;
+    }
+  else
+    buf = *data;
+
+  off = 0;
+  do
+    {
+      len = p->tot_len;
+      if (off + TUN_FRAME_HLEN + len > amount)
+	{
+	  if (off > 0)
+	    {
+	      /* Leave it for the next read */
+	      unpop (q, p);
+	      break;
+	    }
+	  len = amount - TUN_FRAME_HLEN;
+	}
+
+      buf[off] = len >> 8;
+      buf[off + 1] = len & 0xff;
+      pbuf_copy_partial (p, buf + off + TUN_FRAME_HLEN, len, 0);
+      off += TUN_FRAME_HLEN + len;
+
+      stat_inc (&q->stats.dequeued);
+      pbuf_free (p);
+    }
+  while (off + TUN_FRAME_HLEN < amount
+	 && (p = queue_pop (q, netif)) != 0);
+
+  if (alloced && round_page (off) < round_page (amount))
+    munmap (buf + round_page (off), round_page (amount) - round_page (off));
+
+  *data = buf;
+  *data_len = off;
 
-  /* Set the callbacks */
-  netif->output = hurdtunif_output;
-  tunif->comm.open = 0;
-  tunif->comm.close = 0;
-  tunif->comm.terminate = hurdtunif_device_terminate;
-  tunif->comm.update_mtu = hurdtunif_device_update_mtu;
-  tunif->comm.change_flags = hurdtunif_device_set_flags;
+  return 0;
+}
 
-  /* Bind the translator to tunif->comm.devname */
-  tunif->underlying = file_name_lookup (tunif->comm.devname,
-					O_CREAT | O_NOTRANS, 0664);
+/* Pass the packet P to the stack */
+static void
+input_packet (struct netif *netif, struct pbuf *p)
+{
+  IF_COUNT (netif, rx_packets, 1);
+  IF_COUNT (netif, rx_bytes, p->tot_len);
+  capture_packet (netif, p, CAPTURE_IN);
 
-  if (tunif->underlying == MACH_PORT_NULL)
+  if (netif->input (p, netif) != ERR_OK)
     {
-      error (0, 0, "%s", tunif->comm.devname);
-      return -1;
+      LWIP_DEBUGF (NETIF_DEBUG, ("trivfs_S_io_write: IP input error\n"));
+      IF_COUNT (netif, rx_drops, 1);
+      pbuf_free (p);
     }
+}
 
-  err = trivfs_create_control (tunif->underlying, tunnel_cntlclass,
-			       lwip_bucket, tunnel_class, lwip_bucket,
-			       &tunif->cntl);
+/* Copy a packet written by the user into a pool chain for the stack */
+static void
+write_packet (struct netif *netif, char *data, size_t len)
+{
+  struct pbuf *p;
 
-  if (!err)
+  /* Leave room for a link header, in case the packet is forwarded */
+  p = if_alloc_pbuf (PBUF_LINK, len);
+  if (!p)
     {
-      mach_port_t right = ports_get_send_right (tunif->cntl);
-      err = file_set_translator (tunif->underlying, 0,
-				 FS_TRANS_SET | FS_TRANS_ORPHAN, 0, 0, 0,
-				 right, MACH_MSG_TYPE_COPY_SEND);
-      mach_port_deallocate (mach_task_self (), right);
+      IF_COUNT (netif, rx_drops, 1);
+      LINK_STATS_INC (link.memerr);
+      return;
     }
 
-  if (err)
-    error (0, err, "%s", tunif->comm.devname);
+  /* Fill the whole chain */
+  pbuf_take (p, data, len);
 
-  /* We'll need to get the netif from trivfs operations */
-  tunif->cntl->hook = netif;
+  input_packet (netif, p);
+}
 
-  /* Output queue initialization */
-  tunif->queue.head = 0;
-  tunif->queue.tail = &tunif->queue.head;
-  tunif->queue.len = 0;
-  pthread_mutex_init (&tunif->lock, NULL);
-  pthread_cond_init (&tunif->read, NULL);
-  pthread_cond_init (&tunif->select, NULL);
-  tunif->read_blocked = 0;
+#if TUN_ZEROCOPY
+/* Release a reference to a region of written pages */
+static void
+release_pages (struct tunpages *pages)
+{
+  if (refcount_deref (&pages->refs) == 0)
+    {
+      vm_deallocate (mach_task_self (), pages->addr, pages->size);
+      free (pages);
+    }
+}
 
-  return err;
+/* Called by the stack when it's done with a packet */
+static void
+tun_pbuf_free (struct pbuf *p)
+{
+  struct tunpbuf *tp = (struct tunpbuf *) p;
+
+  release_pages (tp->pages);
+  free (tp);
 }
 
 /*
- * Set libports classes
- *
- * This function should be called once.
+ * Get a copy-on-write copy of the pages holding the DATALEN bytes at DATA.
+ * Returns in *COPY where DATA lies in the copy.
  */
-error_t
-hurdtunif_module_init ()
+static struct tunpages *
+map_pages (char *data, size_t datalen, char **copy)
 {
-  error_t err = 0;
+  error_t err;
+  struct tunpages *pages;
+  vm_address_t start;
 
-  trivfs_add_control_port_class (&tunnel_cntlclass);
-  trivfs_add_protid_port_class (&tunnel_class);
+  pages = malloc (sizeof (struct tunpages));
+  if (!pages)
+    return 0;
 
-  return err;
+  start = trunc_page ((vm_address_t) data);
+  pages->size = round_page ((vm_address_t) data + datalen) - start;
+  pages->addr = 0;
+  err = vm_allocate (mach_task_self (), &pages->addr, pages->size, 1);
+  if (!err)
+    {
+      err = vm_copy (mach_task_self (), start, pages->size, pages->addr);
+      if (err)
+	vm_deallocate (mach_task_self (), pages->addr, pages->size);
+    }
+  if (err)
+    {
+      free (pages);
+      return 0;
+    }
+
+  refcount_init (&pages->refs, 1);
+  *copy = (char *) pages->addr + ((vm_address_t) data - start);
+
+  return pages;
 }
 
-/* If a new open with read and/or write permissions is requested,
-   restrict to exclusive usage.  */
-static error_t
-check_open_hook (struct trivfs_control *cntl, struct iouser *user, int flags)
+/* Pass to the stack a packet referencing the written pages */
+static void
+write_packet_pages (struct netif *netif, struct tunpages *pages,
+		    char *data, size_t len)
 {
-  struct netif *netif;
-  struct hurdtunif *tunif;
+  struct tunpbuf *tp;
+  struct pbuf *p;
 
-  for (netif = netif_list; netif; netif = netif->next)
+  tp = malloc (sizeof (struct tunpbuf));
+  if (!tp)
     {
-      tunif = (struct hurdtunif *) netif_get_state (netif);
-      if (tunif->cntl == cntl)
-	break;
+      write_packet (netif, data, len);
+      return;
     }
 
-  if (netif && flags != O_NORW)
+  tp->pc.custom_free_function = tun_pbuf_free;
+  tp->pages = pages;
+  refcount_ref (&pages->refs);
+
+  p = pbuf_alloced_custom (PBUF_RAW, len, PBUF_REF, &tp->pc, data, len);
+
+  input_packet (netif, p);
+}
+#endif
+
+/* Pass a packet to the stack, referencing PAGES if given */
+static void
+write_one (struct netif *netif, struct tunpages *pages, char *data,
+	   size_t len)
+{
+#if TUN_ZEROCOPY
+  if (pages)
+    write_packet_pages (netif, pages, data, len);
+  else
+#endif
+    write_packet (netif, data, len);
+}
+
+/* Length of the frame starting at DATA */
+static inline size_t
+frame_len (char *data)
+{
+  return ((uint8_t) data[0] << 8) | (uint8_t) data[1];
+}
+
+/*
+ * Pass to the stack the packets in a write: one packet, or several
+ * length-prefixed ones in framed mode.
+ *
+ * Large writes come out-of-line, so their pages can be referenced by the
+ * packets instead of copied.
+ */
+static error_t
+write_data (struct netif *netif, int framed, char *data, size_t datalen,
+	    mach_msg_type_number_t * amount)
+{
+  size_t off, len;
+  struct tunpages *pages = 0;
+
+  /* Check the whole buffer before injecting anything */
+  if (!framed)
     {
-      if (tunif->user)
-	return EBUSY;
-      else
-	tunif->user = user;
+      if (datalen > 0xffff)
+	return EMSGSIZE;
     }
+  else
+    for (off = 0; off < datalen; off += TUN_FRAME_HLEN + len)
+      {
+	if (off + TUN_FRAME_HLEN > datalen)
+	  return EINVAL;
+	len = frame_len (data + off);
+	if (len == 0 || off + TUN_FRAME_HLEN + len > datalen)
+	  return EINVAL;
+      }
+
+#if TUN_ZEROCOPY
+  if (datalen >= TUN_ZEROCOPY_MIN)
+    pages = map_pages (data, datalen, &data);
+#endif
+
+  if (!framed)
+    write_one (netif, pages, data, datalen);
+  else
+    for (off = 0; off < datalen; off += TUN_FRAME_HLEN + len)
+      {
+	len = frame_len (data + off);
+	write_one (netif, pages, data + off + TUN_FRAME_HLEN, len);
+      }
+
+#if TUN_ZEROCOPY
+  if (pages)
+    release_pages (pages);
+#endif
+
+  *amount = datalen;
 
   return 0;
 }
 
-/* When a protid is destroyed, check if it is the current user.
-   If yes, release the interface for other users.  */
+/*
+ * Pass the packets in the TX ring to the stack.
+ *
+ * After publishing our tail we look at the head again, so a user who
+ * sees an old tail knows it must kick us.
+ */
 static void
-pi_destroy_hook (struct trivfs_protid *cred)
+map_drain_tx (struct netif *netif, struct tunmap *map)
 {
-  struct netif *netif;
-  struct hurdtunif *tunif;
+  struct tunring *tx = &map->hdr->tx;
+  uint32_t head, slot, len;
 
-  if (cred->pi.class != tunnel_class)
-    return;
+  pthread_mutex_lock (&map->tx_lock);
 
-  netif = (struct netif *) cred->po->cntl->hook;
-  tunif = (struct hurdtunif *) netif_get_state (netif);
+  while (1)
+    {
+      head = __atomic_load_n (&tx->head, __ATOMIC_ACQUIRE);
 
-  if (tunif->user == cred->user)
-    tunif->user = 0;
-}
+      /* Don't trust the user to keep the ring consistent */
+      if (head - map->tx_tail > TUN_RING_SLOTS)
+	break;
+
+      for (; map->tx_tail != head; map->tx_tail++)
+	{
+	  slot = map->tx_tail % TUN_RING_SLOTS;
+	  len = tx->len[slot];
+	  if (len > 0 && len <= TUN_RING_SLOT_SIZE)
+	    write_packet (netif, map->tx_slots + slot * TUN_RING_SLOT_SIZE,
+			  len);
+	}
 
-/* If this variable is set, it is called every time a new peropen
-   structure is created and initialized. */
-error_t (*trivfs_check_open_hook) (struct trivfs_control *,
-				   struct iouser *, int) = check_open_hook;
+      __atomic_store_n (&tx->tail, map->tx_tail, __ATOMIC_RELEASE);
+      __atomic_thread_fence (__ATOMIC_SEQ_CST);
+      if (__atomic_load_n (&tx->head, __ATOMIC_RELAXED) == map->tx_tail)
+	break;
+    }
 
-/* If this variable is set, it is called every time a protid structure
-   is about to be destroyed. */
-void (*trivfs_protid_destroy_hook) (struct trivfs_protid *) = pi_destroy_hook;
+  pthread_mutex_unlock (&map->tx_lock);
+}
 
-/* Read data from an IO object.  If offset is -1, read from the object
-   maintained file pointer.  If the object is not seekable, offset is
-   ignored.  The amount desired to be read is in AMOUNT.  */
-error_t
-trivfs_S_io_read (struct trivfs_protid *cred,
-		  mach_port_t reply, mach_msg_type_name_t reply_type,
-		  char **data, mach_msg_type_number_t * data_len,
-		  loff_t offs, size_t amount)
+/* Take the next packet of the queue of CRED, or as many whole frames as
+   fit in AMOUNT, waiting for one unless the open is non-blocking */
+static error_t
+tunnel_read (struct trivfs_protid *cred, char **data,
+	     mach_msg_type_number_t * data_len, loff_t offs, size_t amount)
 {
+  error_t err;
   struct hurdtunif *tunif;
+  struct pbufqueue *q;
   struct pbuf *p;
 
-  if (!cred)
-    return EOPNOTSUPP;
-
-  if (cred->pi.class != tunnel_class)
-    return EOPNOTSUPP;
+  if (!(cred->po->openmodes & O_READ))
+    return EBADF;
 
   tunif =
     (struct hurdtunif *)
     netif_get_state (((struct netif *) cred->po->cntl->hook));
+  q = (struct pbufqueue *) cred->po->hook;
 
-  pthread_mutex_lock (&tunif->lock);
+  if (tunif->framed && amount < TUN_FRAME_HLEN)
+    return EINVAL;
+
+  pthread_mutex_lock (&q->lock);
 
-  while (tunif->queue.len == 0)
+  while ((p = queue_pop (q, cred->po->cntl->hook)) == 0)
     {
+      /*
+       * Packets go to the shared rings now, never to the queue. Waiting
+       * would spin, the rings count as data for select.
+       */
+      if (q->map)
+	{
+	  pthread_mutex_unlock (&q->lock);
+	  return EOPNOTSUPP;
+	}
+
       if (cred->po->openmodes & O_NONBLOCK)
 	{
-	  pthread_mutex_unlock (&tunif->lock);
+	  pthread_mutex_unlock (&q->lock);
 	  return EWOULDBLOCK;
 	}
 
-      tunif->read_blocked = 1;
-      if (pthread_hurd_cond_wait_np (&tunif->read, &tunif->lock))
+      if (queue_wait (q, &q->read, NULL))
 	{
-	  pthread_mutex_unlock (&tunif->lock);
+	  pthread_mutex_unlock (&q->lock);
 	  return EINTR;
 	}
     }
 
-  p = dequeue (&tunif->queue);
-
-  if (p->tot_len < amount)
-    amount = p->tot_len;
-  if (amount > 0)
-    {
-      /* Possibly allocate a new buffer. */
-      if (*data_len < amount)
-	{
-	  *data = mmap (0, amount, PROT_READ | PROT_WRITE, MAP_ANON, 0, 0);
-	  if (*data == MAP_FAILED)
-	    {
-	      pbuf_free (p);
-	      pthread_mutex_unlock (&tunif->lock);
-	      return ENOMEM;
-	    }
-	}
-
-      /* Copy the constant data into the buffer. */
-      memcpy ((char *) *data, p->payload, amount);
-    }
-  *data_len = amount;
-  pbuf_free (p);
+  if (tunif->framed)
+    err = read_frames (q, cred->po->cntl->hook, p, data, data_len, amount);
+  else
+    err = read_packet (q, p, data, data_len, amount);
 
-  pthread_mutex_unlock (&tunif->lock);
+  pthread_mutex_unlock (&q->lock);
 
-  return 0;
+  return err;
 }
 
-/* Write data to an IO object.  If offset is -1, write at the object
-   maintained file pointer.  If the object is not seekable, offset is
-   ignored.  The amount successfully written is returned in amount.  A
-   given user should not have more than one outstanding io_write on an
-   object at a time; servers implement congestion control by delaying
-   responses to io_write.  Servers may drop data (returning ENOBUFS)
-   if they receive more than one write when not prepared for it.  */
-error_t
-trivfs_S_io_write (struct trivfs_protid * cred,
-		   mach_port_t reply,
-		   mach_msg_type_name_t replytype,
-		   char *data,
-		   mach_msg_type_number_t datalen,
-		   off_t offset, mach_msg_type_number_t * amount)
+/* Send the packets written by the user. An empty write is a kick for
+   the TX ring */
+static error_t
+tunnel_write (struct trivfs_protid *cred, char *data,
+	      mach_msg_type_number_t datalen, mach_msg_type_number_t * amount)
 {
   struct netif *netif;
-  struct pbuf *p, *q;
-  uint16_t off;
-
-  /* Deny access if they have bad credentials. */
-  if (!cred)
-    return EOPNOTSUPP;
-
-  else if (!(cred->po->openmodes & O_WRITE))
-    return EBADF;
-
-  if (cred->pi.class != tunnel_class)
-    return EOPNOTSUPP;
+  struct hurdtunif *tunif;
+  struct pbufqueue *q;
+  struct tunmap *map = 0;
 
   netif = (struct netif *) cred->po->cntl->hook;
+  tunif = (struct hurdtunif *) netif_get_state (netif);
+  q = (struct pbufqueue *) cred->po->hook;
 
-  /* Allocate an empty pbuf chain for the data */
-  p = pbuf_alloc (PBUF_RAW, datalen, PBUF_POOL);
-
-  if (p)
+  /* An empty write is a kick for the TX ring. Keep the rings while
+     draining them, their owner may close meanwhile */
+  if (datalen == 0 && __atomic_load_n (&q->map, __ATOMIC_ACQUIRE))
     {
-      /* Iterate to fill the pbuf chain. */
-      q = p;
-      off = 0;
-      do
-	{
-	  memcpy (q->payload, data, q->len);
-
-	  off += q->len;
-
-	  if (q->tot_len == q->len)
-	    break;
-	  else
-	    q = q->next;
-	}
-      while (1);
-
-      /* pass it to the stack */
-      if (netif->input (p, netif) != ERR_OK)
-	{
-	  LWIP_DEBUGF (NETIF_DEBUG, ("trivfs_S_io_write: IP input error\n"));
-	  pbuf_free (p);
-	  p = NULL;
-	}
+      pthread_mutex_lock (&q->lock);
+      map = q->map;
+      if (map)
+	refcount_ref (&map->refs);
+      pthread_mutex_unlock (&q->lock);
+    }
 
-      *amount = datalen;
+  if (map)
+    {
+      map_drain_tx (netif, map);
+      map_release (map);
+      *amount = 0;
+      return 0;
     }
 
-  return 0;
+  return write_data (netif, tunif->framed, data, datalen, amount);
 }
 
-/* Tell how much data can be read from the object without blocking for
-   a "long time" (this should be the same meaning of "long time" used
-   by the nonblocking flag.  */
-kern_return_t
-trivfs_S_io_readable (struct trivfs_protid * cred,
-		      mach_port_t reply, mach_msg_type_name_t replytype,
-		      mach_msg_type_number_t * amount)
+/* Tell the size of the next packet, or of all the queued frames */
+static error_t
+tunnel_readable (struct trivfs_protid *cred, mach_msg_type_number_t * amount)
 {
   struct hurdtunif *tunif;
-
-  if (!cred)
-    return EOPNOTSUPP;
-
-  if (cred->pi.class != tunnel_class)
-    return EOPNOTSUPP;
+  struct pbufqueue *q;
 
   tunif =
     (struct hurdtunif *)
     netif_get_state (((struct netif *) cred->po->cntl->hook));
+  q = (struct pbufqueue *) cred->po->hook;
 
-  pthread_mutex_lock (&tunif->lock);
+  pthread_mutex_lock (&q->lock);
 
-  if (tunif->queue.head)
-    *amount = tunif->queue.head->tot_len;
+  if (q->map)
+    /* The size of the next packet in the RX ring */
+    *amount = map_pending (q->map) ?
+      q->map->hdr->rx.len[q->map->hdr->rx.tail % TUN_RING_SLOTS] : 0;
+  else if (tunif->framed)
+    *amount = queue_bytes (q) + queue_len (q) * TUN_FRAME_HLEN;
   else
-    *amount = 0;
+    {
+      /* Keep the next packet apart so the stack can't drop it meanwhile */
+      if (!q->stash)
+	q->stash = queue_pop (q, cred->po->cntl->hook);
+      *amount = q->stash ? q->stash->tot_len : 0;
+    }
 
-  pthread_mutex_unlock (&tunif->lock);
+  pthread_mutex_unlock (&q->lock);
 
   return 0;
 }
 
-/* SELECT_TYPE is the bitwise OR of SELECT_READ, SELECT_WRITE, and SELECT_URG.
-   Block until one of the indicated types of i/o can be done "quickly", and
-   return the types that are then available.  ID_TAG is returned as passed; it
-   is just for the convenience of the user in matching up reply messages with
-   specific requests sent.  */
+/* Wait until the queue has data. Tunnels are always writable */
 static error_t
-io_select_common (struct trivfs_protid *cred,
-		  mach_port_t reply,
-		  mach_msg_type_name_t reply_type,
-		  struct timespec *tsp, int *type)
+tunnel_select (struct trivfs_protid *cred, struct timespec *tsp, int *type)
 {
   error_t err;
-  struct hurdtunif *tunif;
-
-  if (!cred)
-    return EOPNOTSUPP;
-
-  if (cred->pi.class != tunnel_class)
-    return EOPNOTSUPP;
-
-  /* Make this thread cancellable */
-  ports_interrupt_self_on_port_death (cred, reply);
+  struct pbufqueue *q;
 
   /* We only deal with SELECT_READ and SELECT_WRITE here.  */
   *type &= SELECT_READ | SELECT_WRITE;
@@ -528,39 +1844,35 @@ io_select_common (struct trivfs_protid *cred,
   if (*type == 0)
     return 0;
 
-  tunif =
-    (struct hurdtunif *)
-    netif_get_state (((struct netif *) cred->po->cntl->hook));
+  q = (struct pbufqueue *) cred->po->hook;
 
-  pthread_mutex_lock (&tunif->lock);
+  pthread_mutex_lock (&q->lock);
 
   if (*type & SELECT_WRITE)
     {
       /* We are always writable.  */
-      if (tunif->queue.len == 0)
+      if (!queue_has_data (q))
 	*type &= ~SELECT_READ;
-      pthread_mutex_unlock (&tunif->lock);
+      pthread_mutex_unlock (&q->lock);
       return 0;
     }
 
   while (1)
     {
       /* There's data on the queue */
-      if (tunif->queue.len != 0)
+      if (queue_has_data (q))
 	{
 	  *type = SELECT_READ;
-	  pthread_mutex_unlock (&tunif->lock);
+	  pthread_mutex_unlock (&q->lock);
 	  return 0;
 	}
 
       /* The queue is empty, we must wait */
-      tunif->read_blocked = 1;
-      err =
-	pthread_hurd_cond_timedwait_np (&tunif->select, &tunif->lock, tsp);
+      err = queue_wait (q, &q->select, tsp);
       if (err)
 	{
 	  *type = 0;
-	  pthread_mutex_unlock (&tunif->lock);
+	  pthread_mutex_unlock (&q->lock);
 
 	  if (err == ETIMEDOUT)
 	    err = 0;
@@ -570,152 +1882,84 @@ io_select_common (struct trivfs_protid *cred,
     }
 }
 
-error_t
-trivfs_S_io_select (struct trivfs_protid * cred,
-		    mach_port_t reply,
-		    mach_msg_type_name_t reply_type, int *type)
-{
-  return io_select_common (cred, reply, reply_type, NULL, type);
-}
-
-error_t
-trivfs_S_io_select_timeout (struct trivfs_protid * cred,
-			    mach_port_t reply,
-			    mach_msg_type_name_t reply_type,
-			    struct timespec ts, int *type)
-{
-  return io_select_common (cred, reply, reply_type, &ts, type);
-}
-
-/* Change current read/write offset */
-error_t
-trivfs_S_io_seek (struct trivfs_protid * cred,
-		  mach_port_t reply, mach_msg_type_name_t reply_type,
-		  off_t offs, int whence, off_t * new_offs)
-{
-  if (!cred)
-    return EOPNOTSUPP;
-
-  if (cred->pi.class != tunnel_class)
-    return EOPNOTSUPP;
-
-  return ESPIPE;
-}
-
-/* Change the size of the file.  If the size increases, new blocks are
-   zero-filled.  After successful return, it is safe to reference mapped
-   areas of the file up to NEW_SIZE.  */
-error_t
-trivfs_S_file_set_size (struct trivfs_protid * cred,
-			mach_port_t reply, mach_msg_type_name_t reply_type,
-			off_t size)
+/* Only truncating to nothing is supported, which is a no-op */
+static error_t
+tunnel_set_size (struct trivfs_protid *cred, off_t size)
 {
-  if (!cred)
-    return EOPNOTSUPP;
-
-  if (cred->pi.class != tunnel_class)
-    return EOPNOTSUPP;
-
   return size == 0 ? 0 : EINVAL;
 }
 
-/* These four routines modify the O_APPEND, O_ASYNC, O_FSYNC, and
-   O_NONBLOCK bits for the IO object. In addition, io_get_openmodes
-   will tell you which of O_READ, O_WRITE, and O_EXEC the object can
-   be used for.  The O_ASYNC bit affects icky async I/O; good async
-   I/O is done through io_async which is orthogonal to these calls. */
-error_t
-trivfs_S_io_set_all_openmodes (struct trivfs_protid * cred,
-			       mach_port_t reply,
-			       mach_msg_type_name_t reply_type, int mode)
-{
-  if (!cred)
-    return EOPNOTSUPP;
-
-  if (cred->pi.class != tunnel_class)
-    return EOPNOTSUPP;
-
-  return 0;
-}
-
-error_t
-trivfs_S_io_set_some_openmodes (struct trivfs_protid * cred,
-				mach_port_t reply,
-				mach_msg_type_name_t reply_type, int bits)
+/*
+ * Map the shared rings of the queue of CRED, setting them up the first
+ * time. It takes an open for reading and writing. Only the open that set
+ * them up gets them, they go away when it's closed.
+ */
+static error_t
+tunnel_map (struct trivfs_protid *cred, memory_object_t * rdobj,
+	    memory_object_t * wrobj)
 {
-  if (!cred)
-    return EOPNOTSUPP;
-
-  if (cred->pi.class != tunnel_class)
-    return EOPNOTSUPP;
+  error_t err;
+  struct pbufqueue *q;
+  struct queue_config_msg msg;
 
-  return 0;
-}
+  if ((cred->po->openmodes & (O_READ | O_WRITE)) != (O_READ | O_WRITE))
+    return EBADF;
 
-error_t
-trivfs_S_io_clear_some_openmodes (struct trivfs_protid * cred,
-				  mach_port_t reply,
-				  mach_msg_type_name_t reply_type, int bits)
-{
-  if (!cred)
-    return EOPNOTSUPP;
+  q = (struct pbufqueue *) cred->po->hook;
 
-  if (cred->pi.class != tunnel_class)
-    return EOPNOTSUPP;
+  /* Switch the queue to the shared rings the first time */
+  if (!__atomic_load_n (&q->map, __ATOMIC_ACQUIRE))
+    {
+      err = map_create (&msg.map);
+      if (err)
+	return err;
+
+      msg.map->owner = cred->po;
+      msg.netif = (struct netif *) cred->po->cntl->hook;
+      msg.queue = q;
+      tcpip_api_call (do_install_map, &msg.call);
+      if (msg.err)
+	map_destroy (msg.map);
+    }
 
-  return 0;
-}
+  pthread_mutex_lock (&q->lock);
 
-error_t
-trivfs_S_io_get_owner (struct trivfs_protid * cred,
-		       mach_port_t reply,
-		       mach_msg_type_name_t reply_type, pid_t * owner)
-{
-  if (!cred)
-    return EOPNOTSUPP;
+  if (!q->map || q->map->owner != cred->po)
+    /* Mapped by another open of the same queue */
+    err = EBUSY;
+  else
+    {
+      *rdobj = *wrobj = q->map->memobj;
+      err = 0;
+    }
 
-  if (cred->pi.class != tunnel_class)
-    return EOPNOTSUPP;
+  pthread_mutex_unlock (&q->lock);
 
-  *owner = 0;
-  return 0;
+  return err;
 }
 
-error_t
-trivfs_S_io_mod_owner (struct trivfs_protid * cred,
-		       mach_port_t reply, mach_msg_type_name_t reply_type,
-		       pid_t owner)
-{
-  if (!cred)
-    return EOPNOTSUPP;
-
-  if (cred->pi.class != tunnel_class)
-    return EOPNOTSUPP;
-
-  return EINVAL;
-}
+static const struct trivfs_node_ops tunnel_ops = {
+  .check_open = tunnel_check_open,
+  .po_create = tunnel_po_create,
+  .po_destroy = tunnel_po_destroy,
+  .protid_destroy = tunnel_protid_destroy,
+  .modify_stat = tunnel_modify_stat,
+  .read = tunnel_read,
+  .write = tunnel_write,
+  .readable = tunnel_readable,
+  .select = tunnel_select,
+  .set_size = tunnel_set_size,
+  .map = tunnel_map,
+};
 
-/* Return objects mapping the data underlying this memory object.  If
-   the object can be read then memobjrd will be provided; if the
-   object can be written then memobjwr will be provided.  For objects
-   where read data and write data are the same, these objects will be
-   equal, otherwise they will be disjoint.  Servers are permitted to
-   implement io_map but not io_map_cntl.  Some objects do not provide
-   mapping; they will set none of the ports and return an error.  Such
-   objects can still be accessed by io_read and io_write.  */
+/*
+ * Set libports classes
+ *
+ * This function should be called once.
+ */
 error_t
-trivfs_S_io_map (struct trivfs_protid * cred,
-		 mach_port_t reply,
-		 mach_msg_type_name_t replyPoly,
-		 memory_object_t * rdobj,
-		 mach_msg_type_name_t * rdtype,
-		 memory_object_t * wrobj, mach_msg_type_name_t * wrtype)
+hurdtunif_module_init ()
 {
-  if (!cred)
-    return EOPNOTSUPP;
-
-  if (cred->pi.class != tunnel_class)
-    return EOPNOTSUPP;
-
-  return EINVAL;
+  return trivfs_node_register (&tunnel_cntlclass, &tunnel_class,
+			       &tunnel_ops);
 }
@@ -22,10 +22,56 @@
 
 #include <netif/ifcommon.h>
 
+#include <string.h>
 #include <net/if.h>
 
 #include <lwip/netifapi.h>
 
+uint64_t if_pool_fallbacks;
+
+struct pbuf *
+if_alloc_pbuf (pbuf_layer layer, uint16_t len)
+{
+  struct pbuf *p;
+
+  p = pbuf_alloc (layer, len, PBUF_POOL);
+  if (!p)
+    {
+      p = pbuf_alloc (layer, len, PBUF_RAM);
+      if (p)
+	__atomic_add_fetch (&if_pool_fallbacks, 1, __ATOMIC_RELAXED);
+    }
+
+  return p;
+}
+
+void
+if_get_stats (struct netif *netif, struct ifstats *stats)
+{
+  struct ifstats *shards = netif_get_state (netif)->stats;
+
+  memset (stats, 0, sizeof (struct ifstats));
+  stats->rx_packets = STATS_SUM (shards, rx_packets);
+  stats->rx_bytes = STATS_SUM (shards, rx_bytes);
+  stats->rx_drops = STATS_SUM (shards, rx_drops);
+  stats->tx_packets = STATS_SUM (shards, tx_packets);
+  stats->tx_bytes = STATS_SUM (shards, tx_bytes);
+  stats->tx_drops = STATS_SUM (shards, tx_drops);
+}
+
+void
+if_reset_stats (struct netif *netif)
+{
+  struct ifstats *shards = netif_get_state (netif)->stats;
+
+  STATS_CLEAR (shards, rx_packets);
+  STATS_CLEAR (shards, rx_bytes);
+  STATS_CLEAR (shards, rx_drops);
+  STATS_CLEAR (shards, tx_packets);
+  STATS_CLEAR (shards, tx_bytes);
+  STATS_CLEAR (shards, tx_drops);
+}
+
 /* Open the device and set the interface up */
 static error_t
 if_open (struct netif *netif)
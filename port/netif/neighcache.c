@@ -0,0 +1,580 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Neighbour cache for Ethernet devices */
+
+#include <netif/neighcache.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <lwip/sys.h>
+#include <lwip/etharp.h>
+#include <lwip/ethip6.h>
+#include <lwip/priv/tcpip_priv.h>
+#include <lwip/priv/nd6_priv.h>
+#include <lwip/prot/ip6.h>
+#include <netif/ethernet.h>
+
+#include <lwiphooks.h>
+
+/*
+ * LwIP's ARP table and neighbour cache are small arrays searched
+ * linearly. This cache sits in front of them: the output callbacks look
+ * the next hop up in a hash table, and only go through LwIP when it's
+ * not there. It learns from the ARP packets and neighbour advertisements
+ * LwIP gets in answer.
+ *
+ * Entries are used for NEIGH_REACHABLE_MS after the last confirmation.
+ * Then IPv4 ones are still used for NEIGH_PROBE_MS while an ARP request
+ * confirms them, and IPv6 ones go back to LwIP, which probes them itself.
+ * When full, the least recently used entry is evicted.
+ *
+ * The cache is only used from the tcpip thread.
+ */
+
+struct neigh
+{
+  struct netif *netif;
+  uint32_t addr[4];		/* IPv4 uses the first word */
+  int v6;
+  struct eth_addr mac;
+  uint32_t confirmed;
+  int probed;
+
+  /* Next in the bucket, or in the free list */
+  struct neigh *chain;
+
+  /* Usage order, most recent first */
+  struct neigh *prev, *next;
+};
+
+static struct neigh *entries;
+static struct neigh **buckets;
+static struct neigh *free_entries;
+static struct neigh lru = { .prev = &lru, .next = &lru };
+static uint32_t size, nbuckets;
+
+static struct neighcache_stats stats;
+
+#define NEIGH_COUNT(field) \
+  __atomic_add_fetch (&stats.field, 1, __ATOMIC_RELAXED)
+
+/* Offsets in the frames */
+#define ARP_OFF         SIZEOF_ETH_HDR
+#define IP6_OFF         SIZEOF_ETH_HDR
+#define ICMP6_OFF       (IP6_OFF + 40)
+#define ICMP6_TYPE_NA   136
+#define ND6_OPT_TLLA    2
+
+/* Length of a bare neighbour advertisement, and of the longest learnt from */
+#define NA_MIN_LEN      24
+#define NA_MAX_LEN      256
+
+static uint32_t
+neigh_hash (struct netif *netif, const uint32_t * addr, int v6)
+{
+  uint32_t h;
+  int i;
+
+  h = (uint32_t) (uintptr_t) netif * 0x9e3779b1;
+  for (i = 0; i < (v6 ? 4 : 1); i++)
+    {
+      h ^= addr[i];
+      h *= 0x9e3779b1;
+      h ^= h >> 15;
+    }
+
+  return h & (nbuckets - 1);
+}
+
+static void
+lru_remove (struct neigh *n)
+{
+  n->prev->next = n->next;
+  n->next->prev = n->prev;
+}
+
+static void
+lru_push (struct neigh *n)
+{
+  n->next = lru.next;
+  n->prev = &lru;
+  lru.next->prev = n;
+  lru.next = n;
+}
+
+static struct neigh *
+neigh_find (struct netif *netif, const uint32_t * addr, int v6)
+{
+  struct neigh *n;
+
+  if (!entries)
+    return 0;
+
+  for (n = buckets[neigh_hash (netif, addr, v6)]; n != 0; n = n->chain)
+    if (n->netif == netif && n->v6 == v6
+	&& memcmp (n->addr, addr, (v6 ? 4 : 1) * sizeof (uint32_t)) == 0)
+      break;
+
+  return n;
+}
+
+/* Take N out of the cache */
+static void
+neigh_drop (struct neigh *n)
+{
+  struct neigh **prev;
+
+  for (prev = &buckets[neigh_hash (n->netif, n->addr, n->v6)]; *prev != n;
+       prev = &(*prev)->chain);
+  *prev = n->chain;
+
+  lru_remove (n);
+
+  n->chain = free_entries;
+  free_entries = n;
+}
+
+/* Replace the table by an empty one of NEWSIZE entries */
+static error_t
+neigh_alloc (uint32_t newsize)
+{
+  struct neigh *newentries;
+  struct neigh **newbuckets;
+  uint32_t n, i;
+
+  for (n = 1; n < newsize; n <<= 1);
+
+  newentries = calloc (newsize, sizeof (struct neigh));
+  newbuckets = calloc (n, sizeof (struct neigh *));
+  if (!newentries || !newbuckets)
+    {
+      free (newentries);
+      free (newbuckets);
+      return ENOMEM;
+    }
+
+  free (entries);
+  free (buckets);
+  entries = newentries;
+  buckets = newbuckets;
+  nbuckets = n;
+  __atomic_store_n (&size, newsize, __ATOMIC_RELAXED);
+
+  free_entries = 0;
+  for (i = 0; i < newsize; i++)
+    {
+      entries[i].chain = free_entries;
+      free_entries = &entries[i];
+    }
+  lru.prev = lru.next = &lru;
+
+  return 0;
+}
+
+/*
+ * Record that ADDR is at MAC on NETIF. A new entry is only made if
+ * CREATE, otherwise just an existing one is updated.
+ */
+static void
+neigh_learn (struct netif *netif, const uint32_t * addr, int v6,
+	     const struct eth_addr *mac, int create)
+{
+  struct neigh *n;
+  uint32_t h;
+
+  n = neigh_find (netif, addr, v6);
+  if (n)
+    lru_remove (n);
+  else
+    {
+      if (!create)
+	return;
+
+      if (!entries && neigh_alloc (NEIGH_DEFAULT_SIZE))
+	return;
+
+      if (free_entries)
+	{
+	  n = free_entries;
+	  free_entries = n->chain;
+	}
+      else
+	{
+	  /* Evict the least recently used */
+	  n = lru.prev;
+	  neigh_drop (n);
+	  free_entries = n->chain;
+	  NEIGH_COUNT (evictions);
+	}
+
+      n->netif = netif;
+      n->v6 = v6;
+      memset (n->addr, 0, sizeof (n->addr));
+      memcpy (n->addr, addr, (v6 ? 4 : 1) * sizeof (uint32_t));
+
+      h = neigh_hash (netif, addr, v6);
+      n->chain = buckets[h];
+      buckets[h] = n;
+    }
+
+  memcpy (&n->mac, mac, ETH_HWADDR_LEN);
+  n->confirmed = sys_now ();
+  n->probed = 0;
+  lru_push (n);
+}
+
+/* Get the entry to send to ADDR through, if it's still usable */
+static struct neigh *
+neigh_resolve (struct netif *netif, const uint32_t * addr, int v6)
+{
+  struct neigh *n;
+  uint32_t age;
+  ip4_addr_t ip4;
+
+  n = neigh_find (netif, addr, v6);
+  if (!n)
+    {
+      NEIGH_COUNT (misses);
+      return 0;
+    }
+
+  age = sys_now () - n->confirmed;
+  if (age >= NEIGH_REACHABLE_MS + (v6 ? 0 : NEIGH_PROBE_MS))
+    {
+      neigh_drop (n);
+      NEIGH_COUNT (expirations);
+      NEIGH_COUNT (misses);
+      return 0;
+    }
+
+  if (age >= NEIGH_REACHABLE_MS && !n->probed)
+    {
+      /* Ask for a confirmation, meanwhile keep using it */
+      n->probed = 1;
+      ip4.addr = n->addr[0];
+      etharp_request (netif, &ip4);
+    }
+
+  lru_remove (n);
+  lru_push (n);
+  NEIGH_COUNT (hits);
+
+  return n;
+}
+
+err_t
+neighcache_output (struct netif *netif, struct pbuf *p,
+		   const ip4_addr_t * ipaddr)
+{
+  const ip4_addr_t *hop = ipaddr;
+  struct neigh *n;
+
+  if (ip4_addr_isbroadcast (ipaddr, netif) || ip4_addr_ismulticast (ipaddr))
+    return etharp_output (netif, p, ipaddr);
+
+  if (!ip4_addr_netcmp (ipaddr, netif_ip4_addr (netif),
+			netif_ip4_netmask (netif))
+      && !ip4_addr_islinklocal (ipaddr))
+    {
+      /* Off-link, send it to the gateway */
+      hop = route_ip4_gw_hook (netif, ipaddr);
+      if (!hop)
+	hop = netif_ip4_gw (netif);
+    }
+
+  n = neigh_resolve (netif, &hop->addr, 0);
+  if (!n)
+    return etharp_output (netif, p, ipaddr);
+
+  return ethernet_output (netif, p, (const struct eth_addr *) netif->hwaddr,
+			  &n->mac, ETHTYPE_IP);
+}
+
+/*
+ * Off-link destinations are only found here if there's a static route
+ * for them, LwIP chooses among the default routers.
+ */
+err_t
+neighcache_output_ip6 (struct netif *netif, struct pbuf *p,
+		       const ip6_addr_t * ip6addr)
+{
+  const ip6_addr_t *hop;
+  struct neigh *n;
+
+  if (ip6_addr_ismulticast (ip6addr))
+    return ethip6_output (netif, p, ip6addr);
+
+  hop = route_ip6_gw_hook (netif, ip6addr);
+  if (!hop)
+    hop = ip6addr;
+
+  n = neigh_resolve (netif, hop->addr, 1);
+  if (!n)
+    return ethip6_output (netif, p, ip6addr);
+
+  return ethernet_output (netif, p, (const struct eth_addr *) netif->hwaddr,
+			  &n->mac, ETHTYPE_IPV6);
+}
+
+/* Learn the sender of an ARP packet, if it's for us or already known */
+static void
+learn_arp (struct pbuf *p, struct netif *netif)
+{
+  uint8_t arp[28];
+  uint32_t sip, tip;
+
+  if (pbuf_copy_partial (p, arp, sizeof arp, ARP_OFF) != sizeof arp)
+    return;
+
+  /* Ethernet and IPv4 */
+  if (arp[0] != 0 || arp[1] != 1 || arp[2] != 0x08 || arp[3] != 0x00
+      || arp[4] != ETH_HWADDR_LEN || arp[5] != 4)
+    return;
+
+  memcpy (&sip, arp + 14, 4);
+  memcpy (&tip, arp + 24, 4);
+
+  /* Address probes don't tell anything */
+  if (sip == 0 || (arp[8] & 1))
+    return;
+
+  neigh_learn (netif, &sip, 0, (struct eth_addr *) (arp + 8),
+	       tip == netif_ip4_addr (netif)->addr);
+}
+
+/* Whether the checksum of MSG, LEN bytes of ICMPv6 in packet IP6, is right */
+static int
+icmp6_checksum_ok (const uint8_t * ip6, const uint8_t * msg, uint16_t len)
+{
+  uint32_t sum = IP6_NEXTH_ICMP6 + len;
+  int i;
+
+  /* Pseudo header: the source and destination addresses */
+  for (i = 8; i < 40; i += 2)
+    sum += (ip6[i] << 8) | ip6[i + 1];
+
+  for (i = 0; i + 1 < len; i += 2)
+    sum += (msg[i] << 8) | msg[i + 1];
+  if (len & 1)
+    sum += msg[len - 1] << 8;
+
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+
+  return sum == 0xffff;
+}
+
+/* Whether LwIP is soliciting TARGET on NETIF */
+static int
+nd6_soliciting (struct netif *netif, const uint32_t * target)
+{
+  int i;
+
+  for (i = 0; i < LWIP_ND6_NUM_NEIGHBORS; i++)
+    if (neighbor_cache[i].netif == netif
+	&& (neighbor_cache[i].state == ND6_INCOMPLETE
+	    || neighbor_cache[i].state == ND6_DELAY
+	    || neighbor_cache[i].state == ND6_PROBE)
+	&& memcmp (neighbor_cache[i].next_hop_address.addr, target,
+		   4 * sizeof (uint32_t)) == 0)
+      return 1;
+
+  return 0;
+}
+
+/*
+ * Learn the target of a neighbour advertisement, following RFC 4861
+ * 7.2.5. This runs before LwIP has looked at the packet, so it checks it
+ * itself. Only an answer to one of LwIP's solicitations makes a new entry
+ * or confirms one. An advertisement without the override flag doesn't
+ * change a known address, and an unsolicited one with it only drops the
+ * entry, so LwIP checks the new address.
+ */
+static void
+learn_na (struct pbuf *p, struct netif *netif)
+{
+  uint8_t ip6[40], na[NA_MAX_LEN], *opt;
+  uint32_t target[4];
+  struct eth_addr *mac = 0;
+  struct neigh *n;
+  uint16_t len, off;
+  int solicited, override;
+
+  if (pbuf_copy_partial (p, ip6, sizeof ip6, IP6_OFF) != sizeof ip6)
+    return;
+
+  /* Only from the link, with no extension headers */
+  if (ip6[6] != IP6_NEXTH_ICMP6 || ip6[7] != 255)
+    return;
+  len = (ip6[4] << 8) | ip6[5];
+
+  if (len < NA_MIN_LEN || len > sizeof na
+      || pbuf_copy_partial (p, na, len, ICMP6_OFF) != len
+      || na[0] != ICMP6_TYPE_NA || na[1] != 0
+      || !icmp6_checksum_ok (ip6, na, len))
+    return;
+
+  memcpy (target, na + 8, sizeof target);
+  if (ip6_addr_ismulticast ((ip6_addr_t *) target))
+    return;
+
+  /* Look for the target link-layer address */
+  for (off = NA_MIN_LEN; off + 8 <= len; off += opt[1] * 8)
+    {
+      opt = na + off;
+      if (opt[1] == 0 || off + opt[1] * 8 > len)
+	return;
+
+      if (opt[0] == ND6_OPT_TLLA && opt[1] == 1)
+	{
+	  mac = (struct eth_addr *) (opt + 2);
+	  break;
+	}
+    }
+  if (!mac)
+    return;
+
+  solicited = na[4] & 0x40;
+  override = na[4] & 0x20;
+  n = neigh_find (netif, target, 1);
+
+  if (!solicited)
+    {
+      if (n && override && memcmp (&n->mac, mac, ETH_HWADDR_LEN) != 0)
+	neigh_drop (n);
+      return;
+    }
+
+  if (n)
+    {
+      /* Keep the known address unless told to override it */
+      if (!override && memcmp (&n->mac, mac, ETH_HWADDR_LEN) != 0)
+	return;
+    }
+  else if (!nd6_soliciting (netif, target))
+    return;
+
+  neigh_learn (netif, target, 1, mac, 1);
+}
+
+/* Called from the tcpip thread for every incoming frame */
+err_t
+neighcache_input (struct pbuf *p, struct netif *netif)
+{
+  uint8_t type[2];
+
+  if (pbuf_copy_partial (p, type, 2, SIZEOF_ETH_HDR - 2) == 2)
+    {
+      if (type[0] == 0x08 && type[1] == 0x06)
+	learn_arp (p, netif);
+      else if (type[0] == 0x86 && type[1] == 0xdd)
+	learn_na (p, netif);
+    }
+
+  return ethernet_input (p, netif);
+}
+
+struct neigh_msg
+{
+  struct tcpip_api_call_data call;
+  struct netif *netif;
+  uint32_t size;
+  error_t err;
+};
+
+static err_t
+do_flush (struct tcpip_api_call_data *call)
+{
+  struct neigh_msg *msg = (struct neigh_msg *) call;
+  struct neigh *n, *next;
+
+  for (n = lru.next; n != &lru; n = next)
+    {
+      next = n->next;
+      if (n->netif == msg->netif)
+	neigh_drop (n);
+    }
+
+  return ERR_OK;
+}
+
+static err_t
+do_set_size (struct tcpip_api_call_data *call)
+{
+  struct neigh_msg *msg = (struct neigh_msg *) call;
+
+  if (entries && size == msg->size)
+    msg->err = 0;
+  else
+    msg->err = neigh_alloc (msg->size);
+
+  return ERR_OK;
+}
+
+void
+neighcache_flush (struct netif *netif)
+{
+  struct neigh_msg msg;
+
+  msg.netif = netif;
+  tcpip_api_call (do_flush, &msg.call);
+}
+
+error_t
+neighcache_set_size (uint32_t newsize)
+{
+  struct neigh_msg msg;
+
+  if (newsize == 0)
+    return EINVAL;
+
+  msg.size = newsize;
+  msg.err = 0;
+  tcpip_api_call (do_set_size, &msg.call);
+
+  return msg.err;
+}
+
+uint32_t
+neighcache_get_size (void)
+{
+  uint32_t n = __atomic_load_n (&size, __ATOMIC_RELAXED);
+
+  return n ? n : NEIGH_DEFAULT_SIZE;
+}
+
+void
+neighcache_get_stats (struct neighcache_stats *s)
+{
+  s->hits = __atomic_load_n (&stats.hits, __ATOMIC_RELAXED);
+  s->misses = __atomic_load_n (&stats.misses, __ATOMIC_RELAXED);
+  s->evictions = __atomic_load_n (&stats.evictions, __ATOMIC_RELAXED);
+  s->expirations = __atomic_load_n (&stats.expirations, __ATOMIC_RELAXED);
+}
+
+void
+neighcache_reset_stats (void)
+{
+  __atomic_store_n (&stats.hits, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&stats.misses, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&stats.evictions, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&stats.expirations, 0, __ATOMIC_RELAXED);
+}
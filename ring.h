@@ -0,0 +1,184 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Bounded lock-free queue of pointers */
+
+#ifndef LWIP_RING_H
+#define LWIP_RING_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Any number of threads may push and pop concurrently. Each cell carries
+ * a sequence number telling whether it's ready to be written or read in
+ * the current lap, as in Vyukov's bounded MPMC queue.
+ */
+
+#define RING_CACHELINE  64
+
+struct ring_cell
+{
+  unsigned long seq;
+  void *ptr;
+  uint32_t tag;
+};
+
+struct ring
+{
+  struct ring_cell *cells;
+  unsigned long mask;
+
+  /* Producers and consumers don't share cache lines */
+  unsigned long head __attribute__ ((aligned (RING_CACHELINE)));
+  unsigned long tail __attribute__ ((aligned (RING_CACHELINE)));
+};
+
+/* Initialize R to hold at least SIZE elements */
+static inline error_t
+ring_init (struct ring *r, size_t size)
+{
+  size_t i, n;
+
+  for (n = 1; n < size; n <<= 1);
+
+  r->cells = malloc (n * sizeof (struct ring_cell));
+  if (!r->cells)
+    return ENOMEM;
+
+  for (i = 0; i < n; i++)
+    {
+      r->cells[i].seq = i;
+      r->cells[i].ptr = 0;
+    }
+
+  r->mask = n - 1;
+  r->head = r->tail = 0;
+
+  return 0;
+}
+
+/* Release the resources of R. It must be empty */
+static inline void
+ring_destroy (struct ring *r)
+{
+  free (r->cells);
+  r->cells = 0;
+}
+
+/* Add PTR and TAG to the tail of R. Returns 0 if R is full */
+static inline int
+ring_push (struct ring *r, void *ptr, uint32_t tag)
+{
+  struct ring_cell *cell;
+  unsigned long pos, seq;
+  long dif;
+
+  pos = __atomic_load_n (&r->tail, __ATOMIC_RELAXED);
+  for (;;)
+    {
+      cell = &r->cells[pos & r->mask];
+      seq = __atomic_load_n (&cell->seq, __ATOMIC_ACQUIRE);
+      dif = (long) seq - (long) pos;
+      if (dif == 0)
+	{
+	  if (__atomic_compare_exchange_n (&r->tail, &pos, pos + 1, 1,
+					   __ATOMIC_RELAXED,
+					   __ATOMIC_RELAXED))
+	    break;
+	}
+      else if (dif < 0)
+	/* The cell from the previous lap hasn't been read yet */
+	return 0;
+      else
+	pos = __atomic_load_n (&r->tail, __ATOMIC_RELAXED);
+    }
+
+  cell->ptr = ptr;
+  cell->tag = tag;
+  __atomic_store_n (&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+  return 1;
+}
+
+/* Get from the head of R, and its tag in TAG. Returns 0 if R is empty */
+static inline void *
+ring_pop (struct ring *r, uint32_t * tag)
+{
+  struct ring_cell *cell;
+  unsigned long pos, seq;
+  long dif;
+  void *ptr;
+
+  pos = __atomic_load_n (&r->head, __ATOMIC_RELAXED);
+  for (;;)
+    {
+      cell = &r->cells[pos & r->mask];
+      seq = __atomic_load_n (&cell->seq, __ATOMIC_ACQUIRE);
+      dif = (long) seq - (long) (pos + 1);
+      if (dif == 0)
+	{
+	  if (__atomic_compare_exchange_n (&r->head, &pos, pos + 1, 1,
+					   __ATOMIC_RELAXED,
+					   __ATOMIC_RELAXED))
+	    break;
+	}
+      else if (dif < 0)
+	/* Nothing written in this cell yet */
+	return 0;
+      else
+	pos = __atomic_load_n (&r->head, __ATOMIC_RELAXED);
+    }
+
+  ptr = cell->ptr;
+  if (tag)
+    *tag = cell->tag;
+  __atomic_store_n (&cell->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+
+  return ptr;
+}
+
+/* Whether there's an element ready to be popped from R */
+static inline int
+ring_ready (struct ring *r)
+{
+  unsigned long pos;
+
+  pos = __atomic_load_n (&r->head, __ATOMIC_ACQUIRE);
+  return __atomic_load_n (&r->cells[pos & r->mask].seq, __ATOMIC_ACQUIRE)
+    == pos + 1;
+}
+
+/*
+ * Number of elements in R. Only exact when nobody else is using it,
+ * otherwise it may count elements still being pushed or popped.
+ */
+static inline unsigned long
+ring_count (struct ring *r)
+{
+  unsigned long head, tail;
+
+  head = __atomic_load_n (&r->head, __ATOMIC_ACQUIRE);
+  tail = __atomic_load_n (&r->tail, __ATOMIC_ACQUIRE);
+
+  return tail - head;
+}
+
+#endif /* LWIP_RING_H */
@@ -0,0 +1,609 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Static routing table */
+
+#include <route.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <lwip/priv/tcpip_priv.h>
+
+#include <lwiphooks.h>
+
+/*
+ * Each family has a multibit trie with 8-bit strides, so a lookup reads
+ * at most 4 nodes for IPv4 and 16 for IPv6 whatever the number of routes.
+ *
+ * A route lives in the node for its last byte, expanded over all the
+ * entries it covers there. An entry holds the longest route among those
+ * expanded over it, and the lookup keeps the last one found on its way
+ * down. Routes of length 0 aren't in the trie.
+ *
+ * The tables are only used from the tcpip thread.
+ */
+
+#define ROUTE_STRIDE    8
+#define ROUTE_FANOUT    (1 << ROUTE_STRIDE)
+#define ROUTE_MAX_LEVELS  16
+
+struct route_node;
+
+struct route_entry
+{
+  struct route_node *child;
+  struct route *route;
+};
+
+struct route_node
+{
+  struct route_entry entries[ROUTE_FANOUT];
+
+  /* Number of entries with a child or a route */
+  unsigned int used;
+};
+
+struct route_table
+{
+  struct route_node *root;
+
+  /* The default route */
+  struct route *def;
+
+  /* All the routes, for listing and removal */
+  struct route *routes;
+
+  /* Length of the addresses, in bytes */
+  int levels;
+};
+
+static struct route_table table4 = { 0, 0, 0, 4 };
+static struct route_table table6 = { 0, 0, 0, 16 };
+
+/* Get the table for ADDR, and its bytes in network order in KEY */
+static struct route_table *
+route_key (const ip_addr_t * addr, uint8_t ** key)
+{
+  if (IP_IS_V6 (addr))
+    {
+      *key = (uint8_t *) ip_2_ip6 (addr)->addr;
+      return &table6;
+    }
+
+  *key = (uint8_t *) & ip_2_ip4 (addr)->addr;
+  return &table4;
+}
+
+/* Whether the first LEN bits of A and B are the same */
+static int
+key_match (const uint8_t * a, const uint8_t * b, int len)
+{
+  int bytes = len / 8;
+  int bits = len % 8;
+
+  if (memcmp (a, b, bytes))
+    return 0;
+
+  return !bits || ((a[bytes] ^ b[bytes]) & (0xff00 >> bits) & 0xff) == 0;
+}
+
+/* Clear the bits after the first LEN of KEY */
+static void
+key_mask (uint8_t * key, int len, int levels)
+{
+  int i, bits;
+
+  for (i = len / 8; i < levels; i++)
+    {
+      bits = len - i * 8;
+      key[i] &= bits > 0 ? (0xff00 >> bits) & 0xff : 0;
+    }
+}
+
+/* Add R to the trie of T */
+static error_t
+table_insert (struct route_table *t, struct route *r)
+{
+  struct route_node *node = 0, **slot = &t->root;
+  struct route_entry *e = 0;
+  uint8_t *key;
+  int level, last, span, first, i;
+
+  if (r->len == 0)
+    {
+      t->def = r;
+      return 0;
+    }
+
+  route_key (&r->prefix, &key);
+  last = (r->len - 1) / ROUTE_STRIDE;
+
+  for (level = 0;; level++)
+    {
+      if (!*slot)
+	{
+	  *slot = calloc (1, sizeof (struct route_node));
+	  if (!*slot)
+	    return ENOMEM;
+
+	  /* The parent entry was empty if it had no route */
+	  if (e && !e->route)
+	    node->used++;
+	}
+
+      node = *slot;
+      if (level == last)
+	break;
+
+      e = &node->entries[key[level]];
+      slot = &e->child;
+    }
+
+  /* Expand R over the entries it covers, unless they have a longer one */
+  span = 1 << ((last + 1) * ROUTE_STRIDE - r->len);
+  first = key[last] & ~(span - 1);
+  for (i = first; i < first + span; i++)
+    {
+      e = &node->entries[i];
+      if (e->route && e->route->len > r->len)
+	continue;
+
+      if (!e->route && !e->child)
+	node->used++;
+      e->route = r;
+    }
+
+  return 0;
+}
+
+/* Take R out of the trie of T, it must still be in the list */
+static void
+table_remove (struct route_table *t, struct route *r)
+{
+  struct route_node *path[ROUTE_MAX_LEVELS], *node;
+  struct route_entry *e;
+  struct route *best, *other;
+  uint8_t *key, *okey;
+  int level, last, span, first, i;
+
+  if (r->len == 0)
+    {
+      if (t->def == r)
+	t->def = 0;
+      return;
+    }
+
+  route_key (&r->prefix, &key);
+  last = (r->len - 1) / ROUTE_STRIDE;
+
+  node = t->root;
+  for (level = 0; level < last; level++)
+    {
+      if (!node)
+	return;
+      path[level] = node;
+      node = node->entries[key[level]].child;
+    }
+  if (!node)
+    return;
+  path[last] = node;
+
+  /* The longest shorter route in the same node takes its place */
+  best = 0;
+  for (other = t->routes; other != 0; other = other->next)
+    {
+      if (other == r || other->len <= last * ROUTE_STRIDE
+	  || other->len >= r->len || (best && other->len <= best->len))
+	continue;
+
+      route_key (&other->prefix, &okey);
+      if (key_match (key, okey, other->len))
+	best = other;
+    }
+
+  span = 1 << ((last + 1) * ROUTE_STRIDE - r->len);
+  first = key[last] & ~(span - 1);
+  for (i = first; i < first + span; i++)
+    {
+      e = &node->entries[i];
+      if (e->route != r)
+	continue;
+
+      e->route = best;
+      if (!best && !e->child)
+	node->used--;
+    }
+
+  /* Release the nodes left empty */
+  for (level = last; level >= 0 && path[level]->used == 0; level--)
+    {
+      free (path[level]);
+
+      if (level == 0)
+	t->root = 0;
+      else
+	{
+	  e = &path[level - 1]->entries[key[level - 1]];
+	  e->child = 0;
+	  if (!e->route)
+	    path[level - 1]->used--;
+	}
+    }
+}
+
+/* Find the longest route matching KEY */
+static struct route *
+table_lookup (struct route_table *t, const uint8_t * key)
+{
+  struct route_node *node = t->root;
+  struct route *found = t->def;
+  struct route_entry *e;
+  int level;
+
+  for (level = 0; node && level < t->levels; level++)
+    {
+      e = &node->entries[key[level]];
+      if (e->route)
+	found = e->route;
+      node = e->child;
+    }
+
+  return found;
+}
+
+/* Unlink R from T and free it */
+static void
+table_free (struct route_table *t, struct route *r)
+{
+  struct route **prev;
+
+  table_remove (t, r);
+
+  for (prev = &t->routes; *prev != r; prev = &(*prev)->next);
+  *prev = r->next;
+
+  free (r);
+}
+
+/* Find the route to exactly PREFIX/LEN in T */
+static struct route *
+table_find (struct route_table *t, const uint8_t * key, uint8_t len)
+{
+  struct route *r;
+  uint8_t *rkey;
+
+  for (r = t->routes; r != 0; r = r->next)
+    {
+      route_key (&r->prefix, &rkey);
+      if (r->len == len && key_match (key, rkey, len))
+	break;
+    }
+
+  return r;
+}
+
+struct route_msg
+{
+  struct tcpip_api_call_data call;
+  const ip_addr_t *prefix;
+  uint8_t len;
+  const ip_addr_t *gateway;
+  struct netif *netif;
+  struct route *routes;
+  size_t num;
+  error_t err;
+};
+
+static err_t
+do_route_add (struct tcpip_api_call_data *call)
+{
+  struct route_msg *msg = (struct route_msg *) call;
+  struct route_table *t;
+  struct route *r, *old;
+  uint8_t *key;
+
+  r = malloc (sizeof (struct route));
+  if (!r)
+    {
+      msg->err = ENOMEM;
+      return ERR_OK;
+    }
+
+  ip_addr_copy (r->prefix, *msg->prefix);
+  ip_addr_copy (r->gateway, *msg->gateway);
+  r->len = msg->len;
+  r->netif = msg->netif;
+
+  t = route_key (&r->prefix, &key);
+  if (r->len > t->levels * 8
+      || IP_IS_V6 (&r->gateway) != IP_IS_V6 (&r->prefix))
+    {
+      free (r);
+      msg->err = EINVAL;
+      return ERR_OK;
+    }
+  key_mask (key, r->len, t->levels);
+
+#ifdef ip6_addr_assign_zone
+  if (IP_IS_V6 (&r->gateway))
+    ip6_addr_assign_zone (ip_2_ip6 (&r->gateway), IP6_UNICAST, r->netif);
+#endif
+
+  old = table_find (t, key, r->len);
+  if (old)
+    table_free (t, old);
+
+  msg->err = table_insert (t, r);
+  if (msg->err)
+    {
+      free (r);
+      return ERR_OK;
+    }
+
+  r->next = t->routes;
+  t->routes = r;
+
+  return ERR_OK;
+}
+
+static err_t
+do_route_del (struct tcpip_api_call_data *call)
+{
+  struct route_msg *msg = (struct route_msg *) call;
+  struct route_table *t;
+  struct route *r;
+  ip_addr_t prefix;
+  uint8_t *key;
+
+  ip_addr_copy (prefix, *msg->prefix);
+  t = route_key (&prefix, &key);
+  if (msg->len > t->levels * 8)
+    {
+      msg->err = EINVAL;
+      return ERR_OK;
+    }
+  key_mask (key, msg->len, t->levels);
+
+  r = table_find (t, key, msg->len);
+  if (r)
+    table_free (t, r);
+
+  msg->err = r ? 0 : ESRCH;
+
+  return ERR_OK;
+}
+
+static err_t
+do_route_flush (struct tcpip_api_call_data *call)
+{
+  struct route_msg *msg = (struct route_msg *) call;
+  struct route_table *tables[] = { &table4, &table6 };
+  struct route *r, *next;
+  int i;
+
+  for (i = 0; i < 2; i++)
+    for (r = tables[i]->routes; r != 0; r = next)
+      {
+	next = r->next;
+	if (r->netif == msg->netif)
+	  table_free (tables[i], r);
+      }
+
+  return ERR_OK;
+}
+
+static err_t
+do_route_list (struct tcpip_api_call_data *call)
+{
+  struct route_msg *msg = (struct route_msg *) call;
+  struct route_table *tables[] = { &table4, &table6 };
+  struct route *r;
+  size_t num = 0;
+  int i;
+
+  for (i = 0; i < 2; i++)
+    for (r = tables[i]->routes; r != 0; r = r->next)
+      if (r->netif == msg->netif)
+	num++;
+
+  msg->routes = malloc ((num ? num : 1) * sizeof (struct route));
+  if (!msg->routes)
+    {
+      msg->err = ENOMEM;
+      return ERR_OK;
+    }
+
+  msg->num = 0;
+  for (i = 0; i < 2; i++)
+    for (r = tables[i]->routes; r != 0; r = r->next)
+      if (r->netif == msg->netif)
+	msg->routes[msg->num++] = *r;
+
+  msg->err = 0;
+
+  return ERR_OK;
+}
+
+error_t
+route_add (const ip_addr_t * prefix, uint8_t len, const ip_addr_t * gateway,
+	   struct netif *netif)
+{
+  struct route_msg msg;
+
+  msg.prefix = prefix;
+  msg.len = len;
+  msg.gateway = gateway;
+  msg.netif = netif;
+  msg.err = 0;
+  tcpip_api_call (do_route_add, &msg.call);
+
+  return msg.err;
+}
+
+error_t
+route_del (const ip_addr_t * prefix, uint8_t len)
+{
+  struct route_msg msg;
+
+  msg.prefix = prefix;
+  msg.len = len;
+  msg.err = 0;
+  tcpip_api_call (do_route_del, &msg.call);
+
+  return msg.err;
+}
+
+void
+route_flush (struct netif *netif)
+{
+  struct route_msg msg;
+
+  msg.netif = netif;
+  tcpip_api_call (do_route_flush, &msg.call);
+}
+
+error_t
+route_list (struct netif *netif, struct route **routes, size_t * num)
+{
+  struct route_msg msg;
+
+  msg.netif = netif;
+  msg.err = 0;
+  tcpip_api_call (do_route_list, &msg.call);
+
+  if (!msg.err)
+    {
+      *routes = msg.routes;
+      *num = msg.num;
+    }
+
+  return msg.err;
+}
+
+/* Whether R is the route to PREFIX/LEN through GATEWAY, or any gateway
+   if NULL. Host bits in PREFIX are ignored */
+int
+route_is (const struct route *r, const ip_addr_t * prefix, uint8_t len,
+	  const ip_addr_t * gateway)
+{
+  ip_addr_t copy;
+  uint8_t *key, *rkey;
+
+  if (r->len != len || IP_IS_V6 (&r->prefix) != IP_IS_V6 (prefix)
+      || (gateway && !ip_addr_cmp_zoneless (&r->gateway, gateway)))
+    return 0;
+
+  ip_addr_copy (copy, *prefix);
+  route_key (&r->prefix, &rkey);
+  route_key (&copy, &key);
+
+  return key_match (key, rkey, len);
+}
+
+/* Whether the stack can send through the interface of R */
+static int
+route_usable (struct route *r)
+{
+  return r && netif_is_up (r->netif) && netif_is_link_up (r->netif);
+}
+
+/* Interface for DEST, or NULL to let LwIP choose */
+struct netif *
+route_ip4_hook (const ip4_addr_t * dest)
+{
+  struct route *r;
+
+  r = table_lookup (&table4, (const uint8_t *) &dest->addr);
+
+  return route_usable (r) ? r->netif : 0;
+}
+
+/* Next hop for DEST through NETIF, or NULL for the interface gateway */
+const ip4_addr_t *
+route_ip4_gw_hook (struct netif *netif, const ip4_addr_t * dest)
+{
+  struct route *r;
+
+  r = table_lookup (&table4, (const uint8_t *) &dest->addr);
+  if (!r || r->netif != netif)
+    return 0;
+
+  if (ip_addr_isany (&r->gateway))
+    /* On-link */
+    return dest;
+
+  return ip_2_ip4 (&r->gateway);
+}
+
+/* Whether DEST is on the link of an interface, or the loopback address */
+static int
+ip6_is_local (const ip6_addr_t * dest)
+{
+  struct netif *netif;
+  int i;
+
+  if (ip6_addr_isloopback (dest))
+    return 1;
+
+  for (netif = netif_list; netif != 0; netif = netif->next)
+    {
+      if (!netif_is_up (netif))
+	continue;
+
+      for (i = 0; i < LWIP_IPV6_NUM_ADDRESSES; i++)
+	if (ip6_addr_isvalid (netif_ip6_addr_state (netif, i))
+	    && ip6_addr_netcmp (dest, netif_ip6_addr (netif, i)))
+	  return 1;
+    }
+
+  return 0;
+}
+
+/*
+ * LwIP asks this one before looking at the connected subnets, so leave
+ * those to it: a route must not take traffic away from the link.
+ */
+struct netif *
+route_ip6_hook (const ip6_addr_t * src, const ip6_addr_t * dest)
+{
+  struct route *r;
+
+  if (ip6_is_local (dest))
+    return 0;
+
+  r = table_lookup (&table6, (const uint8_t *) dest->addr);
+
+  return route_usable (r) ? r->netif : 0;
+}
+
+const ip6_addr_t *
+route_ip6_gw_hook (struct netif *netif, const ip6_addr_t * dest)
+{
+  struct route *r;
+
+  r = table_lookup (&table6, (const uint8_t *) dest->addr);
+  if (!r || r->netif != netif)
+    return 0;
+
+  if (ip_addr_isany (&r->gateway))
+    return dest;
+
+  return ip_2_ip6 (&r->gateway);
+}
@@ -0,0 +1,74 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Static routing table */
+
+#ifndef LWIP_ROUTE_H
+#define LWIP_ROUTE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include <lwip/ip_addr.h>
+#include <lwip/netif.h>
+
+/* A static route, IPv4 or IPv6 */
+struct route
+{
+  ip_addr_t prefix;
+  uint8_t len;
+
+  /* Any if the destination is on-link */
+  ip_addr_t gateway;
+
+  struct netif *netif;
+
+  /* Next in the list of its table */
+  struct route *next;
+};
+
+/*
+ * Add a route to PREFIX/LEN through NETIF, replacing any other to the
+ * same prefix. Host bits in PREFIX are ignored.
+ */
+error_t route_add (const ip_addr_t * prefix, uint8_t len,
+		   const ip_addr_t * gateway, struct netif *netif);
+
+/* Remove the route to PREFIX/LEN */
+error_t route_del (const ip_addr_t * prefix, uint8_t len);
+
+/*
+ * Whether R is the route to PREFIX/LEN through GATEWAY, or through any
+ * gateway if it's NULL. Host bits in PREFIX are ignored.
+ */
+int route_is (const struct route *r, const ip_addr_t * prefix, uint8_t len,
+	      const ip_addr_t * gateway);
+
+/* Remove all routes through NETIF */
+void route_flush (struct netif *netif);
+
+/*
+ * Get a copy of the routes through NETIF in ROUTES, which the caller must
+ * free. Their next fields are meaningless.
+ */
+error_t route_list (struct netif *netif, struct route **routes,
+		    size_t * num);
+
+#endif /* LWIP_ROUTE_H */
@@ -0,0 +1,356 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* RPC counters and latency histograms */
+
+#include <rpcstats.h>
+
+#if LWIP_RPC_STATS
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+/*
+ * Each server thread counts the RPCs it handles in its own table, so
+ * there's no locking and no shared cache line on the way. Readers add
+ * the tables up under threads_lock. Threads give their counters to
+ * `retired' when they exit.
+ *
+ * A reset only moves to a new epoch. Each thread clears its own table
+ * when it sees it's from an old one, and readers skip those.
+ */
+
+struct rpc_entry
+{
+  mach_msg_id_t id;
+  uint64_t calls;
+  uint64_t errors;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint32_t hist[RPC_BUCKETS];
+};
+
+struct rpc_table
+{
+  struct rpc_table *next;
+  unsigned int epoch;
+  struct rpc_entry *slots[RPC_SLOTS];
+};
+
+static struct rpc_table *threads;
+static struct rpc_table retired;
+static unsigned int epoch;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static __thread struct rpc_table *self;
+
+/* Only the owner writes, readers may look at any time */
+#define BUMP(field, n) \
+  __atomic_store_n (&(field), (field) + (n), __ATOMIC_RELAXED)
+#define LOAD(field) \
+  __atomic_load_n (&(field), __ATOMIC_RELAXED)
+
+static int
+bucket (uint64_t ns)
+{
+  int msb, i;
+
+  if (ns < (1 << RPC_SUB_BITS))
+    return ns;
+
+  msb = 63 - __builtin_clzll (ns);
+  i = ((msb - RPC_SUB_BITS + 1) << RPC_SUB_BITS)
+    + ((ns >> (msb - RPC_SUB_BITS)) & ((1 << RPC_SUB_BITS) - 1));
+
+  return i < RPC_BUCKETS ? i : RPC_BUCKETS - 1;
+}
+
+/* Lowest latency counted in bucket I */
+static uint64_t
+bucket_low (int i)
+{
+  int msb;
+
+  if (i < (1 << RPC_SUB_BITS))
+    return i;
+
+  msb = (i >> RPC_SUB_BITS) + RPC_SUB_BITS - 1;
+  return (1ULL << msb)
+    + ((uint64_t) (i & ((1 << RPC_SUB_BITS) - 1)) << (msb - RPC_SUB_BITS));
+}
+
+/* Find the entry for ID in T, or add it */
+static struct rpc_entry *
+entry_get (struct rpc_table *t, mach_msg_id_t id)
+{
+  unsigned int i, n;
+  struct rpc_entry *e;
+
+  i = ((uint32_t) id * 2654435761U) % RPC_SLOTS;
+  for (n = 0; n < RPC_SLOTS; n++, i = (i + 1) % RPC_SLOTS)
+    {
+      e = t->slots[i];
+      if (e && e->id == id)
+	return e;
+
+      if (!e)
+	{
+	  e = calloc (1, sizeof (struct rpc_entry));
+	  if (e)
+	    {
+	      e->id = id;
+	      __atomic_store_n (&t->slots[i], e, __ATOMIC_RELEASE);
+	    }
+	  return e;
+	}
+    }
+
+  return 0;
+}
+
+/* Add the counters in SRC to DST */
+static void
+table_merge (struct rpc_table *dst, struct rpc_table *src)
+{
+  struct rpc_entry *s, *d;
+  uint64_t max;
+  int i, j;
+
+  for (i = 0; i < RPC_SLOTS; i++)
+    {
+      s = __atomic_load_n (&src->slots[i], __ATOMIC_ACQUIRE);
+      if (!s || !LOAD (s->calls))
+	continue;
+
+      d = entry_get (dst, s->id);
+      if (!d)
+	continue;
+
+      d->calls += LOAD (s->calls);
+      d->errors += LOAD (s->errors);
+      d->total_ns += LOAD (s->total_ns);
+      max = LOAD (s->max_ns);
+      if (max > d->max_ns)
+	d->max_ns = max;
+      for (j = 0; j < RPC_BUCKETS; j++)
+	d->hist[j] += LOAD (s->hist[j]);
+    }
+}
+
+/* Zero the counters of T, keeping its entries */
+static void
+table_clear (struct rpc_table *t)
+{
+  mach_msg_id_t id;
+  int i;
+
+  for (i = 0; i < RPC_SLOTS; i++)
+    if (t->slots[i])
+      {
+	id = t->slots[i]->id;
+	memset (t->slots[i], 0, sizeof (struct rpc_entry));
+	t->slots[i]->id = id;
+      }
+}
+
+static void
+table_free (struct rpc_table *t)
+{
+  int i;
+
+  for (i = 0; i < RPC_SLOTS; i++)
+    free (t->slots[i]);
+}
+
+/* Hand the counters of an exiting thread to `retired' */
+static void
+thread_destroy (void *arg)
+{
+  struct rpc_table *t = arg, **p;
+
+  pthread_mutex_lock (&threads_lock);
+  for (p = &threads; *p; p = &(*p)->next)
+    if (*p == t)
+      {
+	*p = t->next;
+	break;
+      }
+  if (t->epoch == epoch)
+    table_merge (&retired, t);
+  pthread_mutex_unlock (&threads_lock);
+
+  table_free (t);
+  free (t);
+}
+
+static void
+thread_key_create (void)
+{
+  pthread_key_create (&thread_key, thread_destroy);
+}
+
+static struct rpc_table *
+thread_get (void)
+{
+  struct rpc_table *t;
+
+  if (self)
+    return self;
+
+  pthread_once (&thread_key_once, thread_key_create);
+
+  t = calloc (1, sizeof (struct rpc_table));
+  if (!t)
+    return 0;
+
+  if (pthread_setspecific (thread_key, t))
+    {
+      free (t);
+      return 0;
+    }
+
+  pthread_mutex_lock (&threads_lock);
+  t->epoch = epoch;
+  t->next = threads;
+  threads = t;
+  pthread_mutex_unlock (&threads_lock);
+
+  self = t;
+  return t;
+}
+
+void
+rpcstats_record (mach_msg_id_t id, kern_return_t retcode, uint64_t start)
+{
+  struct rpc_table *t;
+  struct rpc_entry *e;
+  uint64_t ns = rpcstats_now () - start;
+  unsigned int cur;
+
+  t = thread_get ();
+  if (!t)
+    return;
+
+  /* Counters were reset since this thread last counted */
+  cur = __atomic_load_n (&epoch, __ATOMIC_ACQUIRE);
+  if (t->epoch != cur)
+    {
+      table_clear (t);
+      __atomic_store_n (&t->epoch, cur, __ATOMIC_RELEASE);
+    }
+
+  e = entry_get (t, id);
+  if (!e)
+    return;
+
+  BUMP (e->calls, 1);
+  if (retcode != KERN_SUCCESS && retcode != MIG_NO_REPLY)
+    BUMP (e->errors, 1);
+  BUMP (e->total_ns, ns);
+  if (ns > e->max_ns)
+    __atomic_store_n (&e->max_ns, ns, __ATOMIC_RELAXED);
+  BUMP (e->hist[bucket (ns)], 1);
+}
+
+static int
+entry_cmp (const void *a, const void *b)
+{
+  const struct rpc_entry *x = *(struct rpc_entry **) a;
+  const struct rpc_entry *y = *(struct rpc_entry **) b;
+
+  return x->id < y->id ? -1 : x->id > y->id;
+}
+
+/* Lowest latency of the bucket holding the PERMILLE-th call */
+static uint64_t
+percentile (struct rpc_entry *e, unsigned int permille)
+{
+  uint64_t target, seen = 0;
+  int i;
+
+  target = (e->calls * permille + 999) / 1000;
+  for (i = 0; i < RPC_BUCKETS; i++)
+    {
+      seen += e->hist[i];
+      if (seen >= target)
+	return bucket_low (i);
+    }
+
+  return e->max_ns;
+}
+
+static void
+print_entry (FILE * f, struct rpc_entry *e)
+{
+  int i;
+
+  fprintf (f, "rpc.%d.calls %" PRIu64 "\n", e->id, e->calls);
+  fprintf (f, "rpc.%d.errors %" PRIu64 "\n", e->id, e->errors);
+  fprintf (f, "rpc.%d.total_ns %" PRIu64 "\n", e->id, e->total_ns);
+  fprintf (f, "rpc.%d.max_ns %" PRIu64 "\n", e->id, e->max_ns);
+  fprintf (f, "rpc.%d.p50_ns %" PRIu64 "\n", e->id, percentile (e, 500));
+  fprintf (f, "rpc.%d.p90_ns %" PRIu64 "\n", e->id, percentile (e, 900));
+  fprintf (f, "rpc.%d.p99_ns %" PRIu64 "\n", e->id, percentile (e, 990));
+  fprintf (f, "rpc.%d.p999_ns %" PRIu64 "\n", e->id, percentile (e, 999));
+
+  /* The histogram, by the lowest latency of each bucket */
+  for (i = 0; i < RPC_BUCKETS; i++)
+    if (e->hist[i])
+      fprintf (f, "rpc.%d.bucket.%" PRIu64 " %" PRIu32 "\n", e->id,
+	       bucket_low (i), e->hist[i]);
+}
+
+void
+rpcstats_print (FILE * f, int reset)
+{
+  struct rpc_table sum, *t;
+  struct rpc_entry *entries[RPC_SLOTS];
+  int i, n;
+
+  memset (&sum, 0, sizeof (sum));
+
+  pthread_mutex_lock (&threads_lock);
+  table_merge (&sum, &retired);
+  for (t = threads; t; t = t->next)
+    if (__atomic_load_n (&t->epoch, __ATOMIC_ACQUIRE) == epoch)
+      table_merge (&sum, t);
+
+  if (reset)
+    {
+      table_clear (&retired);
+      __atomic_add_fetch (&epoch, 1, __ATOMIC_RELEASE);
+    }
+  pthread_mutex_unlock (&threads_lock);
+
+  for (i = n = 0; i < RPC_SLOTS; i++)
+    if (sum.slots[i])
+      entries[n++] = sum.slots[i];
+  qsort (entries, n, sizeof (struct rpc_entry *), entry_cmp);
+
+  for (i = 0; i < n; i++)
+    print_entry (f, entries[i]);
+
+  table_free (&sum);
+}
+
+#endif /* LWIP_RPC_STATS */
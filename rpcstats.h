@@ -0,0 +1,63 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* RPC counters and latency histograms */
+
+#ifndef LWIP_RPCSTATS_H
+#define LWIP_RPCSTATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <mach.h>
+#include <mach/mig_errors.h>
+
+/* Build with -DLWIP_RPC_STATS=1 to count the RPCs */
+#ifndef LWIP_RPC_STATS
+#define LWIP_RPC_STATS  0
+#endif
+
+#if LWIP_RPC_STATS
+
+/* Different RPCs each thread can count */
+#define RPC_SLOTS       256
+
+/* Two bits of precision below each power of two, up to 2^40 ns */
+#define RPC_SUB_BITS    2
+#define RPC_BUCKETS     ((40 - RPC_SUB_BITS + 1) << RPC_SUB_BITS)
+
+static inline uint64_t
+rpcstats_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Count a call to ID which started at START and returned RETCODE */
+void rpcstats_record (mach_msg_id_t id, kern_return_t retcode,
+		      uint64_t start);
+
+/* Add the counters to the statistics in F, then clear them if RESET */
+void rpcstats_print (FILE * f, int reset);
+
+#endif /* LWIP_RPC_STATS */
+
+#endif /* LWIP_RPCSTATS_H */
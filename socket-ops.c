@@ -27,6 +27,85 @@
 
 #include <lwip/sockets.h>
 #include <lwip-hurd.h>
+#include <tcpinfo.h>
+
+/* Whether the connection from SOCKNO to PEER goes through the loopback */
+static int
+is_loopback_peer (int sockno, const struct sockaddr *peer)
+{
+  struct sockaddr_storage local;
+  socklen_t len = sizeof (local);
+  ip4_addr_t addr4;
+  ip6_addr_t addr6;
+
+  switch (peer->sa_family)
+    {
+    case AF_INET:
+      inet_addr_to_ip4addr (&addr4,
+			    &((struct sockaddr_in *) peer)->sin_addr);
+      if (ip4_addr_isloopback (&addr4))
+	return 1;
+      break;
+    case AF_INET6:
+      inet6_addr_to_ip6addr (&addr6,
+			     &((struct sockaddr_in6 *) peer)->sin6_addr);
+      if (ip6_addr_isloopback (&addr6))
+	return 1;
+      break;
+    default:
+      return 0;
+    }
+
+  /* Connections to our own addresses are looped back too */
+  if (lwip_getsockname (sockno, (struct sockaddr *) &local, &len)
+      || local.ss_family != peer->sa_family)
+    return 0;
+
+  if (peer->sa_family == AF_INET)
+    return !memcmp (&((struct sockaddr_in *) &local)->sin_addr,
+		    &((struct sockaddr_in *) peer)->sin_addr,
+		    sizeof (struct in_addr));
+  else
+    return !memcmp (&((struct sockaddr_in6 *) &local)->sin6_addr,
+		    &((struct sockaddr_in6 *) peer)->sin6_addr,
+		    sizeof (struct in6_addr));
+}
+
+/*
+ * Both ends of a local connection live in this stack, so holding small
+ * segments back for Nagle's algorithm only adds a delayed ACK of latency
+ * to every request and response.
+ */
+static void
+tune_local_connection (int sockno, const struct sockaddr *peer)
+{
+  int one = 1, type, saved_errno = errno;
+  socklen_t len = sizeof (type);
+
+  if (lwip_getsockopt (sockno, SOL_SOCKET, SO_TYPE, &type, &len) == 0
+      && type == SOCK_STREAM && is_loopback_peer (sockno, peer))
+    lwip_setsockopt (sockno, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+
+  errno = saved_errno;
+}
+
+/* Whether OPTION sizes a buffer of SOCKNO the tuner is in charge of */
+static int
+is_tuned_option (int sockno, int level, int option)
+{
+  int type, saved_errno = errno;
+  socklen_t len = sizeof (type);
+  int ret;
+
+  if (level != SOL_SOCKET || (option != SO_RCVBUF && option != SO_SNDBUF))
+    return 0;
+
+  ret = lwip_getsockopt (sockno, SOL_SOCKET, SO_TYPE, &type, &len) == 0
+    && type == SOCK_STREAM;
+
+  errno = saved_errno;
+  return ret;
+}
 
 error_t
 lwip_S_socket_create (struct trivfs_protid *master,
@@ -39,6 +118,7 @@ lwip_S_socket_create (struct trivfs_protid *master,
   struct socket *sock;
   int isroot;
   int domain;
+  uid_t owner;
 
   if (!master)
     return EOPNOTSUPP;
@@ -55,7 +135,7 @@ lwip_S_socket_create (struct trivfs_protid *master,
 
   sock = sock_alloc ();
   if (!sock)
-    return ENOMEM;
+    return errno;
 
   sock->sockno = lwip_socket (domain, sock_type, protocol);
   if (sock->sockno < 0)
@@ -77,6 +157,15 @@ lwip_S_socket_create (struct trivfs_protid *master,
 	isroot = 1;
     }
 
+  /* Its memory is accounted to the first effective uid */
+  owner = master->user->uids->num ? master->user->uids->ids[0] : -1;
+  err = tcptune_set_owner (sock->sockno, owner, isroot);
+  if (err)
+    {
+      sock_release (sock);
+      return err;
+    }
+
   user = make_sock_user (sock, isroot, 0, 1);
   *port = ports_get_right (user);
   *porttype = MACH_MSG_TYPE_MAKE_SEND;
@@ -118,7 +207,7 @@ lwip_S_socket_accept (struct sock_user * user,
 
   newsock = sock_alloc ();
   if (!newsock)
-    return ENOMEM;
+    return errno;
 
   addr_len = sizeof (addr);
   newsock->sockno =
@@ -130,6 +219,18 @@ lwip_S_socket_accept (struct sock_user * user,
     }
   else
     {
+      tune_local_connection (newsock->sockno, (struct sockaddr *) &addr);
+
+      /* The listener's owner is accepting it */
+      err = tcptune_set_owner (newsock->sockno,
+			       tcptune_get_owner (sock->sockno),
+			       user->isroot);
+      if (err)
+	{
+	  sock_release (newsock);
+	  return err;
+	}
+
       /* Set the peer's address for the caller */
       err =
 	lwip_S_socket_create_address (0, addr.ss_family, (void *) &addr,
@@ -157,6 +258,10 @@ lwip_S_socket_connect (struct sock_user * user, struct sock_addr * addr)
   err = lwip_connect (user->sock->sockno,
 		      &addr->address.sa, addr->address.sa.sa_len);
 
+  /* Also while in progress, the pcb is bound by now */
+  if (!err || errno == EINPROGRESS)
+    tune_local_connection (user->sock->sockno, &addr->address.sa);
+
   /* MiG should do this for us, but it doesn't. */
   if (!err)
     mach_port_deallocate (mach_task_self (), addr->pi.port_right);
@@ -249,11 +354,12 @@ lwip_S_socket_create_address (mach_port_t server,
       return EINVAL;
 
   err = ports_create_port (addrport_class, lwip_bucket,
-			   (offsetof (struct sock_addr, address)
-			    +data_len), &addrstruct);
+			   SOCK_ADDR_SIZE (data_len), &addrstruct);
   if (err)
     return err;
 
+  objstats_alloc (&sock_addr_stats);
+
   memcpy (&addrstruct->address.sa, data, data_len);
 
   /* BSD does not require incoming sa_len to be set, so we don't either.  */
@@ -313,6 +419,21 @@ lwip_S_socket_getopt (struct sock_user * user,
   if (!user)
     return EOPNOTSUPP;
 
+  /* TCP buffers are sized by the tuner */
+  if (is_tuned_option (user->sock->sockno, level, option))
+    {
+      if (*datalen < sizeof (int))
+	return EINVAL;
+
+      *(int *) *data = tcptune_get_bufsize (user->sock->sockno, option);
+      *datalen = sizeof (int);
+      return 0;
+    }
+
+  /* LwIP doesn't know TCP_INFO */
+  if (level == IPPROTO_TCP && option == TCP_INFO)
+    return tcpinfo_getopt (user->sock->sockno, *data, datalen);
+
   int len = *datalen;
   lwip_getsockopt (user->sock->sockno, level, option, *data,
 		   (socklen_t *) & len);
@@ -328,6 +449,15 @@ lwip_S_socket_setopt (struct sock_user * user,
   if (!user)
     return EOPNOTSUPP;
 
+  if (is_tuned_option (user->sock->sockno, level, option))
+    {
+      if (datalen < sizeof (int) || *(int *) data < 0)
+	return EINVAL;
+
+      return tcptune_set_bufsize (user->sock->sockno, option,
+				  *(int *) data);
+    }
+
   lwip_setsockopt (user->sock->sockno, level, option, data, datalen);
 
   return errno;
@@ -0,0 +1,408 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Statistics */
+
+#include <stats.h>
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <fcntl.h>
+#include <net/if_arp.h>
+
+#include <lwip/stats.h>
+#include <lwip/memp.h>
+#include <lwip/tcpip.h>
+#include <lwip/priv/tcpip_priv.h>
+
+#include <lwip-hurd.h>
+#include <trivfs-ops.h>
+#include <ifreg.h>
+#include <tcptune.h>
+#include <rpcstats.h>
+#include <capture.h>
+#include <netif/ifcommon.h>
+#include <netif/hurdtunif.h>
+#include <netif/neighcache.h>
+
+/*
+ * The snapshot is built when the node is opened, and read from the
+ * open like a regular file. Names are stable, new counters are only
+ * ever added. Protocol counters are LwIP's own, and only present when
+ * it's built with LWIP_STATS.
+ *
+ * Opening it for writing too resets the counters of events right after
+ * taking the snapshot: LwIP's protocol counters and allocation errors,
+ * the traffic of the interfaces, the tunnel queues, the pool fallbacks,
+ * the neighbour cache, the memory pressure events, the capture and the
+ * RPCs. The high-water marks of the tunnel queues start over from what's
+ * queued. Those telling the current state are kept: what's used and
+ * available, live objects, peaks, sizes, limits and sessions. Events
+ * counted between the snapshot and the reset are lost. The node isn't
+ * writable, so only root can.
+ */
+
+__thread unsigned int stats_thread_shard;
+static unsigned int next_shard;
+
+char *stats_node_path;
+
+static struct port_class *stats_cntlclass;
+static struct port_class *stats_class;
+
+unsigned int
+stats_new_shard (void)
+{
+  return __atomic_fetch_add (&next_shard, 1, __ATOMIC_RELAXED)
+    % STATS_SHARDS + 1;
+}
+
+#if LWIP_STATS
+#if MEMP_STATS
+/* Names of the pools */
+static const char *memp_names[] = {
+#define LWIP_MEMPOOL(name,num,size,desc) #name,
+#include <lwip/priv/memp_std.h>
+};
+#endif
+
+struct lwip_stats_msg
+{
+  struct tcpip_api_call_data call;
+  int reset;
+  struct stats_ stats;
+#if MEMP_STATS
+  struct stats_mem memp[MEMP_MAX];
+#endif
+};
+
+/* Set LwIP's counters of events back to 0, the gauges are kept */
+static void
+reset_lwip (void)
+{
+#if MEMP_STATS
+  int i;
+
+  for (i = 0; i < MEMP_MAX; i++)
+    lwip_stats.memp[i]->err = 0;
+#endif
+
+#if LINK_STATS
+  memset (&lwip_stats.link, 0, sizeof (struct stats_proto));
+#endif
+#if ETHARP_STATS
+  memset (&lwip_stats.etharp, 0, sizeof (struct stats_proto));
+#endif
+#if IP_STATS
+  memset (&lwip_stats.ip, 0, sizeof (struct stats_proto));
+#endif
+#if IPFRAG_STATS
+  memset (&lwip_stats.ip_frag, 0, sizeof (struct stats_proto));
+#endif
+#if ICMP_STATS
+  memset (&lwip_stats.icmp, 0, sizeof (struct stats_proto));
+#endif
+#if UDP_STATS
+  memset (&lwip_stats.udp, 0, sizeof (struct stats_proto));
+#endif
+#if TCP_STATS
+  memset (&lwip_stats.tcp, 0, sizeof (struct stats_proto));
+#endif
+#if IP6_STATS
+  memset (&lwip_stats.ip6, 0, sizeof (struct stats_proto));
+#endif
+#if ICMP6_STATS
+  memset (&lwip_stats.icmp6, 0, sizeof (struct stats_proto));
+#endif
+#if ND6_STATS
+  memset (&lwip_stats.nd6, 0, sizeof (struct stats_proto));
+#endif
+#if MEM_STATS
+  lwip_stats.mem.err = 0;
+#endif
+}
+
+/* Copy LwIP's counters, then reset them if asked, from the tcpip
+   thread */
+static err_t
+do_copy_stats (struct tcpip_api_call_data *call)
+{
+  struct lwip_stats_msg *msg = (struct lwip_stats_msg *) call;
+#if MEMP_STATS
+  int i;
+
+  for (i = 0; i < MEMP_MAX; i++)
+    msg->memp[i] = *lwip_stats.memp[i];
+#endif
+
+  msg->stats = lwip_stats;
+
+  if (msg->reset)
+    reset_lwip ();
+
+  return ERR_OK;
+}
+
+static void
+print_proto (FILE * f, const char *name, struct stats_proto *p)
+{
+  fprintf (f, "proto.%s.xmit %lu\n", name, (unsigned long) p->xmit);
+  fprintf (f, "proto.%s.recv %lu\n", name, (unsigned long) p->recv);
+  fprintf (f, "proto.%s.fw %lu\n", name, (unsigned long) p->fw);
+  fprintf (f, "proto.%s.drop %lu\n", name, (unsigned long) p->drop);
+  fprintf (f, "proto.%s.chkerr %lu\n", name, (unsigned long) p->chkerr);
+  fprintf (f, "proto.%s.lenerr %lu\n", name, (unsigned long) p->lenerr);
+  fprintf (f, "proto.%s.memerr %lu\n", name, (unsigned long) p->memerr);
+  fprintf (f, "proto.%s.rterr %lu\n", name, (unsigned long) p->rterr);
+  fprintf (f, "proto.%s.proterr %lu\n", name, (unsigned long) p->proterr);
+  fprintf (f, "proto.%s.opterr %lu\n", name, (unsigned long) p->opterr);
+  fprintf (f, "proto.%s.err %lu\n", name, (unsigned long) p->err);
+}
+
+static void
+print_mem (FILE * f, const char *name, struct stats_mem *m)
+{
+  fprintf (f, "%s.avail %lu\n", name, (unsigned long) m->avail);
+  fprintf (f, "%s.used %lu\n", name, (unsigned long) m->used);
+  fprintf (f, "%s.max %lu\n", name, (unsigned long) m->max);
+  fprintf (f, "%s.err %lu\n", name, (unsigned long) m->err);
+}
+
+static void
+print_lwip (FILE * f, int reset)
+{
+  struct lwip_stats_msg msg;
+#if MEMP_STATS
+  char name[64];
+  int i;
+#endif
+
+  msg.reset = reset;
+  tcpip_api_call (do_copy_stats, &msg.call);
+
+#if LINK_STATS
+  print_proto (f, "link", &msg.stats.link);
+#endif
+#if ETHARP_STATS
+  print_proto (f, "etharp", &msg.stats.etharp);
+#endif
+#if IP_STATS
+  print_proto (f, "ip", &msg.stats.ip);
+#endif
+#if IPFRAG_STATS
+  print_proto (f, "ip_frag", &msg.stats.ip_frag);
+#endif
+#if ICMP_STATS
+  print_proto (f, "icmp", &msg.stats.icmp);
+#endif
+#if UDP_STATS
+  print_proto (f, "udp", &msg.stats.udp);
+#endif
+#if TCP_STATS
+  print_proto (f, "tcp", &msg.stats.tcp);
+#endif
+#if IP6_STATS
+  print_proto (f, "ip6", &msg.stats.ip6);
+#endif
+#if ICMP6_STATS
+  print_proto (f, "icmp6", &msg.stats.icmp6);
+#endif
+#if ND6_STATS
+  print_proto (f, "nd6", &msg.stats.nd6);
+#endif
+#if MEM_STATS
+  print_mem (f, "heap", &msg.stats.mem);
+#endif
+#if MEMP_STATS
+  for (i = 0; i < MEMP_MAX; i++)
+    {
+      snprintf (name, sizeof (name), "memp.%s", memp_names[i]);
+      print_mem (f, name, &msg.memp[i]);
+    }
+#endif
+}
+#else
+static void
+print_lwip (FILE * f, int reset)
+{
+}
+#endif
+
+/* Print the queue counters of the tunnel NETIF */
+static void
+print_tunnel (FILE * f, const char *name, struct netif *netif, int reset)
+{
+  struct tunqueue_stats s;
+  uint32_t len, bytes;
+
+  hurdtunif_get_queue_stats (netif, &s, &len, &bytes);
+
+  fprintf (f, "tun.%s.len %u\n", name, len);
+  fprintf (f, "tun.%s.bytes %u\n", name, bytes);
+  fprintf (f, "tun.%s.max_len %u\n", name, s.max_len);
+  fprintf (f, "tun.%s.max_bytes %u\n", name, s.max_bytes);
+  fprintf (f, "tun.%s.enqueued %" PRIu64 "\n", name, s.enqueued);
+  fprintf (f, "tun.%s.dequeued %" PRIu64 "\n", name, s.dequeued);
+  fprintf (f, "tun.%s.tail_drops %" PRIu64 "\n", name, s.tail_drops);
+  fprintf (f, "tun.%s.head_drops %" PRIu64 "\n", name, s.head_drops);
+  fprintf (f, "tun.%s.codel_drops %" PRIu64 "\n", name, s.codel_drops);
+
+  if (reset)
+    hurdtunif_reset_queue_stats (netif);
+}
+
+static void
+print_ifs (FILE * f, int reset)
+{
+  struct ifsnapshot *snap;
+  struct ifstats s;
+  const char *name;
+  size_t n;
+
+  snap = ifreg_get ();
+  for (n = 0; n < snap->num; n++)
+    {
+      name = netif_get_state (snap->netifs[n])->devname;
+      if_get_stats (snap->netifs[n], &s);
+
+      fprintf (f, "if.%s.rx_packets %" PRIu64 "\n", name, s.rx_packets);
+      fprintf (f, "if.%s.rx_bytes %" PRIu64 "\n", name, s.rx_bytes);
+      fprintf (f, "if.%s.rx_drops %" PRIu64 "\n", name, s.rx_drops);
+      fprintf (f, "if.%s.tx_packets %" PRIu64 "\n", name, s.tx_packets);
+      fprintf (f, "if.%s.tx_bytes %" PRIu64 "\n", name, s.tx_bytes);
+      fprintf (f, "if.%s.tx_drops %" PRIu64 "\n", name, s.tx_drops);
+
+      if (reset)
+	if_reset_stats (snap->netifs[n]);
+
+      if (netif_get_state (snap->netifs[n])->type == ARPHRD_TUNNEL)
+	print_tunnel (f, name, snap->netifs[n], reset);
+    }
+  ifreg_put (snap);
+
+  fprintf (f, "pbuf.pool_fallbacks %" PRIu64 "\n",
+	   __atomic_load_n (&if_pool_fallbacks, __ATOMIC_RELAXED));
+  if (reset)
+    __atomic_store_n (&if_pool_fallbacks, 0, __ATOMIC_RELAXED);
+}
+
+static void
+print_objstats (FILE * f, const char *name, struct objstats *s)
+{
+  struct objstats copy;
+
+  objstats_get (s, &copy);
+  fprintf (f, "%s.allocs %" PRIu64 "\n", name, copy.allocs);
+  fprintf (f, "%s.frees %" PRIu64 "\n", name, copy.frees);
+  fprintf (f, "%s.live %" PRIu64 "\n", name, copy.allocs - copy.frees);
+  fprintf (f, "%s.peak %" PRIu64 "\n", name, copy.peak);
+}
+
+static void
+print_translator (FILE * f, int reset)
+{
+  struct neighcache_stats neigh;
+  struct tcptune_stats tune;
+  struct capture_stats capture;
+
+  print_objstats (f, "sockets", &socket_cache.stats);
+  fprintf (f, "sockets.max %u\n",
+	   __atomic_load_n (&lwip_max_sockets, __ATOMIC_RELAXED));
+  fprintf (f, "sockets.slab_bytes %zu\n",
+	   __atomic_load_n (&socket_cache.slab_bytes, __ATOMIC_RELAXED));
+  print_objstats (f, "ports.socket", &sock_user_stats);
+  print_objstats (f, "ports.address", &sock_addr_stats);
+
+  neighcache_get_stats (&neigh);
+  fprintf (f, "neigh.size %u\n", neighcache_get_size ());
+  fprintf (f, "neigh.hits %" PRIu64 "\n", neigh.hits);
+  fprintf (f, "neigh.misses %" PRIu64 "\n", neigh.misses);
+  fprintf (f, "neigh.evictions %" PRIu64 "\n", neigh.evictions);
+  fprintf (f, "neigh.expirations %" PRIu64 "\n", neigh.expirations);
+
+  tcptune_get_stats (&tune);
+  fprintf (f, "tcpmem.used %" PRIu64 "\n", tune.mem);
+  fprintf (f, "tcpmem.limit %u\n",
+	   __atomic_load_n (&tcptune_mem_limit, __ATOMIC_RELAXED));
+  fprintf (f, "tcpmem.user_limit %u\n",
+	   __atomic_load_n (&tcptune_user_limit, __ATOMIC_RELAXED));
+  fprintf (f, "tcpmem.pressure %d\n", tune.pressure);
+  fprintf (f, "tcpmem.pressure_events %" PRIu64 "\n", tune.pressure_events);
+  fprintf (f, "tcpmem.prunes %" PRIu64 "\n", tune.prunes);
+  fprintf (f, "tcpmem.aborts %" PRIu64 "\n", tune.aborts);
+
+  capture_get_stats (&capture);
+  fprintf (f, "capture.sessions %u\n",
+	   __atomic_load_n (&capture_sessions, __ATOMIC_RELAXED));
+  fprintf (f, "capture.packets %" PRIu64 "\n", capture.packets);
+  fprintf (f, "capture.captured %" PRIu64 "\n", capture.captured);
+  fprintf (f, "capture.drops %" PRIu64 "\n", capture.drops);
+
+  if (reset)
+    {
+      neighcache_reset_stats ();
+      tcptune_reset_stats ();
+      capture_reset_stats ();
+    }
+}
+
+/* Print a new snapshot to F, then reset what can be if PO can write */
+static error_t
+print_stats (FILE * f, struct trivfs_peropen *po)
+{
+  int reset = po->openmodes & O_WRITE;
+
+  print_lwip (f, reset);
+  print_ifs (f, reset);
+  print_translator (f, reset);
+#if LWIP_RPC_STATS
+  rpcstats_print (f, reset);
+#endif
+
+  return 0;
+}
+
+error_t
+stats_node_create (const char *path)
+{
+  return trivfs_node_create (path, 0444, stats_cntlclass, stats_class,
+			     &stats_node_path);
+}
+
+static error_t
+stats_po_create (struct trivfs_peropen *po)
+{
+  return trivfs_snapshot_create (po, print_stats);
+}
+
+static const struct trivfs_node_ops stats_ops = {
+  .po_create = stats_po_create,
+  .po_destroy = trivfs_snapshot_destroy,
+  .modify_stat = trivfs_snapshot_modify_stat,
+  .read = trivfs_snapshot_read,
+  .readable = trivfs_snapshot_readable,
+  .seek = trivfs_snapshot_seek,
+};
+
+error_t
+stats_module_init (void)
+{
+  return trivfs_node_register (&stats_cntlclass, &stats_class, &stats_ops);
+}
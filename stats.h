@@ -0,0 +1,79 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Statistics */
+
+#ifndef LWIP_STATS_H
+#define LWIP_STATS_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <hurd/trivfs.h>
+
+/*
+ * Counters updated from several threads are kept in shards, arrays of
+ * STATS_SHARDS structures of one cache line each. Every thread adds to
+ * its own shard, and readers add them all up.
+ */
+#define STATS_SHARDS    8
+#define STATS_LINE      64
+
+/* Shard of the calling thread plus one, 0 until it's got one */
+extern __thread unsigned int stats_thread_shard;
+unsigned int stats_new_shard (void);
+
+static inline unsigned int
+stats_shard (void)
+{
+  if (!stats_thread_shard)
+    stats_thread_shard = stats_new_shard ();
+
+  return stats_thread_shard - 1;
+}
+
+#define STATS_ADD(shards, field, n) \
+  __atomic_add_fetch (&(shards)[stats_shard ()].field, (n), __ATOMIC_RELAXED)
+
+#define STATS_SUM(shards, field)					\
+  ({ uint64_t __sum = 0; unsigned int __i;				\
+     for (__i = 0; __i < STATS_SHARDS; __i++)				\
+       __sum += __atomic_load_n (&(shards)[__i].field, __ATOMIC_RELAXED);	\
+     __sum; })
+
+#define STATS_CLEAR(shards, field)					\
+  ({ unsigned int __i;							\
+     for (__i = 0; __i < STATS_SHARDS; __i++)				\
+       __atomic_store_n (&(shards)[__i].field, 0, __ATOMIC_RELAXED); })
+
+/*
+ * The statistics node. Every open gets a snapshot of all the counters,
+ * one "name value" line each. Opens for writing then reset the ones
+ * that count events, but not those telling the current state, like
+ * what's in use, peaks, sizes and limits.
+ */
+error_t stats_module_init (void);
+
+/* Serve the statistics on PATH */
+error_t stats_node_create (const char *path);
+
+/* Where they're served, or NULL */
+extern char *stats_node_path;
+
+#endif /* LWIP_STATS_H */
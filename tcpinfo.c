@@ -0,0 +1,361 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* TCP connection information */
+
+#include <tcpinfo.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include <lwip/sockets.h>
+#include <lwip/tcp.h>
+#include <lwip/tcpip.h>
+#include <lwip/api.h>
+#include <lwip/netif.h>
+#include <lwip/priv/tcp_priv.h>
+#include <lwip/priv/tcpip_priv.h>
+
+#include <lwip-hurd.h>
+#include <trivfs-ops.h>
+#include <tcptune.h>
+
+/*
+ * Everything comes from the connection's control block, read in the
+ * tcpip thread. LwIP measures times in slow timer ticks, so RTTs have
+ * that granularity. It doesn't count retransmissions over the life of a
+ * connection, nor pace, so the total is the current retransmission
+ * count and the pacing rate is what the congestion window allows: one
+ * window per RTT.
+ */
+
+/* A line of the table */
+struct conn
+{
+  ip_addr_t local_ip, remote_ip;
+  uint16_t local_port, remote_port;
+  uint8_t state;
+  int sockno;
+  uid_t owner;
+  uint32_t cwnd, ssthresh;
+  uint32_t snd_wnd, rcv_wnd;
+  uint32_t snd_queue;		/* Bytes written and not acknowledged */
+  uint32_t rcv_queue;		/* Bytes received and not read */
+  struct tcpinfo ti;
+};
+
+char *tcpinfo_node_path;
+
+static struct port_class *tcpinfo_cntlclass;
+static struct port_class *tcpinfo_class;
+
+static const char *state_names[] = {
+  "CLOSED", "LISTEN", "SYN_SENT", "SYN_RCVD", "ESTABLISHED",
+  "FIN_WAIT_1", "FIN_WAIT_2", "CLOSE_WAIT", "CLOSING", "LAST_ACK",
+  "TIME_WAIT",
+};
+
+/* The same states, as TCP_INFO names them */
+static const uint8_t info_states[] = {
+  TCP_CLOSE, TCP_LISTEN, TCP_SYN_SENT, TCP_SYN_RECV, TCP_ESTABLISHED,
+  TCP_FIN_WAIT1, TCP_FIN_WAIT2, TCP_CLOSE_WAIT, TCP_CLOSING, TCP_LAST_ACK,
+  TCP_TIME_WAIT,
+};
+
+/* Socket of a control block, or -1 when not accepted yet or closed */
+static int
+pcb_sockno (void *callback_arg)
+{
+  struct netconn *conn = callback_arg;
+
+  return conn && conn->socket >= 0 ? conn->socket : -1;
+}
+
+/* Fill TI with what PCB looks like */
+static void
+fill_info (struct tcp_pcb *pcb, struct tcpinfo *ti)
+{
+  struct tcp_info *info = &ti->info;
+  struct tcp_seg *seg;
+  struct netif *netif;
+  uint32_t mss = pcb->mss ? pcb->mss : 1;
+
+  memset (ti, 0, sizeof (*ti));
+
+  info->tcpi_state = info_states[pcb->state];
+  if (pcb->flags & TF_INFR)
+    info->tcpi_ca_state = TCP_CA_Recovery;
+  else if (pcb->nrtx)
+    info->tcpi_ca_state = TCP_CA_Loss;
+  else
+    info->tcpi_ca_state = TCP_CA_Open;
+  info->tcpi_retransmits = pcb->nrtx;
+  info->tcpi_probes =
+    pcb->persist_probe ? pcb->persist_probe : pcb->keep_cnt_sent;
+  info->tcpi_backoff = pcb->nrtx;
+
+#if LWIP_TCP_TIMESTAMPS
+  if (pcb->flags & TF_TIMESTAMP)
+    info->tcpi_options |= TCPI_OPT_TIMESTAMPS;
+#endif
+#if LWIP_TCP_SACK_OUT
+  if (pcb->flags & TF_SACK)
+    info->tcpi_options |= TCPI_OPT_SACK;
+#endif
+#if LWIP_WND_SCALE
+  if (pcb->flags & TF_WND_SCALE)
+    {
+      info->tcpi_options |= TCPI_OPT_WSCALE;
+      info->tcpi_snd_wscale = pcb->snd_scale;
+      info->tcpi_rcv_wscale = pcb->rcv_scale;
+    }
+#endif
+
+  /* Timers are in microseconds, ages in milliseconds */
+  info->tcpi_rto = pcb->rto * TCP_SLOW_INTERVAL * 1000;
+  info->tcpi_ato = TCP_FAST_INTERVAL * 1000;
+  info->tcpi_last_data_recv = (tcp_ticks - pcb->tmr) * TCP_SLOW_INTERVAL;
+  info->tcpi_last_ack_recv = info->tcpi_last_data_recv;
+  info->tcpi_rtt = (pcb->sa >> 3) * TCP_SLOW_INTERVAL * 1000;
+  info->tcpi_rttvar = (pcb->sv >> 2) * TCP_SLOW_INTERVAL * 1000;
+
+  info->tcpi_snd_mss = pcb->mss;
+  info->tcpi_rcv_mss = pcb->mss;
+  info->tcpi_advmss = pcb->mss;
+  for (seg = pcb->unacked; seg; seg = seg->next)
+    info->tcpi_unacked++;
+
+  netif = netif_get_by_index (pcb->netif_idx);
+  if (netif)
+    info->tcpi_pmtu = netif->mtu;
+
+  /* Windows are in segments */
+  info->tcpi_snd_ssthresh = pcb->ssthresh / mss;
+  info->tcpi_snd_cwnd = pcb->cwnd / mss;
+  info->tcpi_rcv_ssthresh = pcb->rcv_ann_wnd;
+  info->tcpi_rcv_space = pcb->rcv_wnd;
+  info->tcpi_reordering = 3;
+  info->tcpi_total_retrans = pcb->nrtx;
+
+  if (info->tcpi_rtt)
+    ti->pacing_rate = (uint64_t) pcb->cwnd * 1000000 / info->tcpi_rtt;
+  ti->max_pacing_rate = UINT64_MAX;
+  ti->notsent_bytes = pcb->snd_lbb - pcb->snd_nxt;
+}
+
+struct info_msg
+{
+  struct tcpip_api_call_data call;
+  int sockno;
+  struct tcpinfo ti;
+};
+
+/* Find the connection of the socket, from the tcpip thread */
+static err_t
+do_get_info (struct tcpip_api_call_data *call)
+{
+  struct info_msg *msg = (struct info_msg *) call;
+  struct tcp_pcb *pcb;
+  struct tcp_pcb_listen *lpcb;
+
+  for (pcb = tcp_active_pcbs; pcb; pcb = pcb->next)
+    if (pcb_sockno (pcb->callback_arg) == msg->sockno)
+      {
+	fill_info (pcb, &msg->ti);
+	return ERR_OK;
+      }
+
+  for (lpcb = tcp_listen_pcbs.listen_pcbs; lpcb; lpcb = lpcb->next)
+    if (pcb_sockno (lpcb->callback_arg) == msg->sockno)
+      {
+	msg->ti.info.tcpi_state = TCP_LISTEN;
+	return ERR_OK;
+      }
+
+  /* Not connected yet, or not any more */
+  msg->ti.info.tcpi_state = TCP_CLOSE;
+
+  return ERR_OK;
+}
+
+error_t
+tcpinfo_getopt (int sockno, char *data, size_t * datalen)
+{
+  struct info_msg msg;
+  int type;
+  socklen_t len = sizeof (type);
+
+  if (lwip_getsockopt (sockno, SOL_SOCKET, SO_TYPE, &type, &len))
+    return errno;
+  if (type != SOCK_STREAM)
+    return ENOPROTOOPT;
+
+  memset (&msg.ti, 0, sizeof (msg.ti));
+  msg.sockno = sockno;
+  tcpip_api_call (do_get_info, &msg.call);
+
+  if (*datalen > sizeof (msg.ti))
+    *datalen = sizeof (msg.ti);
+  memcpy (data, &msg.ti, *datalen);
+
+  return 0;
+}
+
+struct table_msg
+{
+  struct tcpip_api_call_data call;
+  struct conn *conns;
+  size_t num;
+};
+
+static void
+add_conn (struct table_msg *msg, struct tcp_pcb *pcb)
+{
+  struct conn *c = &msg->conns[msg->num++];
+
+  ip_addr_copy (c->local_ip, pcb->local_ip);
+  ip_addr_copy (c->remote_ip, pcb->remote_ip);
+  c->local_port = pcb->local_port;
+  c->remote_port = pcb->remote_port;
+  c->state = pcb->state;
+  c->sockno = pcb_sockno (pcb->callback_arg);
+  c->owner = tcptune_get_owner (c->sockno);
+  c->cwnd = pcb->cwnd;
+  c->ssthresh = pcb->ssthresh;
+  c->snd_wnd = pcb->snd_wnd;
+  c->rcv_wnd = pcb->rcv_ann_wnd;
+  c->snd_queue = pcb->snd_lbb - pcb->lastack;
+  c->rcv_queue = tcptune_get_unread (c->sockno, pcb);
+  if (pcb->refused_data)
+    c->rcv_queue += pcb->refused_data->tot_len;
+  fill_info (pcb, &c->ti);
+}
+
+/* Copy every connection, from the tcpip thread */
+static err_t
+do_copy_table (struct tcpip_api_call_data *call)
+{
+  struct table_msg *msg = (struct table_msg *) call;
+  struct tcp_pcb *pcb;
+  struct tcp_pcb_listen *lpcb;
+  struct conn *c;
+  size_t num = 0;
+
+  for (lpcb = tcp_listen_pcbs.listen_pcbs; lpcb; lpcb = lpcb->next)
+    num++;
+  for (pcb = tcp_active_pcbs; pcb; pcb = pcb->next)
+    num++;
+  for (pcb = tcp_tw_pcbs; pcb; pcb = pcb->next)
+    num++;
+
+  msg->num = 0;
+  msg->conns = calloc (num ? num : 1, sizeof (struct conn));
+  if (!msg->conns)
+    return ERR_MEM;
+
+  for (lpcb = tcp_listen_pcbs.listen_pcbs; lpcb; lpcb = lpcb->next)
+    {
+      c = &msg->conns[msg->num++];
+      ip_addr_copy (c->local_ip, lpcb->local_ip);
+      ip_addr_set_zero (&c->remote_ip);
+      c->local_port = lpcb->local_port;
+      c->state = LISTEN;
+      c->sockno = pcb_sockno (lpcb->callback_arg);
+      c->owner = tcptune_get_owner (c->sockno);
+      c->ti.info.tcpi_state = TCP_LISTEN;
+    }
+  for (pcb = tcp_active_pcbs; pcb; pcb = pcb->next)
+    add_conn (msg, pcb);
+  for (pcb = tcp_tw_pcbs; pcb; pcb = pcb->next)
+    add_conn (msg, pcb);
+
+  return ERR_OK;
+}
+
+static void
+print_conn (FILE * f, struct conn *c)
+{
+  char local[IPADDR_STRLEN_MAX], remote[IPADDR_STRLEN_MAX];
+  struct tcp_info *info = &c->ti.info;
+
+  ipaddr_ntoa_r (&c->local_ip, local, sizeof local);
+  ipaddr_ntoa_r (&c->remote_ip, remote, sizeof remote);
+
+  fprintf (f, "%d %d %s %u %s %u %s %u %u %u %u %u %u %u %u %u %u %u %u %u"
+	   "\n", c->sockno, (int) c->owner, local, c->local_port, remote,
+	   c->remote_port, state_names[c->state], c->snd_queue,
+	   c->rcv_queue, c->ti.notsent_bytes, info->tcpi_unacked,
+	   info->tcpi_rtt, info->tcpi_rttvar, info->tcpi_rto / 1000,
+	   c->cwnd, c->ssthresh, c->snd_wnd, c->rcv_wnd, info->tcpi_snd_mss,
+	   info->tcpi_retransmits);
+}
+
+/* Print a new snapshot to F */
+static error_t
+print_tcpinfo (FILE * f, struct trivfs_peropen *po)
+{
+  struct table_msg msg;
+  size_t i;
+  err_t lerr;
+
+  lerr = tcpip_api_call (do_copy_table, &msg.call);
+  if (lerr != ERR_OK)
+    return ENOMEM;
+
+  fprintf (f, "sockno uid local_address local_port remote_address"
+	   " remote_port state snd_queue rcv_queue notsent unacked rtt_us"
+	   " rttvar_us rto_ms cwnd ssthresh snd_wnd rcv_wnd mss"
+	   " retransmits\n");
+  for (i = 0; i < msg.num; i++)
+    print_conn (f, &msg.conns[i]);
+
+  free (msg.conns);
+
+  return 0;
+}
+
+error_t
+tcpinfo_node_create (const char *path)
+{
+  return trivfs_node_create (path, 0444, tcpinfo_cntlclass, tcpinfo_class,
+			     &tcpinfo_node_path);
+}
+
+static error_t
+tcpinfo_po_create (struct trivfs_peropen *po)
+{
+  return trivfs_snapshot_create (po, print_tcpinfo);
+}
+
+static const struct trivfs_node_ops tcpinfo_ops = {
+  .po_create = tcpinfo_po_create,
+  .po_destroy = trivfs_snapshot_destroy,
+  .modify_stat = trivfs_snapshot_modify_stat,
+  .read = trivfs_snapshot_read,
+  .readable = trivfs_snapshot_readable,
+  .seek = trivfs_snapshot_seek,
+};
+
+error_t
+tcpinfo_module_init (void)
+{
+  return trivfs_node_register (&tcpinfo_cntlclass, &tcpinfo_class, &tcpinfo_ops);
+}
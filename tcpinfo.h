@@ -0,0 +1,64 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* TCP connection information */
+
+#ifndef LWIP_TCPINFO_H
+#define LWIP_TCPINFO_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <netinet/tcp.h>
+#include <hurd/trivfs.h>
+
+/*
+ * What TCP_INFO returns: the GNU structure, then the fields Linux has
+ * after it, at the same offsets, up to tcpi_min_rtt. Those LwIP doesn't
+ * keep are 0. Callers get as much of it as they ask for.
+ */
+struct tcpinfo
+{
+  struct tcp_info info;
+  uint64_t pacing_rate;		/* Bytes per second */
+  uint64_t max_pacing_rate;	/* Always unlimited */
+  uint64_t bytes_acked;		/* Not counted */
+  uint64_t bytes_received;	/* Not counted */
+  uint32_t segs_out;		/* Not counted */
+  uint32_t segs_in;		/* Not counted */
+  uint32_t notsent_bytes;	/* Bytes written and not sent */
+  uint32_t min_rtt;		/* Not kept */
+};
+
+/* Get the TCP_INFO of SOCKNO into DATA, of *DATALEN bytes at most */
+error_t tcpinfo_getopt (int sockno, char *data, size_t * datalen);
+
+/*
+ * The connections node. Every open gets a snapshot of the TCP
+ * connections, one line each after a header naming the fields.
+ */
+error_t tcpinfo_module_init (void);
+
+/* Serve the connections on PATH */
+error_t tcpinfo_node_create (const char *path);
+
+/* Where they're served, or NULL */
+extern char *tcpinfo_node_path;
+
+#endif /* LWIP_TCPINFO_H */
@@ -0,0 +1,789 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* TCP event tracing */
+
+#include <tcptrace.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <hurd.h>
+#include <hurd/idvec.h>
+#include <hurd/ihash.h>
+
+#include <lwip/sys.h>
+#include <lwip/tcp.h>
+#include <lwip/tcpip.h>
+#include <lwip/prot/tcp.h>
+#include <lwip/priv/tcp_priv.h>
+#include <lwip/priv/tcpip_priv.h>
+
+#include <lwip-hurd.h>
+#include <trivfs-ops.h>
+#include <lwiphooks.h>
+
+/*
+ * LwIP has no tracepoints, so events are found by comparing what each
+ * connection looks like with what it looked like before: when a segment
+ * comes in for it, when one goes out, and every TCPTRACE_INTERVAL_MS.
+ * That needs LwIP built with the TCP hooks in lwiphooks.h, otherwise
+ * only the periodic look finds them.
+ *
+ * All of TCP runs in the tcpip thread, so the ring has a single writer
+ * and needs no locking. Readers copy from it in the tcpip thread too.
+ */
+
+enum tcptrace_type
+{
+  EV_STATE,			/* State change */
+  EV_CWND,			/* Congestion window or threshold update */
+  EV_RETRANSMIT,		/* Segment sent again */
+  EV_FAST_RECOVERY,		/* Three duplicate acks */
+  EV_RTO,			/* Retransmission timer fired */
+  EV_ZERO_WINDOW,		/* The peer can't take more */
+  EV_WINDOW_OPEN,
+  EV_RCV_ZERO_WINDOW,		/* We can't take more, nobody reads */
+  EV_RCV_WINDOW_OPEN,
+  EV_CLOSED,			/* The connection is gone */
+};
+
+static const char *type_names[] = {
+  "state", "cwnd", "retransmit", "fast_recovery", "rto",
+  "zero_window", "window_open", "rcv_zero_window", "rcv_window_open",
+  "closed",
+};
+
+static const char *state_names[] = {
+  "CLOSED", "LISTEN", "SYN_SENT", "SYN_RCVD", "ESTABLISHED",
+  "FIN_WAIT_1", "FIN_WAIT_2", "CLOSE_WAIT", "CLOSING", "LAST_ACK",
+  "TIME_WAIT",
+};
+
+/* Identity of a connection */
+struct tuple
+{
+  ip_addr_t local_ip, remote_ip;
+  uint16_t local_port, remote_port;
+};
+
+struct tcptrace_event
+{
+  uint64_t time;		/* Microseconds since the epoch */
+  struct tuple tuple;
+  uint8_t type;
+  uint8_t state, old_state;
+  uint32_t seqno;		/* Retransmitted sequence number */
+  uint32_t cwnd, ssthresh;
+  uint32_t snd_wnd, rcv_wnd;
+  uint32_t srtt_ms, rto_ms;
+  uint8_t nrtx;
+};
+
+/* What a connection looked like the last time */
+struct shadow
+{
+  struct tcp_pcb *pcb;
+  struct tuple tuple;
+  unsigned int gen;
+  uint8_t state;
+  uint8_t nrtx;
+  uint8_t in_recovery;
+  uint32_t cwnd, ssthresh;
+  uint32_t snd_wnd, rcv_wnd;
+};
+
+/* What a reader of the node wants, and what it didn't read yet */
+struct trace_reader
+{
+  uint64_t cursor;		/* Next event to look at */
+
+  int filtered;
+  struct tuple filter;
+  int any_local_ip, any_local_port, any_remote_ip, any_remote_port;
+
+  /* Readers of the same open */
+  pthread_mutex_t lock;
+
+  /* Events formatted and not read yet, protected by the lock */
+  char *out;
+  size_t out_len, out_offs;
+};
+
+/* Events copied at most for a read */
+#define TRACE_BATCH  128
+
+int tcptrace_enabled;
+char *tcptrace_node_path;
+
+/* Only used from the tcpip thread */
+static struct tcptrace_event events[TCPTRACE_EVENTS];
+static uint64_t next_event;
+static struct hurd_ihash shadows =
+  HURD_IHASH_INITIALIZER (HURD_IHASH_NO_LOCP);
+static unsigned int generation;
+
+static struct port_class *tcptrace_cntlclass;
+static struct port_class *tcptrace_class;
+
+static uint64_t
+now_us (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void
+get_tuple (struct tcp_pcb *pcb, struct tuple *tuple)
+{
+  ip_addr_copy (tuple->local_ip, pcb->local_ip);
+  ip_addr_copy (tuple->remote_ip, pcb->remote_ip);
+  tuple->local_port = pcb->local_port;
+  tuple->remote_port = pcb->remote_port;
+}
+
+static int
+same_tuple (struct tuple *a, struct tuple *b)
+{
+  return a->local_port == b->local_port
+    && a->remote_port == b->remote_port
+    && ip_addr_cmp (&a->local_ip, &b->local_ip)
+    && ip_addr_cmp (&a->remote_ip, &b->remote_ip);
+}
+
+/* Add an event of TYPE about S, with the rest taken from PCB if any */
+static struct tcptrace_event *
+record (enum tcptrace_type type, struct shadow *s, struct tcp_pcb *pcb)
+{
+  struct tcptrace_event *ev;
+
+  ev = &events[next_event++ % TCPTRACE_EVENTS];
+  memset (ev, 0, sizeof (*ev));
+
+  ev->time = now_us ();
+  ev->type = type;
+  ev->tuple = s->tuple;
+  ev->old_state = s->state;
+
+  if (pcb)
+    {
+      ev->state = pcb->state;
+      ev->cwnd = pcb->cwnd;
+      ev->ssthresh = pcb->ssthresh;
+      ev->snd_wnd = pcb->snd_wnd;
+      ev->rcv_wnd = pcb->rcv_ann_wnd;
+      ev->srtt_ms = (pcb->sa >> 3) * TCP_SLOW_INTERVAL;
+      ev->rto_ms = pcb->rto * TCP_SLOW_INTERVAL;
+      ev->nrtx = pcb->nrtx;
+    }
+  else
+    ev->state = CLOSED;
+
+  return ev;
+}
+
+static void
+shadow_set (struct shadow *s, struct tcp_pcb *pcb)
+{
+  s->state = pcb->state;
+  s->nrtx = pcb->nrtx;
+  s->in_recovery = !!(pcb->flags & TF_INFR);
+  s->cwnd = pcb->cwnd;
+  s->ssthresh = pcb->ssthresh;
+  s->snd_wnd = pcb->snd_wnd;
+  s->rcv_wnd = pcb->rcv_ann_wnd;
+}
+
+/* Start following PCB, as TUPLE */
+static void
+shadow_init (struct shadow *s, struct tcp_pcb *pcb, struct tuple *tuple)
+{
+  s->tuple = *tuple;
+  shadow_set (s, pcb);
+
+  /* New connections start from CLOSED, those found later as they are */
+  if (pcb->state == SYN_SENT || pcb->state == SYN_RCVD)
+    s->state = CLOSED;
+}
+
+/* Find what PCB looked like, or start following it */
+static struct shadow *
+shadow_get (struct tcp_pcb *pcb)
+{
+  struct shadow *s;
+  struct tuple tuple;
+
+  get_tuple (pcb, &tuple);
+
+  s = hurd_ihash_find (&shadows, (hurd_ihash_key_t) pcb);
+  if (s)
+    {
+      if (!same_tuple (&s->tuple, &tuple))
+	{
+	  /* The old connection is gone, and this one took its place */
+	  record (EV_CLOSED, s, 0);
+	  shadow_init (s, pcb, &tuple);
+	}
+      return s;
+    }
+
+  s = calloc (1, sizeof (struct shadow));
+  if (!s)
+    return 0;
+
+  s->pcb = pcb;
+  if (hurd_ihash_add (&shadows, (hurd_ihash_key_t) pcb, s))
+    {
+      free (s);
+      return 0;
+    }
+
+  shadow_init (s, pcb, &tuple);
+
+  return s;
+}
+
+/* Record what changed in PCB since it was last looked at */
+static void
+look (struct tcp_pcb *pcb)
+{
+  struct shadow *s;
+  int in_recovery;
+
+  if (pcb->state == LISTEN)
+    return;
+
+  s = shadow_get (pcb);
+  if (!s)
+    return;
+
+  s->gen = generation;
+  in_recovery = !!(pcb->flags & TF_INFR);
+
+  if (pcb->state != s->state)
+    record (EV_STATE, s, pcb);
+  if (pcb->nrtx > s->nrtx)
+    record (EV_RTO, s, pcb);
+  if (in_recovery && !s->in_recovery)
+    record (EV_FAST_RECOVERY, s, pcb);
+  if (pcb->cwnd != s->cwnd || pcb->ssthresh != s->ssthresh)
+    record (EV_CWND, s, pcb);
+
+  /* Windows only mean something once the handshake is over */
+  if (pcb->state >= ESTABLISHED && s->state >= ESTABLISHED)
+    {
+      if (pcb->snd_wnd == 0 && s->snd_wnd != 0)
+	record (EV_ZERO_WINDOW, s, pcb);
+      else if (pcb->snd_wnd != 0 && s->snd_wnd == 0)
+	record (EV_WINDOW_OPEN, s, pcb);
+
+      if (pcb->rcv_ann_wnd == 0 && s->rcv_wnd != 0)
+	record (EV_RCV_ZERO_WINDOW, s, pcb);
+      else if (pcb->rcv_ann_wnd != 0 && s->rcv_wnd == 0)
+	record (EV_RCV_WINDOW_OPEN, s, pcb);
+    }
+
+  shadow_set (s, pcb);
+}
+
+err_t
+tcptrace_input_hook (struct tcp_pcb *pcb)
+{
+  look (pcb);
+  return ERR_OK;
+}
+
+u32_t *
+tcptrace_output_hook (struct pbuf *p, struct tcp_hdr *hdr,
+		      struct tcp_pcb *pcb, u32_t * opts)
+{
+  struct shadow *s;
+  struct tcptrace_event *ev;
+  uint32_t seqno, len;
+
+  /* Resets may not have a connection */
+  if (!pcb || pcb->state == LISTEN)
+    return opts;
+
+  look (pcb);
+
+  /* Below what was sent already, and not a keepalive probe */
+  seqno = lwip_ntohl (hdr->seqno);
+  len = p->tot_len - TCPH_HDRLEN_BYTES (hdr);
+  if (TCP_SEQ_LT (seqno, pcb->snd_nxt)
+      && (len > 0 || (TCPH_FLAGS (hdr) & (TCP_SYN | TCP_FIN))))
+    {
+      s = hurd_ihash_find (&shadows, (hurd_ihash_key_t) pcb);
+      if (s)
+	{
+	  ev = record (EV_RETRANSMIT, s, pcb);
+	  ev->seqno = seqno;
+	}
+    }
+
+  return opts;
+}
+
+/* Forget about every connection */
+static void
+shadows_clear (void)
+{
+  HURD_IHASH_ITERATE (&shadows, value) free (value);
+  hurd_ihash_destroy (&shadows);
+  hurd_ihash_init (&shadows, HURD_IHASH_NO_LOCP);
+}
+
+/* Record the connections gone since the last pass */
+static void
+sweep (void)
+{
+  struct shadow *s;
+  int again;
+
+  do
+    {
+      again = 0;
+      HURD_IHASH_ITERATE (&shadows, value)
+      {
+	s = value;
+	if (s->gen != generation)
+	  {
+	    record (EV_CLOSED, s, 0);
+	    hurd_ihash_remove (&shadows, (hurd_ihash_key_t) s->pcb);
+	    free (s);
+	    again = 1;
+	    break;
+	  }
+      }
+    }
+  while (again);
+}
+
+static void
+trace_pass (void *arg)
+{
+  struct tcp_pcb *pcb;
+
+  if (!__atomic_load_n (&tcptrace_enabled, __ATOMIC_RELAXED))
+    {
+      /* Start afresh when enabled again */
+      if (shadows.nr_items)
+	shadows_clear ();
+    }
+  else
+    {
+      generation++;
+      for (pcb = tcp_active_pcbs; pcb; pcb = pcb->next)
+	look (pcb);
+      for (pcb = tcp_tw_pcbs; pcb; pcb = pcb->next)
+	look (pcb);
+      sweep ();
+    }
+
+  sys_timeout (TCPTRACE_INTERVAL_MS, trace_pass, 0);
+}
+
+void
+tcptrace_init (void)
+{
+  tcpip_callback (trace_pass, 0);
+}
+
+/* Whether EV is about a connection R wants */
+static int
+wanted (struct trace_reader *r, struct tcptrace_event *ev)
+{
+  struct tuple *t = &ev->tuple;
+
+  if (!r->filtered)
+    return 1;
+
+  return (r->any_local_ip || ip_addr_cmp (&t->local_ip, &r->filter.local_ip))
+    && (r->any_local_port || t->local_port == r->filter.local_port)
+    && (r->any_remote_ip
+	|| ip_addr_cmp (&t->remote_ip, &r->filter.remote_ip))
+    && (r->any_remote_port || t->remote_port == r->filter.remote_port);
+}
+
+struct copy_msg
+{
+  struct tcpip_api_call_data call;
+  struct trace_reader *reader;
+  struct tcptrace_event events[TRACE_BATCH];
+  size_t num;
+  uint64_t lost;
+  int more;			/* Events left to look at */
+};
+
+/* Copy the events the reader wants from where it was, in the tcpip
+   thread */
+static err_t
+do_copy_events (struct tcpip_api_call_data *call)
+{
+  struct copy_msg *msg = (struct copy_msg *) call;
+  struct trace_reader *r = msg->reader;
+  struct tcptrace_event *ev;
+  uint64_t oldest;
+
+  oldest = next_event > TCPTRACE_EVENTS ? next_event - TCPTRACE_EVENTS : 0;
+  msg->lost = r->cursor < oldest ? oldest - r->cursor : 0;
+  if (r->cursor < oldest)
+    r->cursor = oldest;
+
+  msg->num = 0;
+  while (r->cursor < next_event && msg->num < TRACE_BATCH)
+    {
+      ev = &events[r->cursor++ % TCPTRACE_EVENTS];
+      if (wanted (r, ev))
+	msg->events[msg->num++] = *ev;
+    }
+  msg->more = r->cursor < next_event;
+
+  return ERR_OK;
+}
+
+static void
+print_event (FILE * f, struct tcptrace_event *ev)
+{
+  char local[IPADDR_STRLEN_MAX], remote[IPADDR_STRLEN_MAX];
+
+  ipaddr_ntoa_r (&ev->tuple.local_ip, local, sizeof local);
+  ipaddr_ntoa_r (&ev->tuple.remote_ip, remote, sizeof remote);
+
+  fprintf (f, "%" PRIu64 " %s %u %s %u %s", ev->time,
+	   local, ev->tuple.local_port, remote, ev->tuple.remote_port,
+	   type_names[ev->type]);
+
+  if (ev->type == EV_CLOSED)
+    {
+      fprintf (f, " last=%s\n", state_names[ev->old_state]);
+      return;
+    }
+
+  if (ev->type == EV_STATE)
+    fprintf (f, " from=%s", state_names[ev->old_state]);
+  if (ev->type == EV_RETRANSMIT)
+    fprintf (f, " seqno=%u", ev->seqno);
+
+  fprintf (f, " state=%s cwnd=%u ssthresh=%u snd_wnd=%u rcv_wnd=%u"
+	   " srtt_ms=%u rto_ms=%u nrtx=%u\n",
+	   state_names[ev->state], ev->cwnd, ev->ssthresh, ev->snd_wnd,
+	   ev->rcv_wnd, ev->srtt_ms, ev->rto_ms, ev->nrtx);
+}
+
+/* Format the next events R wants, if any. Called with its lock held */
+static error_t
+fill (struct trace_reader *r)
+{
+  struct copy_msg *msg;
+  FILE *f;
+  size_t i;
+
+  msg = malloc (sizeof (struct copy_msg));
+  if (!msg)
+    return ENOMEM;
+
+  free (r->out);
+  r->out = 0;
+  r->out_len = r->out_offs = 0;
+
+  f = open_memstream (&r->out, &r->out_len);
+  if (!f)
+    {
+      free (msg);
+      return errno;
+    }
+
+  /* Skip the batches it doesn't want */
+  msg->reader = r;
+  do
+    {
+      tcpip_api_call (do_copy_events, &msg->call);
+
+      if (msg->lost)
+	fprintf (f, "# %" PRIu64 " events lost\n", msg->lost);
+      for (i = 0; i < msg->num; i++)
+	print_event (f, &msg->events[i]);
+    }
+  while (msg->num == 0 && !msg->lost && msg->more);
+
+  free (msg);
+
+  if (fclose (f))
+    return ENOMEM;
+
+  return 0;
+}
+
+error_t
+tcptrace_node_create (const char *path)
+{
+  return trivfs_node_create (path, 0600, tcptrace_cntlclass, tcptrace_class,
+			     &tcptrace_node_path);
+}
+
+/* Only the owner of the translator sees everybody's connections */
+static error_t
+tcptrace_check_open (struct trivfs_control *cntl, struct iouser *user,
+		     int flags)
+{
+  if (flags == O_NORW)
+    return 0;
+
+  if (!idvec_contains (user->uids, 0)
+      && !idvec_contains (user->uids, lwip_owner))
+    return EPERM;
+
+  return 0;
+}
+
+static error_t
+tcptrace_po_create (struct trivfs_peropen *po)
+{
+  struct trace_reader *r;
+
+  r = calloc (1, sizeof (struct trace_reader));
+  if (!r)
+    return ENOMEM;
+
+  pthread_mutex_init (&r->lock, 0);
+  po->hook = r;
+
+  return 0;
+}
+
+static void
+tcptrace_po_destroy (struct trivfs_peropen *po)
+{
+  struct trace_reader *r = po->hook;
+
+  if (!r)
+    return;
+
+  pthread_mutex_destroy (&r->lock);
+  free (r->out);
+  free (r);
+}
+
+static error_t
+tcptrace_read (struct trivfs_protid *cred, char **data,
+	       mach_msg_type_number_t * data_len, loff_t offs, size_t amount)
+{
+  error_t err;
+  struct trace_reader *r = cred->po->hook;
+
+  if (!(cred->po->openmodes & O_READ))
+    return EBADF;
+
+  pthread_mutex_lock (&r->lock);
+
+  if (r->out_offs == r->out_len)
+    {
+      err = fill (r);
+      if (err)
+	{
+	  pthread_mutex_unlock (&r->lock);
+	  return err;
+	}
+    }
+
+  if (amount > r->out_len - r->out_offs)
+    amount = r->out_len - r->out_offs;
+
+  if (amount > 0)
+    {
+      /* Possibly allocate a new buffer. */
+      if (*data_len < amount)
+	{
+	  *data = mmap (0, amount, PROT_READ | PROT_WRITE, MAP_ANON, 0, 0);
+	  if (*data == MAP_FAILED)
+	    {
+	      pthread_mutex_unlock (&r->lock);
+	      return ENOMEM;
+	    }
+	}
+
+      memcpy (*data, r->out + r->out_offs, amount);
+    }
+  *data_len = amount;
+  r->out_offs += amount;
+
+  pthread_mutex_unlock (&r->lock);
+
+  return 0;
+}
+
+/* Parse a field of the filter, `*' sets ANY */
+static error_t
+parse_addr (char *field, ip_addr_t * addr, int *any)
+{
+  *any = strcmp (field, "*") == 0;
+  if (!*any && !ipaddr_aton (field, addr))
+    return EINVAL;
+
+  return 0;
+}
+
+static error_t
+parse_port (char *field, uint16_t * port, int *any)
+{
+  char *end;
+  unsigned long n;
+
+  *any = strcmp (field, "*") == 0;
+  if (*any)
+    return 0;
+
+  n = strtoul (field, &end, 10);
+  if (*end || n > UINT16_MAX)
+    return EINVAL;
+
+  *port = n;
+  return 0;
+}
+
+struct filter_msg
+{
+  struct tcpip_api_call_data call;
+  struct trace_reader *reader;
+  struct trace_reader *filter;
+};
+
+static err_t
+do_set_filter (struct tcpip_api_call_data *call)
+{
+  struct filter_msg *msg = (struct filter_msg *) call;
+  struct trace_reader *r = msg->reader, *f = msg->filter;
+
+  r->filtered = f->filtered;
+  r->filter = f->filter;
+  r->any_local_ip = f->any_local_ip;
+  r->any_local_port = f->any_local_port;
+  r->any_remote_ip = f->any_remote_ip;
+  r->any_remote_port = f->any_remote_port;
+
+  return ERR_OK;
+}
+
+static error_t
+tcptrace_write (struct trivfs_protid *cred, char *data,
+		mach_msg_type_number_t data_len,
+		mach_msg_type_number_t * amount)
+{
+  error_t err;
+  struct trace_reader *r = cred->po->hook, new;
+  struct filter_msg msg;
+  char *line, *fields[4], *p, *save;
+  int n;
+
+  memset (&new, 0, sizeof (new));
+
+  line = strndup (data, data_len);
+  if (!line)
+    return ENOMEM;
+
+  n = 0;
+  for (p = strtok_r (line, " \t\n", &save); p;
+       p = strtok_r (0, " \t\n", &save))
+    {
+      if (n == 4)
+	break;
+      fields[n++] = p;
+    }
+
+  err = 0;
+  if (n == 4 && !p)
+    {
+      new.filtered = 1;
+      err = parse_addr (fields[0], &new.filter.local_ip, &new.any_local_ip);
+      if (!err)
+	err = parse_port (fields[1], &new.filter.local_port,
+			  &new.any_local_port);
+      if (!err)
+	err = parse_addr (fields[2], &new.filter.remote_ip,
+			  &new.any_remote_ip);
+      if (!err)
+	err = parse_port (fields[3], &new.filter.remote_port,
+			  &new.any_remote_port);
+    }
+  else if (n != 0)
+    err = EINVAL;
+
+  free (line);
+  if (err)
+    return err;
+
+  /*
+   * Readers compare it in the tcpip thread. Taking the lock lets a read
+   * in progress finish with the former filter.
+   */
+  msg.reader = r;
+  msg.filter = &new;
+  pthread_mutex_lock (&r->lock);
+  tcpip_api_call (do_set_filter, &msg.call);
+  pthread_mutex_unlock (&r->lock);
+
+  *amount = data_len;
+
+  return 0;
+}
+
+static error_t
+tcptrace_readable (struct trivfs_protid *cred,
+		   mach_msg_type_number_t * amount)
+{
+  struct trace_reader *r = cred->po->hook;
+
+  pthread_mutex_lock (&r->lock);
+  *amount = r->out_len - r->out_offs;
+  pthread_mutex_unlock (&r->lock);
+
+  return 0;
+}
+
+static void
+tcptrace_modify_stat (struct trivfs_protid *cred, io_statbuf_t * st)
+{
+  st->st_size = 0;
+  st->st_mode &= ~(S_IFMT | 077);
+  st->st_mode |= S_IFCHR;
+}
+
+static const struct trivfs_node_ops tcptrace_ops = {
+  .check_open = tcptrace_check_open,
+  .po_create = tcptrace_po_create,
+  .po_destroy = tcptrace_po_destroy,
+  .modify_stat = tcptrace_modify_stat,
+  .read = tcptrace_read,
+  .write = tcptrace_write,
+  .readable = tcptrace_readable,
+};
+
+error_t
+tcptrace_module_init (void)
+{
+  return trivfs_node_register (&tcptrace_cntlclass, &tcptrace_class, &tcptrace_ops);
+}
@@ -0,0 +1,56 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* TCP event tracing */
+
+#ifndef LWIP_TCPTRACE_H
+#define LWIP_TCPTRACE_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <hurd/trivfs.h>
+
+/* Events kept, the oldest are overwritten */
+#define TCPTRACE_EVENTS       4096
+
+/* Time between two looks at the connections between segments */
+#define TCPTRACE_INTERVAL_MS  100
+
+/* Whether events are being recorded, it can change any time */
+extern int tcptrace_enabled;
+
+/* Start looking at the connections, the stack must be running */
+void tcptrace_init (void);
+
+/*
+ * The trace node. Each open reads the events recorded since the oldest
+ * one kept, one line each, and then what comes later. Writing
+ * "LOCAL_ADDR LOCAL_PORT REMOTE_ADDR REMOTE_PORT" to the open, with `*'
+ * for any, only shows those connections. An empty write shows them all.
+ */
+error_t tcptrace_module_init (void);
+
+/* Serve the trace on PATH */
+error_t tcptrace_node_create (const char *path);
+
+/* Where it's served, or NULL */
+extern char *tcptrace_node_path;
+
+#endif /* LWIP_TCPTRACE_H */
@@ -0,0 +1,676 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* TCP buffer autotuning */
+
+#include <tcptune.h>
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <hurd/ihash.h>
+
+#include <lwip/sys.h>
+#include <lwip/tcp.h>
+#include <lwip/tcpip.h>
+#include <lwip/api.h>
+#include <lwip/priv/tcp_priv.h>
+
+/*
+ * LwIP gives every connection the same receive window and send buffer,
+ * TCP_WND and TCP_SND_BUF, fixed when it's built. Those have to be large
+ * for fast, distant peers, and most connections never use them.
+ *
+ * Every TCPTUNE_INTERVAL_MS, this pass measures what each established
+ * connection delivered and its smoothed RTT, and sizes its buffers to
+ * twice the bandwidth-delay product: quickly up, slowly down. The rest
+ * is withheld: taken off the window LwIP announces, and off the space
+ * it lets the application write. LwIP adds to both as data is read and
+ * acknowledged, so what's withheld stays withheld until given back.
+ *
+ * Nothing can grow beyond the compiled sizes, and the window can only
+ * exceed 64 KiB when LwIP is built with LWIP_WND_SCALE.
+ *
+ * When all the buffers together go over tcptune_mem_limit, the next
+ * pass scales them down in proportion. SO_RCVBUF and SO_SNDBUF fix the
+ * size of a socket instead.
+ *
+ * The pass also accounts the memory each socket pins: received data not
+ * read yet, out of order segments and data not acknowledged, by socket
+ * and by owner. When that goes over three quarters of the limit, the
+ * stack is under pressure until it's back under half: buffers don't
+ * grow and shrink faster. Over the limit, or over tcptune_user_limit
+ * for a user, the worst offenders are pruned. Their out of order
+ * segments are dropped and their buffers cut to the minimum, so they
+ * can't take more until they read what they have. Closed connections
+ * still sending are reset. Privileged sockets are never pruned for
+ * their user's usage.
+ */
+
+struct tune
+{
+  struct tcp_pcb *pcb;		/* Connection the state below is about */
+
+  uint32_t rcv_cap, snd_cap;	/* Current sizes */
+  uint32_t rcv_withheld, snd_withheld;
+
+  uint32_t rcv_nxt, lastack;	/* Sequence numbers at the last pass */
+  uint32_t time;
+
+  /* Sizes asked with SO_RCVBUF and SO_SNDBUF, or 0 */
+  uint32_t rcv_fixed, snd_fixed;
+
+  uid_t owner;
+  int privileged;
+  uint32_t mem;			/* Memory pinned at the last pass */
+  int pruned;
+};
+
+/* Memory pinned by the sockets of a user */
+struct user_mem
+{
+  uid_t uid;
+  uint64_t mem;			/* At the last pass */
+  uint64_t acc;			/* Being accounted */
+  int offender;
+};
+
+uint32_t tcptune_mem_limit;
+uint32_t tcptune_user_limit;
+
+/* Tuning state by socket number */
+static struct hurd_ihash tunes =
+  HURD_IHASH_INITIALIZER (HURD_IHASH_NO_LOCP);
+static pthread_mutex_t tunes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Usage by owner, only used from the tcpip thread */
+static struct hurd_ihash users =
+  HURD_IHASH_INITIALIZER (HURD_IHASH_NO_LOCP);
+
+/* Buffer memory at the last pass */
+static uint64_t total_mem;
+
+static struct tcptune_stats stats;
+
+#define TUNE_COUNT(field) \
+  __atomic_add_fetch (&stats.field, 1, __ATOMIC_RELAXED)
+
+#define RCV_MIN         (2 * TCP_MSS)
+#define SND_MIN         (TCP_SNDLOWAT + TCP_MSS)
+#define RCV_START       LWIP_MIN (TCP_WND, 16 * TCP_MSS)
+#define SND_START       LWIP_MIN (TCP_SND_BUF, 16 * TCP_MSS)
+
+static uint32_t
+clamp (uint64_t size, uint32_t min, uint32_t max)
+{
+  if (size < min)
+    return min;
+  if (size > max)
+    return max;
+  return size;
+}
+
+/* Find the state of SOCKNO, or add it, with the state locked */
+static struct tune *
+tune_get (int sockno)
+{
+  struct tune *t;
+
+  t = hurd_ihash_find (&tunes, sockno);
+  if (!t)
+    {
+      t = calloc (1, sizeof (struct tune));
+      if (!t)
+	return 0;
+      t->owner = -1;
+      if (hurd_ihash_add (&tunes, sockno, t))
+	{
+	  free (t);
+	  return 0;
+	}
+    }
+
+  return t;
+}
+
+/* Next size for a buffer at CAP, BYTES having gone through in DT ms */
+static uint32_t
+next_cap (uint32_t cap, uint32_t bytes, uint32_t dt, uint32_t rtt)
+{
+  uint64_t target;
+
+  target = 2 * (uint64_t) bytes * rtt / dt;
+
+  if (target > cap)
+    return target < 2 * (uint64_t) cap ? target : 2 * (uint64_t) cap;
+  else
+    return target > cap - cap / 8 ? target : cap - cap / 8;
+}
+
+/* Bring the receive window of PCB to CAP */
+static void
+set_rcv_cap (struct tune *t, struct tcp_pcb *pcb, uint32_t cap)
+{
+  uint32_t withheld = TCP_WND_MAX (pcb) - cap;
+  uint32_t take, give, announced;
+
+  if (withheld > t->rcv_withheld)
+    {
+      /* Don't take back what the peer was told it may send */
+      announced = pcb->rcv_ann_right_edge - pcb->rcv_nxt;
+      if (pcb->rcv_wnd <= announced)
+	return;
+
+      take = withheld - t->rcv_withheld;
+      if (take > pcb->rcv_wnd - announced)
+	take = pcb->rcv_wnd - announced;
+
+      pcb->rcv_wnd -= take;
+      t->rcv_withheld += take;
+    }
+  else
+    while (withheld < t->rcv_withheld)
+      {
+	give = t->rcv_withheld - withheld;
+	if (give > 0xffff)
+	  give = 0xffff;
+
+	tcp_recved (pcb, give);
+	t->rcv_withheld -= give;
+      }
+}
+
+/* Bring the send buffer of PCB to CAP */
+static void
+set_snd_cap (struct tune *t, struct tcp_pcb *pcb, uint32_t cap)
+{
+  uint32_t withheld = TCP_SND_BUF - cap;
+  uint32_t take;
+
+  if (withheld > t->snd_withheld)
+    {
+      /* What's already queued is taken back as it's acknowledged */
+      take = withheld - t->snd_withheld;
+      if (take > pcb->snd_buf)
+	take = pcb->snd_buf;
+
+      pcb->snd_buf -= take;
+      t->snd_withheld += take;
+    }
+  else
+    {
+      pcb->snd_buf += t->snd_withheld - withheld;
+      t->snd_withheld = withheld;
+    }
+}
+
+static void
+tune_pcb (struct tune *t, struct tcp_pcb *pcb, uint32_t now, uint32_t scale,
+	  int pressure, int offender)
+{
+  uint32_t dt, rtt, rcv_cap, snd_cap;
+
+  if (t->pcb != pcb)
+    {
+      /* New connection on this socket */
+      t->pcb = pcb;
+      t->rcv_withheld = t->snd_withheld = 0;
+      t->rcv_nxt = pcb->rcv_nxt;
+      t->lastack = pcb->lastack;
+      t->time = now;
+
+      rcv_cap = RCV_START;
+      snd_cap = SND_START;
+    }
+  else
+    {
+      dt = now - t->time;
+      if (dt == 0)
+	return;
+
+      /* The smoothed RTT is kept in eighths of a slow timer tick */
+      rtt = (pcb->sa >> 3) * TCP_SLOW_INTERVAL;
+      if (rtt < TCP_SLOW_INTERVAL)
+	rtt = TCP_SLOW_INTERVAL;
+
+      rcv_cap = next_cap (t->rcv_cap, pcb->rcv_nxt - t->rcv_nxt, dt, rtt);
+      snd_cap = next_cap (t->snd_cap, pcb->lastack - t->lastack, dt, rtt);
+
+      if (pressure)
+	{
+	  rcv_cap = LWIP_MIN (rcv_cap, t->rcv_cap - t->rcv_cap / 4);
+	  snd_cap = LWIP_MIN (snd_cap, t->snd_cap - t->snd_cap / 4);
+	}
+
+      t->rcv_nxt = pcb->rcv_nxt;
+      t->lastack = pcb->lastack;
+      t->time = now;
+    }
+
+  rcv_cap = (uint64_t) rcv_cap * scale / 1024;
+  snd_cap = (uint64_t) snd_cap * scale / 1024;
+
+  if (t->rcv_fixed)
+    rcv_cap = t->rcv_fixed;
+  if (t->snd_fixed)
+    snd_cap = t->snd_fixed;
+
+  if (offender)
+    rcv_cap = snd_cap = 0;
+
+  t->rcv_cap = clamp (rcv_cap, RCV_MIN, TCP_WND_MAX (pcb));
+  t->snd_cap = clamp (snd_cap, SND_MIN, TCP_SND_BUF);
+
+  set_rcv_cap (t, pcb, t->rcv_cap);
+  set_snd_cap (t, pcb, t->snd_cap);
+}
+
+/* Bytes of data in the segments of LIST */
+static uint32_t
+seg_bytes (struct tcp_seg *list)
+{
+  uint32_t bytes = 0;
+
+  for (; list; list = list->next)
+    bytes += list->p->tot_len;
+
+  return bytes;
+}
+
+/* Data PCB received in order and not read yet, it's out of the window */
+static uint32_t
+pcb_unread (struct tcp_pcb *pcb, struct tune *t)
+{
+  uint32_t unread = TCP_WND_MAX (pcb);
+
+  if (t && t->pcb == pcb)
+    unread -= t->rcv_withheld;
+
+  return unread > pcb->rcv_wnd ? unread - pcb->rcv_wnd : 0;
+}
+
+/* Memory pinned by PCB, T being its state or NULL once closed */
+static uint32_t
+pcb_mem (struct tcp_pcb *pcb, struct tune *t)
+{
+  uint32_t mem;
+
+  mem = seg_bytes (pcb->unsent) + seg_bytes (pcb->unacked);
+#if TCP_QUEUE_OOSEQ
+  mem += seg_bytes (pcb->ooseq);
+#endif
+  if (pcb->refused_data)
+    mem += pcb->refused_data->tot_len;
+
+  if (t && t->pcb == pcb)
+    mem += pcb_unread (pcb, t);
+
+  return mem;
+}
+
+static struct user_mem *
+user_get (uid_t uid)
+{
+  struct user_mem *u;
+
+  u = hurd_ihash_find (&users, uid);
+  if (!u)
+    {
+      u = calloc (1, sizeof (struct user_mem));
+      if (!u)
+	return 0;
+      u->uid = uid;
+      if (hurd_ihash_add (&users, uid, u))
+	{
+	  free (u);
+	  return 0;
+	}
+    }
+
+  return u;
+}
+
+/* Take the sockets of PCB, if any */
+static struct tune *
+pcb_tune (struct tcp_pcb *pcb)
+{
+  struct netconn *conn = pcb->callback_arg;
+
+  /* Connections being closed have no socket any more */
+  if (!conn || conn->socket < 0)
+    return 0;
+
+  return tune_get (conn->socket);
+}
+
+/* Account the memory of every connection, return the total */
+static uint64_t
+account (void)
+{
+  struct tcp_pcb *pcb;
+  struct tune *t;
+  struct user_mem *u;
+  uint64_t total = 0;
+
+  for (pcb = tcp_active_pcbs; pcb; pcb = pcb->next)
+    {
+      t = pcb_tune (pcb);
+      if (!t)
+	{
+	  total += pcb_mem (pcb, 0);
+	  continue;
+	}
+
+      t->mem = pcb_mem (pcb, t);
+      total += t->mem;
+
+      u = t->privileged ? 0 : user_get (t->owner);
+      if (u)
+	u->acc += t->mem;
+    }
+
+  return total;
+}
+
+/* Pick the users whose sockets get pruned */
+static void
+find_offenders (int critical)
+{
+  struct user_mem *worst = 0;
+  uint32_t user_limit;
+
+  user_limit = __atomic_load_n (&tcptune_user_limit, __ATOMIC_RELAXED);
+
+  HURD_IHASH_ITERATE (&users, value)
+  {
+    struct user_mem *u = value;
+
+    u->mem = u->acc;
+    u->acc = 0;
+    u->offender = user_limit && u->mem > user_limit;
+
+    if (u->mem && (!worst || u->mem > worst->mem))
+      worst = u;
+  }
+
+  /* When everything is short, the one taking the most */
+  if (critical && worst)
+    worst->offender = 1;
+}
+
+/* Drop the users without sockets any more */
+static void
+clean_users (void)
+{
+  struct user_mem *u;
+  int again;
+
+  do
+    {
+      again = 0;
+      HURD_IHASH_ITERATE (&users, value)
+      {
+	u = value;
+	if (!u->mem)
+	  {
+	    hurd_ihash_remove (&users, u->uid);
+	    free (u);
+	    again = 1;
+	    break;
+	  }
+      }
+    }
+  while (again);
+}
+
+/* Drop what can be dropped, tune_pcb () cuts the buffers */
+static void
+prune (struct tune *t, struct tcp_pcb *pcb)
+{
+#if TCP_QUEUE_OOSEQ
+  if (pcb->ooseq)
+    tcp_free_ooseq (pcb);
+#endif
+
+  if (!t->pruned)
+    {
+      t->pruned = 1;
+      TUNE_COUNT (prunes);
+    }
+}
+
+static void
+tune_pass (void *arg)
+{
+  struct tcp_pcb *pcb, *next;
+  struct tune *t;
+  struct user_mem *u;
+  uint32_t now = sys_now (), scale = 1024, limit;
+  uint64_t total = 0, used;
+  int critical, offender;
+
+  limit = __atomic_load_n (&tcptune_mem_limit, __ATOMIC_RELAXED);
+  if (limit && total_mem > limit)
+    scale = limit * 1024ULL / total_mem;
+
+  pthread_mutex_lock (&tunes_lock);
+
+  used = account ();
+  __atomic_store_n (&stats.mem, used, __ATOMIC_RELAXED);
+
+  if (limit && !stats.pressure && used > limit / 4 * 3)
+    {
+      __atomic_store_n (&stats.pressure, 1, __ATOMIC_RELAXED);
+      TUNE_COUNT (pressure_events);
+    }
+  else if (stats.pressure && (!limit || used < limit / 2))
+    __atomic_store_n (&stats.pressure, 0, __ATOMIC_RELAXED);
+
+  critical = limit && used > limit;
+  find_offenders (critical);
+
+  for (pcb = tcp_active_pcbs; pcb; pcb = next)
+    {
+      next = pcb->next;
+
+      /* Nobody will read from a closed one, only what it sends is left */
+      if (!pcb->callback_arg)
+	{
+	  if (critical && (pcb->unsent || pcb->unacked))
+	    {
+	      tcp_abort (pcb);
+	      TUNE_COUNT (aborts);
+	    }
+	  continue;
+	}
+
+      t = pcb_tune (pcb);
+      if (!t)
+	continue;
+
+      u = t->privileged ? 0 : hurd_ihash_find (&users, t->owner);
+      offender = u && u->offender;
+      if (offender)
+	prune (t, pcb);
+      else
+	t->pruned = 0;
+
+      if (pcb->state == ESTABLISHED)
+	tune_pcb (t, pcb, now, scale, stats.pressure, offender);
+      total += t->rcv_cap + t->snd_cap;
+    }
+
+  clean_users ();
+
+  pthread_mutex_unlock (&tunes_lock);
+
+  total_mem = total;
+
+  sys_timeout (TCPTUNE_INTERVAL_MS, tune_pass, 0);
+}
+
+void
+tcptune_init (void)
+{
+  tcpip_callback (tune_pass, 0);
+}
+
+error_t
+tcptune_set_bufsize (int sockno, int option, uint32_t size)
+{
+  struct tune *t;
+  error_t err = 0;
+
+  if (option != SO_RCVBUF && option != SO_SNDBUF)
+    return ENOPROTOOPT;
+
+  pthread_mutex_lock (&tunes_lock);
+  t = tune_get (sockno);
+  if (!t)
+    err = ENOMEM;
+  else
+    {
+      /* The next pass applies it */
+      if (option == SO_RCVBUF)
+	t->rcv_fixed = clamp (size, RCV_MIN, TCP_WND);
+      else
+	t->snd_fixed = clamp (size, SND_MIN, TCP_SND_BUF);
+    }
+  pthread_mutex_unlock (&tunes_lock);
+
+  return err;
+}
+
+uint32_t
+tcptune_get_bufsize (int sockno, int option)
+{
+  struct tune *t;
+  uint32_t size = option == SO_RCVBUF ? TCP_WND : TCP_SND_BUF;
+
+  pthread_mutex_lock (&tunes_lock);
+  t = hurd_ihash_find (&tunes, sockno);
+  if (t && option == SO_RCVBUF)
+    {
+      if (t->rcv_fixed)
+	size = t->rcv_fixed;
+      else if (t->pcb)
+	size = t->rcv_cap;
+    }
+  else if (t)
+    {
+      if (t->snd_fixed)
+	size = t->snd_fixed;
+      else if (t->pcb)
+	size = t->snd_cap;
+    }
+  pthread_mutex_unlock (&tunes_lock);
+
+  return size;
+}
+
+error_t
+tcptune_set_owner (int sockno, uid_t owner, int privileged)
+{
+  struct tune *t;
+
+  pthread_mutex_lock (&tunes_lock);
+  t = tune_get (sockno);
+  if (t)
+    {
+      t->owner = owner;
+      t->privileged = privileged;
+    }
+  pthread_mutex_unlock (&tunes_lock);
+
+  return t ? 0 : ENOMEM;
+}
+
+uid_t
+tcptune_get_owner (int sockno)
+{
+  struct tune *t;
+  uid_t owner;
+
+  pthread_mutex_lock (&tunes_lock);
+  t = hurd_ihash_find (&tunes, sockno);
+  owner = t ? t->owner : -1;
+  pthread_mutex_unlock (&tunes_lock);
+
+  return owner;
+}
+
+uint32_t
+tcptune_get_mem (int sockno)
+{
+  struct tune *t;
+  uint32_t mem;
+
+  pthread_mutex_lock (&tunes_lock);
+  t = hurd_ihash_find (&tunes, sockno);
+  mem = t ? t->mem : 0;
+  pthread_mutex_unlock (&tunes_lock);
+
+  return mem;
+}
+
+uint32_t
+tcptune_get_unread (int sockno, struct tcp_pcb *pcb)
+{
+  uint32_t unread;
+
+  pthread_mutex_lock (&tunes_lock);
+  unread = pcb_unread (pcb, hurd_ihash_find (&tunes, sockno));
+  pthread_mutex_unlock (&tunes_lock);
+
+  return unread;
+}
+
+void
+tcptune_get_stats (struct tcptune_stats *s)
+{
+  s->mem = __atomic_load_n (&stats.mem, __ATOMIC_RELAXED);
+  s->pressure = __atomic_load_n (&stats.pressure, __ATOMIC_RELAXED);
+  s->pressure_events =
+    __atomic_load_n (&stats.pressure_events, __ATOMIC_RELAXED);
+  s->prunes = __atomic_load_n (&stats.prunes, __ATOMIC_RELAXED);
+  s->aborts = __atomic_load_n (&stats.aborts, __ATOMIC_RELAXED);
+}
+
+void
+tcptune_reset_stats (void)
+{
+  __atomic_store_n (&stats.pressure_events, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&stats.prunes, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&stats.aborts, 0, __ATOMIC_RELAXED);
+}
+
+void
+tcptune_forget (int sockno)
+{
+  struct tune *t;
+
+  pthread_mutex_lock (&tunes_lock);
+  t = hurd_ihash_find (&tunes, sockno);
+  if (t)
+    {
+      hurd_ihash_remove (&tunes, sockno);
+      free (t);
+    }
+  pthread_mutex_unlock (&tunes_lock);
+}
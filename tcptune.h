@@ -0,0 +1,79 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* TCP buffer autotuning */
+
+#ifndef LWIP_TCPTUNE_H
+#define LWIP_TCPTUNE_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/types.h>
+
+/* Time between two tuning passes */
+#define TCPTUNE_INTERVAL_MS   250
+
+struct tcptune_stats
+{
+  uint64_t mem;			/* Memory pinned by all the connections */
+  int pressure;			/* Whether buffers are being reduced */
+  uint64_t pressure_events;
+  uint64_t prunes;		/* Sockets pruned */
+  uint64_t aborts;		/* Closed connections reset */
+};
+
+/* Start tuning, the stack must be running */
+void tcptune_init (void);
+
+/*
+ * Fix the receive or send buffer of the socket SOCKNO to SIZE bytes,
+ * instead of tuning it. OPTION is SO_RCVBUF or SO_SNDBUF.
+ */
+error_t tcptune_set_bufsize (int sockno, int option, uint32_t size);
+uint32_t tcptune_get_bufsize (int sockno, int option);
+
+/* Account the memory of SOCKNO to OWNER, unless PRIVILEGED */
+error_t tcptune_set_owner (int sockno, uid_t owner, int privileged);
+uid_t tcptune_get_owner (int sockno);
+
+/* Memory pinned by SOCKNO at the last pass */
+uint32_t tcptune_get_mem (int sockno);
+
+/*
+ * Bytes PCB, the connection of SOCKNO, received and SOCKNO didn't read
+ * yet. Only from the tcpip thread.
+ */
+struct tcp_pcb;
+uint32_t tcptune_get_unread (int sockno, struct tcp_pcb *pcb);
+
+void tcptune_get_stats (struct tcptune_stats *stats);
+
+/* Set the event counters back to 0, the memory in use is kept */
+void tcptune_reset_stats (void);
+
+/* Drop what's known about SOCKNO, it's being closed */
+void tcptune_forget (int sockno);
+
+/* Bytes all the connection buffers may take together, 0 for no limit */
+extern uint32_t tcptune_mem_limit;
+
+/* Bytes the connections of a user may pin, 0 for no limit */
+extern uint32_t tcptune_user_limit;
+
+#endif /* LWIP_TCPTUNE_H */
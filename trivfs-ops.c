@@ -0,0 +1,577 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Trivfs nodes served by the translator */
+
+#include <trivfs-ops.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <hurd.h>
+#include <hurd/ports.h>
+
+#include <lwip-hurd.h>
+
+/*
+ * The kinds of nodes. They're all registered at startup, before any RPC
+ * is served, so lookups don't need a lock.
+ */
+static struct
+{
+  struct port_class *cntlclass;
+  const struct trivfs_node_ops *ops;
+} nodes[TRIVFS_MAX_NODES];
+
+static int nnodes;
+
+/* What an open of a snapshot node reads */
+struct snapshot
+{
+  char *data;
+  size_t len;
+  off_t offs;
+};
+
+error_t
+trivfs_node_register (struct port_class **cntlclass,
+		      struct port_class **protidclass,
+		      const struct trivfs_node_ops *ops)
+{
+  error_t err;
+
+  if (nnodes == TRIVFS_MAX_NODES)
+    return ENOSPC;
+
+  err = trivfs_add_control_port_class (cntlclass);
+  if (!err)
+    err = trivfs_add_protid_port_class (protidclass);
+  if (err)
+    return err;
+
+  nodes[nnodes].cntlclass = *cntlclass;
+  nodes[nnodes].ops = ops;
+  nnodes++;
+
+  return 0;
+}
+
+error_t
+trivfs_node_create (const char *path, mode_t mode,
+		    struct port_class *cntlclass,
+		    struct port_class *protidclass, char **node_path)
+{
+  error_t err;
+  file_t underlying;
+  struct trivfs_control *cntl;
+  mach_port_t right;
+  char *copy;
+
+  if (*node_path && strcmp (*node_path, path) == 0)
+    return 0;
+
+  copy = strdup (path);
+  if (!copy)
+    return ENOMEM;
+
+  underlying = file_name_lookup (path, O_CREAT | O_NOTRANS, mode);
+  if (underlying == MACH_PORT_NULL)
+    {
+      free (copy);
+      return errno;
+    }
+
+  err = trivfs_create_control (underlying, cntlclass, lwip_bucket,
+			       protidclass, lwip_bucket, &cntl);
+  if (!err)
+    {
+      right = ports_get_send_right (cntl);
+      err = file_set_translator (underlying, 0,
+				 FS_TRANS_SET | FS_TRANS_ORPHAN, 0, 0, 0,
+				 right, MACH_MSG_TYPE_COPY_SEND);
+      mach_port_deallocate (mach_task_self (), right);
+      ports_port_deref (cntl);
+    }
+
+  if (err)
+    {
+      free (copy);
+      return err;
+    }
+
+  free (*node_path);
+  *node_path = copy;
+
+  return 0;
+}
+
+error_t
+trivfs_snapshot_create (struct trivfs_peropen *po,
+			error_t (*print) (FILE * f,
+					  struct trivfs_peropen * po))
+{
+  error_t err;
+  struct snapshot *s;
+  FILE *f;
+
+  s = malloc (sizeof (struct snapshot));
+  if (!s)
+    return ENOMEM;
+
+  f = open_memstream (&s->data, &s->len);
+  if (!f)
+    {
+      free (s);
+      return errno;
+    }
+
+  err = print (f, po);
+  if (fclose (f) && !err)
+    err = ENOMEM;
+  if (err)
+    {
+      free (s->data);
+      free (s);
+      return err;
+    }
+
+  s->offs = 0;
+  po->hook = s;
+
+  return 0;
+}
+
+void
+trivfs_snapshot_destroy (struct trivfs_peropen *po)
+{
+  struct snapshot *s = po->hook;
+
+  if (!s)
+    return;
+
+  free (s->data);
+  free (s);
+}
+
+error_t
+trivfs_snapshot_read (struct trivfs_protid *cred, char **data,
+		      mach_msg_type_number_t * data_len, loff_t offs,
+		      size_t amount)
+{
+  struct snapshot *s = cred->po->hook;
+  int advance = offs == -1;
+
+  if (!(cred->po->openmodes & O_READ))
+    return EBADF;
+
+  if (advance)
+    offs = s->offs;
+
+  if (offs >= s->len)
+    amount = 0;
+  else if (amount > s->len - offs)
+    amount = s->len - offs;
+
+  if (amount > 0)
+    {
+      /* Possibly allocate a new buffer. */
+      if (*data_len < amount)
+	{
+	  *data = mmap (0, amount, PROT_READ | PROT_WRITE, MAP_ANON, 0, 0);
+	  if (*data == MAP_FAILED)
+	    return ENOMEM;
+	}
+
+      memcpy (*data, s->data + offs, amount);
+    }
+  *data_len = amount;
+
+  if (advance)
+    s->offs += amount;
+
+  return 0;
+}
+
+error_t
+trivfs_snapshot_readable (struct trivfs_protid *cred,
+			  mach_msg_type_number_t * amount)
+{
+  struct snapshot *s = cred->po->hook;
+
+  *amount = s->offs < s->len ? s->len - s->offs : 0;
+
+  return 0;
+}
+
+error_t
+trivfs_snapshot_seek (struct trivfs_protid *cred, off_t offs, int whence,
+		      off_t * new_offs)
+{
+  struct snapshot *s = cred->po->hook;
+
+  switch (whence)
+    {
+    case SEEK_CUR:
+      offs += s->offs;
+      break;
+    case SEEK_END:
+      offs += s->len;
+      break;
+    case SEEK_SET:
+      break;
+    default:
+      return EINVAL;
+    }
+
+  if (offs < 0)
+    return EINVAL;
+
+  s->offs = *new_offs = offs;
+
+  return 0;
+}
+
+/* Snapshots are read-only regular files of the size of the text */
+void
+trivfs_snapshot_modify_stat (struct trivfs_protid *cred, io_statbuf_t * st)
+{
+  struct snapshot *s = cred->po->hook;
+
+  st->st_size = s ? s->len : 0;
+  st->st_mode &= ~(S_IFMT | 0222);
+  st->st_mode |= S_IFREG;
+}
+
+/* The operations of the node CNTL controls, or NULL */
+static const struct trivfs_node_ops *
+node_ops (struct trivfs_control *cntl)
+{
+  int i;
+
+  for (i = 0; i < nnodes; i++)
+    if (cntl->pi.class == nodes[i].cntlclass)
+      return nodes[i].ops;
+
+  return 0;
+}
+
+/* The operations of the node CRED was opened on, or NULL */
+static const struct trivfs_node_ops *
+cred_ops (struct trivfs_protid *cred)
+{
+  return cred ? node_ops (cred->po->cntl) : 0;
+}
+
+static error_t
+check_open_hook (struct trivfs_control *cntl, struct iouser *user, int flags)
+{
+  const struct trivfs_node_ops *ops = node_ops (cntl);
+
+  if (!ops || !ops->check_open)
+    return 0;
+
+  return ops->check_open (cntl, user, flags);
+}
+
+static error_t
+po_create_hook (struct trivfs_peropen *po)
+{
+  const struct trivfs_node_ops *ops = node_ops (po->cntl);
+
+  if (!ops || !ops->po_create)
+    return 0;
+
+  return ops->po_create (po);
+}
+
+static void
+po_destroy_hook (struct trivfs_peropen *po)
+{
+  const struct trivfs_node_ops *ops = node_ops (po->cntl);
+
+  if (ops && ops->po_destroy)
+    ops->po_destroy (po);
+}
+
+static void
+pi_destroy_hook (struct trivfs_protid *cred)
+{
+  const struct trivfs_node_ops *ops = cred_ops (cred);
+
+  if (ops && ops->protid_destroy)
+    ops->protid_destroy (cred);
+}
+
+/* If this variable is set, it is called every time a new peropen
+   structure is created and initialized. */
+error_t (*trivfs_check_open_hook) (struct trivfs_control *,
+				   struct iouser *, int) = check_open_hook;
+
+/* If this variable is set, it is called every time a peropen structure
+   is created, and every time one is about to be destroyed. */
+error_t (*trivfs_peropen_create_hook) (struct trivfs_peropen *) =
+  po_create_hook;
+void (*trivfs_peropen_destroy_hook) (struct trivfs_peropen *) =
+  po_destroy_hook;
+
+/* If this variable is set, it is called every time a protid structure
+   is about to be destroyed. */
+void (*trivfs_protid_destroy_hook) (struct trivfs_protid *) = pi_destroy_hook;
+
+void
+trivfs_modify_stat (struct trivfs_protid *cred, io_statbuf_t * st)
+{
+  const struct trivfs_node_ops *ops = cred_ops (cred);
+
+  if (ops && ops->modify_stat)
+    ops->modify_stat (cred, st);
+}
+
+/* Read data from an IO object.  If offset is -1, read from the object
+   maintained file pointer.  If the object is not seekable, offset is
+   ignored.  The amount desired to be read is in AMOUNT.  */
+error_t
+trivfs_S_io_read (struct trivfs_protid *cred,
+		  mach_port_t reply, mach_msg_type_name_t reply_type,
+		  char **data, mach_msg_type_number_t * data_len,
+		  loff_t offs, size_t amount)
+{
+  const struct trivfs_node_ops *ops = cred_ops (cred);
+
+  if (!ops || !ops->read)
+    return EOPNOTSUPP;
+
+  return ops->read (cred, data, data_len, offs, amount);
+}
+
+/* Write data to an IO object.  If offset is -1, write at the object
+   maintained file pointer.  If the object is not seekable, offset is
+   ignored.  The amount successfully written is returned in amount.  A
+   given user should not have more than one outstanding io_write on an
+   object at a time; servers implement congestion control by delaying
+   responses to io_write.  Servers may drop data (returning ENOBUFS)
+   if they receive more than one write when not prepared for it.  */
+error_t
+trivfs_S_io_write (struct trivfs_protid * cred,
+		   mach_port_t reply,
+		   mach_msg_type_name_t replytype,
+		   char *data,
+		   mach_msg_type_number_t datalen,
+		   off_t offset, mach_msg_type_number_t * amount)
+{
+  const struct trivfs_node_ops *ops = cred_ops (cred);
+
+  /* Deny access if they have bad credentials. */
+  if (!ops)
+    return EOPNOTSUPP;
+
+  else if (!(cred->po->openmodes & O_WRITE))
+    return EBADF;
+
+  if (!ops->write)
+    return EOPNOTSUPP;
+
+  return ops->write (cred, data, datalen, amount);
+}
+
+/* Tell how much data can be read from the object without blocking for
+   a "long time" (this should be the same meaning of "long time" used
+   by the nonblocking flag.  */
+kern_return_t
+trivfs_S_io_readable (struct trivfs_protid * cred,
+		      mach_port_t reply, mach_msg_type_name_t replytype,
+		      mach_msg_type_number_t * amount)
+{
+  const struct trivfs_node_ops *ops = cred_ops (cred);
+
+  if (!ops || !ops->readable)
+    return EOPNOTSUPP;
+
+  return ops->readable (cred, amount);
+}
+
+/* SELECT_TYPE is the bitwise OR of SELECT_READ, SELECT_WRITE, and SELECT_URG.
+   Block until one of the indicated types of i/o can be done "quickly", and
+   return the types that are then available.  ID_TAG is returned as passed; it
+   is just for the convenience of the user in matching up reply messages with
+   specific requests sent.  */
+static error_t
+io_select_common (struct trivfs_protid *cred,
+		  mach_port_t reply,
+		  mach_msg_type_name_t reply_type,
+		  struct timespec *tsp, int *type)
+{
+  const struct trivfs_node_ops *ops = cred_ops (cred);
+
+  if (!ops)
+    return EOPNOTSUPP;
+
+  /* Nothing to wait for */
+  if (!ops->select)
+    {
+      *type &= SELECT_READ;
+      return 0;
+    }
+
+  /* Make this thread cancellable */
+  ports_interrupt_self_on_port_death (cred, reply);
+
+  return ops->select (cred, tsp, type);
+}
+
+error_t
+trivfs_S_io_select (struct trivfs_protid * cred,
+		    mach_port_t reply,
+		    mach_msg_type_name_t reply_type, int *type)
+{
+  return io_select_common (cred, reply, reply_type, NULL, type);
+}
+
+error_t
+trivfs_S_io_select_timeout (struct trivfs_protid * cred,
+			    mach_port_t reply,
+			    mach_msg_type_name_t reply_type,
+			    struct timespec ts, int *type)
+{
+  return io_select_common (cred, reply, reply_type, &ts, type);
+}
+
+/* Change current read/write offset */
+error_t
+trivfs_S_io_seek (struct trivfs_protid * cred,
+		  mach_port_t reply, mach_msg_type_name_t reply_type,
+		  off_t offs, int whence, off_t * new_offs)
+{
+  const struct trivfs_node_ops *ops = cred_ops (cred);
+
+  if (!ops)
+    return EOPNOTSUPP;
+
+  if (!ops->seek)
+    return ESPIPE;
+
+  return ops->seek (cred, offs, whence, new_offs);
+}
+
+/* Change the size of the file.  If the size increases, new blocks are
+   zero-filled.  After successful return, it is safe to reference mapped
+   areas of the file up to NEW_SIZE.  */
+error_t
+trivfs_S_file_set_size (struct trivfs_protid * cred,
+			mach_port_t reply, mach_msg_type_name_t reply_type,
+			off_t size)
+{
+  const struct trivfs_node_ops *ops = cred_ops (cred);
+
+  if (!ops || !ops->set_size)
+    return EOPNOTSUPP;
+
+  return ops->set_size (cred, size);
+}
+
+/* These four routines modify the O_APPEND, O_ASYNC, O_FSYNC, and
+   O_NONBLOCK bits for the IO object. In addition, io_get_openmodes
+   will tell you which of O_READ, O_WRITE, and O_EXEC the object can
+   be used for.  The O_ASYNC bit affects icky async I/O; good async
+   I/O is done through io_async which is orthogonal to these calls. */
+error_t
+trivfs_S_io_set_all_openmodes (struct trivfs_protid * cred,
+			       mach_port_t reply,
+			       mach_msg_type_name_t reply_type, int mode)
+{
+  if (!cred_ops (cred))
+    return EOPNOTSUPP;
+
+  return 0;
+}
+
+error_t
+trivfs_S_io_set_some_openmodes (struct trivfs_protid * cred,
+				mach_port_t reply,
+				mach_msg_type_name_t reply_type, int bits)
+{
+  if (!cred_ops (cred))
+    return EOPNOTSUPP;
+
+  return 0;
+}
+
+error_t
+trivfs_S_io_clear_some_openmodes (struct trivfs_protid * cred,
+				  mach_port_t reply,
+				  mach_msg_type_name_t reply_type, int bits)
+{
+  if (!cred_ops (cred))
+    return EOPNOTSUPP;
+
+  return 0;
+}
+
+error_t
+trivfs_S_io_get_owner (struct trivfs_protid * cred,
+		       mach_port_t reply,
+		       mach_msg_type_name_t reply_type, pid_t * owner)
+{
+  if (!cred_ops (cred))
+    return EOPNOTSUPP;
+
+  *owner = 0;
+  return 0;
+}
+
+error_t
+trivfs_S_io_mod_owner (struct trivfs_protid * cred,
+		       mach_port_t reply, mach_msg_type_name_t reply_type,
+		       pid_t owner)
+{
+  if (!cred_ops (cred))
+    return EOPNOTSUPP;
+
+  return EINVAL;
+}
+
+/* Return objects mapping the data underlying this memory object.  If
+   the object can be read then memobjrd will be provided; if the
+   object can be written then memobjwr will be provided.  For objects
+   where read data and write data are the same, these objects will be
+   equal, otherwise they will be disjoint.  Servers are permitted to
+   implement io_map but not io_map_cntl.  Some objects do not provide
+   mapping; they will set none of the ports and return an error.  Such
+   objects can still be accessed by io_read and io_write.  */
+error_t
+trivfs_S_io_map (struct trivfs_protid * cred,
+		 mach_port_t reply,
+		 mach_msg_type_name_t replyPoly,
+		 memory_object_t * rdobj,
+		 mach_msg_type_name_t * rdtype,
+		 memory_object_t * wrobj, mach_msg_type_name_t * wrtype)
+{
+  const struct trivfs_node_ops *ops = cred_ops (cred);
+  error_t err;
+
+  if (!ops || !ops->map)
+    return EOPNOTSUPP;
+
+  err = ops->map (cred, rdobj, wrobj);
+  if (!err)
+    *rdtype = *wrtype = MACH_MSG_TYPE_COPY_SEND;
+
+  return err;
+}
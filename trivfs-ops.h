@@ -0,0 +1,115 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Trivfs nodes served by the translator */
+
+#ifndef LWIP_TRIVFS_OPS_H
+#define LWIP_TRIVFS_OPS_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+#include <hurd/trivfs.h>
+
+/* Nodes of one control port class registered at most */
+#define TRIVFS_MAX_NODES  8
+
+/*
+ * What a kind of node does. The translator defines the trivfs routines
+ * and hooks once, and passes each call on to the operations of the node
+ * it's for. Any of them can be NULL:
+ *
+ *   check_open, po_create, po_destroy, protid_destroy, modify_stat
+ *     Nothing is done.
+ *   read, write, readable, set_size, map
+ *     EOPNOTSUPP. Writes are only passed on to opens for writing.
+ *   select
+ *     The node is always readable, and never writable.
+ *   seek
+ *     ESPIPE.
+ */
+struct trivfs_node_ops
+{
+  error_t (*check_open) (struct trivfs_control *cntl, struct iouser *user,
+			 int flags);
+  error_t (*po_create) (struct trivfs_peropen *po);
+  void (*po_destroy) (struct trivfs_peropen *po);
+  void (*protid_destroy) (struct trivfs_protid *cred);
+  void (*modify_stat) (struct trivfs_protid *cred, io_statbuf_t * st);
+
+  error_t (*read) (struct trivfs_protid *cred, char **data,
+		   mach_msg_type_number_t * data_len, loff_t offs,
+		   size_t amount);
+  error_t (*write) (struct trivfs_protid *cred, char *data,
+		    mach_msg_type_number_t data_len,
+		    mach_msg_type_number_t * amount);
+  error_t (*readable) (struct trivfs_protid *cred,
+		       mach_msg_type_number_t * amount);
+  error_t (*select) (struct trivfs_protid *cred, struct timespec *tsp,
+		     int *type);
+  error_t (*seek) (struct trivfs_protid *cred, off_t offs, int whence,
+		   off_t * new_offs);
+  error_t (*set_size) (struct trivfs_protid *cred, off_t size);
+  error_t (*map) (struct trivfs_protid *cred, memory_object_t * rdobj,
+		  memory_object_t * wrobj);
+};
+
+/*
+ * Create the port classes of a kind of node into *CNTLCLASS and
+ * *PROTIDCLASS, and serve the nodes of that kind with OPS. Called once
+ * from the module initialization, before any node is created.
+ */
+error_t trivfs_node_register (struct port_class **cntlclass,
+			      struct port_class **protidclass,
+			      const struct trivfs_node_ops *ops);
+
+/*
+ * Serve a node of the kind of CNTLCLASS and PROTIDCLASS on PATH,
+ * creating the file with MODE if it doesn't exist. *NODE_PATH is where
+ * the previous one was served, it's replaced with PATH. The previous
+ * node keeps working until it goes away. Nothing is done if PATH is
+ * the same.
+ */
+error_t trivfs_node_create (const char *path, mode_t mode,
+			    struct port_class *cntlclass,
+			    struct port_class *protidclass,
+			    char **node_path);
+
+/*
+ * Nodes whose opens read a snapshot, a text built once at open time
+ * and then read like a regular file. Their po_create calls
+ * trivfs_snapshot_create with a function printing the text, and the
+ * other operations are these.
+ */
+error_t trivfs_snapshot_create (struct trivfs_peropen *po,
+				error_t (*print) (FILE * f,
+						  struct trivfs_peropen * po));
+void trivfs_snapshot_destroy (struct trivfs_peropen *po);
+error_t trivfs_snapshot_read (struct trivfs_protid *cred, char **data,
+			      mach_msg_type_number_t * data_len, loff_t offs,
+			      size_t amount);
+error_t trivfs_snapshot_readable (struct trivfs_protid *cred,
+				  mach_msg_type_number_t * amount);
+error_t trivfs_snapshot_seek (struct trivfs_protid *cred, off_t offs,
+			      int whence, off_t * new_offs);
+void trivfs_snapshot_modify_stat (struct trivfs_protid *cred,
+				  io_statbuf_t * st);
+
+#endif /* LWIP_TRIVFS_OPS_H */